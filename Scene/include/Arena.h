@@ -0,0 +1,55 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+
+namespace Water{
+	//A single block of memory which hands out aligned sub allocations.
+	//Everything allocated from the arena is released when it is destroyed.
+	class Arena{
+		public:
+			//Every allocation starts on a cache line boundary
+			static const size_t ALIGNMENT = 64;
+
+			Arena();
+			~Arena();
+
+			Arena(const Arena&) = delete;
+			Arena& operator=(const Arena&) = delete;
+
+			//Maps a block of bytes. If hugePages is set the block is aligned
+			//to 2MB and advised to be backed by transparent huge pages.
+			//Must be called once before allocate
+			void reserve(size_t bytes, bool hugePages);
+
+			//Returns zero filled memory for count objects of type T.
+			//No constructors are run so T should be plain data
+			template<typename T>
+			T* allocate(size_t count){
+				return static_cast<T*>(allocateBytes(count*sizeof(T)));
+			}
+
+			//Bytes needed to allocate count objects of type T from the arena
+			template<typename T>
+			static size_t bytesFor(size_t count){
+				return padded(count*sizeof(T));
+			}
+
+			//Number of bytes handed out so far
+			size_t size(){ return used; }
+
+			//Number of bytes reserved
+			size_t capacity(){ return cap; }
+
+		private:
+			char* base;
+			size_t used;
+			size_t cap;
+			size_t mapped;
+
+			void* allocateBytes(size_t bytes);
+			static size_t padded(size_t bytes);
+	};
+}
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef CELLMAP_H
+#define CELLMAP_H
+
+#include <vector>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+namespace Water{
+	class WorkerGroup;
+
+	//Sparse grid of cubic cells which sorts particles by the cell they are in.
+	//
+	//Only occupied cells are stored, in an open addressing table keyed by the
+	//integer coordinates of the cell. Keys are compared in full so distant
+	//cells never alias, and the table grows and shrinks with the number of
+	//occupied cells, so the domain is only bounded by 32 bit cell coordinates
+	class CellMap{
+		public:
+			struct Cell{
+				int x, y, z;
+
+				//The particles of the cell are particles[begin, begin + count)
+				//of the array passed to build
+				unsigned int begin;
+				unsigned int count;
+			};
+
+			CellMap(float cellSize);
+
+			//Sorts count particles into cells. cellOf receives the cell index
+			//of every particle and particles the particle indices grouped by
+			//cell, in increasing order within each cell. Both hold count entries.
+			//Instantiated for float and double positions
+			template<typename Scalar>
+			void build(const glm::tvec3<Scalar>* positions, size_t count, int* cellOf, int* particles);
+
+			//Same as build, with every pass split over workers. The cells,
+			//their order and the order of the particles in them are the same
+			//as those of build, however the work is split
+			template<typename Scalar>
+			void build(const glm::tvec3<Scalar>* positions, size_t count, int* cellOf, int* particles, WorkerGroup& workers);
+
+			//Removes all cells, shrinking the table if most of it was empty
+			void clear();
+
+			//Returns the index of the cell at x, y, z, adding it if it is new.
+			//Indices are handed out in the order cells are added
+			int insert(int x, int y, int z);
+
+			//Orders the cells by x, then y, then z. remap receives the new
+			//index of every old one
+			void sort(std::vector<int>& remap);
+
+			//Integer coordinates of the cell containing p
+			template<typename Scalar>
+			void coordinates(const glm::tvec3<Scalar>& p, int& x, int& y, int& z) const{
+				x = (int)std::floor(p.x * inverseSize);
+				y = (int)std::floor(p.y * inverseSize);
+				z = (int)std::floor(p.z * inverseSize);
+			}
+
+			//Returns the cell at coordinates x, y, z or NULL if it is empty
+			const Cell* find(int x, int y, int z) const{
+				size_t s = hash(x, y, z) & mask;
+				while(true){
+					int c = table[s];
+					if(c < 0) return NULL;
+					const Cell& cell = cells[c];
+					if(cell.x == x && cell.y == y && cell.z == z) return &cell;
+					s = (s + 1) & mask;
+				}
+			}
+
+			Cell& cell(size_t index){ return cells[index]; }
+			const Cell& cell(size_t index) const{ return cells[index]; }
+
+			//Number of occupied cells and of slots in the table
+			size_t size() const{ return cells.size(); }
+			size_t tableSize() const{ return table.size(); }
+
+			float getCellSize() const{ return cellSize; }
+
+			//Bytes held by the cells and the table
+			size_t memoryBytes() const{ return cells.capacity()*sizeof(Cell) + table.capacity()*sizeof(int); }
+
+		private:
+			float cellSize;
+			float inverseSize;
+
+			std::vector<Cell> cells;
+
+			//Indices into cells, -1 marks an empty slot. The size is a power of
+			//two and at least twice the number of cells
+			std::vector<int> table;
+			size_t mask;
+
+			static size_t hash(int x, int y, int z){
+				uint64_t h = (uint64_t)(uint32_t)x*0x9E3779B97F4A7C15ull;
+				h ^= (uint64_t)(uint32_t)y*0xC2B2AE3D27D4EB4Full;
+				h ^= (uint64_t)(uint32_t)z*0x165667B19E3779F9ull;
+				return (size_t)(h ^ (h >> 29));
+			}
+
+			void resize(size_t slots);
+
+			//Scratch of the parallel build. A particle claims a slot of
+			//claims for its cell with compare and swap, the slot ends up
+			//holding the lowest index in the cell. pairs holds the cell in
+			//the high and the particle in the low half for the radix sort
+			struct Coordinates{
+				int x, y, z;
+			};
+			std::vector<Coordinates> keys;
+			std::vector<size_t> slotOf;
+			std::vector<std::atomic<int> > claims;
+			std::vector<size_t> offsets;
+			std::vector<uint64_t> pairs;
+			std::vector<uint64_t> sorted;
+			std::vector<size_t> histogram;
+
+			//Returns false if the table got more than half full
+			bool claim(size_t begin, size_t end, std::atomic<size_t>& claimed);
+	};
+}
+
+#endif
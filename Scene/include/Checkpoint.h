@@ -0,0 +1,107 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+namespace Water{
+	template<typename Scalar> class BasicSimulation;
+	typedef BasicSimulation<float> Simulation;
+
+	//Layout of a checkpoint file written by Simulation::save.
+	//
+	//The header is followed by the sections it points to. Every section
+	//starts on a CHECKPOINT_ALIGNMENT boundary of the file, so a mapping of
+	//the file can be read in place as plain arrays. Numbers are stored in
+	//the byte order of the writer, byteOrder tells a reader if it differs.
+	//Particle arrays are in the precision of the simulation which wrote
+	//them, scalarBytes is 4 for float and 8 for double.
+	const char CHECKPOINT_MAGIC[8] = {'W', 'A', 'T', 'E', 'R', 'C', 'K', 'P'};
+	const uint32_t CHECKPOINT_VERSION = 4;
+	const uint32_t CHECKPOINT_BYTE_ORDER = 0x01020304;
+	const uint64_t CHECKPOINT_ALIGNMENT = 64;
+
+	struct CheckpointHeader{
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder;
+		uint64_t fileBytes;
+
+		//SimulationParameters, the seed is replaced by the generator state
+		float v, k, g, pm, p_0, d_0, dt, c_R;
+		float effectiveRadius;
+		uint32_t rngState;
+		float domainMin[3];
+		float domainMax[3];
+		uint32_t respawn;
+		uint32_t boundaryParticles;
+		float boundarySpacing;
+		float boundaryStiffness;
+		uint32_t scalarBytes;
+
+		uint64_t steps;
+		uint64_t particles;
+		uint64_t ghosts;
+		uint64_t surfaces;
+
+		//File offsets of the sections. Triangles are 9 floats, particle
+		//arrays hold particles + ghosts entries of 1 or 3 scalars
+		uint64_t surfacesOffset;
+		uint64_t densityOffset;
+		uint64_t presureOffset;
+		uint64_t positionsOffset;
+		uint64_t velocitiesOffset;
+	};
+
+	//Writes checkpoints on a background thread. submit() only copies the
+	//state of the simulation, the file is written while it keeps stepping
+	class CheckpointWriter{
+		public:
+			CheckpointWriter();
+
+			//Finishes a checkpoint which is still being written
+			~CheckpointWriter();
+
+			CheckpointWriter(const CheckpointWriter&) = delete;
+			CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+			//Copies the state of sim and writes it to path in the background.
+			//Returns false without copying if the previous checkpoint is still
+			//being written, so the caller never waits on the disk
+			template<typename Scalar>
+			bool submit(BasicSimulation<Scalar>& sim, const std::string& path);
+
+			//Blocks until the pending checkpoint is on disk
+			void wait();
+
+			//Number of checkpoints written and failed so far
+			uint64_t getWritten();
+			uint64_t getFailed();
+
+		private:
+			std::thread writer;
+			std::mutex lock;
+			std::condition_variable hasWork;
+			std::condition_variable isIdle;
+
+			std::vector<char> pending;
+			std::string pendingPath;
+			bool busy;
+			bool stopping;
+
+			uint64_t written;
+			uint64_t failed;
+
+			void work();
+	};
+
+	//Writes bytes to path through a temporary file which is renamed over
+	//path, so a crash never leaves a partial checkpoint behind
+	bool writeCheckpointFile(const std::string& path, const std::vector<char>& bytes);
+}
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Simulation.h"
+
+namespace Water{
+	//Fraction of step after which a particle at x moving by step crosses tri,
+	//or -1 if it does not. The surfaces are stored in single precision, the
+	//test runs in the precision of the particle
+	template<typename Scalar>
+	inline Scalar findCollision(const glm::tvec3<Scalar>& x, const Triangle& tri, const glm::tvec3<Scalar>& step){
+		typedef glm::tvec3<Scalar> Vector;
+		Vector a(tri.a);
+		Vector b(tri.b);
+		Vector c(tri.c);
+		Vector n = glm::normalize(glm::cross(a - c,a - b));
+
+		if(glm::dot(n, x - a)*glm::dot(n, x + step - a) <= 0.0){
+			glm::tmat3x3<Scalar> A(0.0);
+			A[0] = a - b;
+			A[1] = a - c;
+			A[2] = step;
+
+			glm::tmat3x3<Scalar> A_t(0.0);
+			A_t[0] = a - b;
+			A_t[1] = a - c;
+			A_t[2] = a - x;
+
+			Scalar t = glm::determinant(A_t) / glm::determinant(A);
+
+			glm::tmat3x3<Scalar> A_gamma(0.0);
+			A_gamma[0] = a - b;
+			A_gamma[1] = a - x;
+			A_gamma[2] = step;
+
+			Scalar gamma = glm::determinant(A_gamma) / glm::determinant(A);
+
+			if(gamma < 0 || gamma > 1) return -1.0; // no hit!
+
+			glm::tmat3x3<Scalar> A_beta(0.0);
+			A_beta[0] = a - x;
+			A_beta[1] = a - c;
+			A_beta[2] = step;
+
+			Scalar beta = glm::determinant(A_beta) / glm::determinant(A);
+
+			if (beta < 0 || beta > 1 - gamma) return -1.0; // no hit!
+
+			return t;
+		}
+		return -1.0;
+	}
+
+	//Moves a particle at x with velocity v to its first collision along step
+	//and reflects v and the rest of step off the surface. Returns false and
+	//leaves everything unchanged if there is no collision
+	template<typename Scalar>
+	inline bool collideAndMove(glm::tvec3<Scalar>& x, glm::tvec3<Scalar>& v, glm::tvec3<Scalar>& step, const std::vector<Triangle>& surfaces,
+			Scalar c_R, SimulationStats& statistics){
+		Scalar mint = 1.0;
+		int minat = -1;
+		SIM_COUNT(statistics.triangleTests, surfaces.size());
+		for(int j=0; j<surfaces.size(); j++){
+			Scalar t = findCollision(x, surfaces[j], step);
+			if(0.0 < t && t < mint){
+				mint = t;
+				minat = j;
+			}
+		}
+		if(minat == -1) return false;
+		SIM_COUNT(statistics.bounces, 1);
+
+		glm::tvec3<Scalar> a(surfaces[minat].a);
+		glm::tvec3<Scalar> b(surfaces[minat].b);
+		glm::tvec3<Scalar> c(surfaces[minat].c);
+		glm::tvec3<Scalar> n = glm::normalize(glm::cross(a - c,a - b));
+
+		x = x + (mint - Scalar(0.001))*step;
+		v = v - (Scalar(1) + c_R)*glm::dot(n,v)*n;
+		step = (1-mint)*(step - (Scalar(1) + c_R)*glm::dot(n,step)*n);
+
+		return true;
+	}
+
+	//Adds the rectangle (-1,0,-1) x (1,0,1) transformed by modelMatrix to
+	//surfaces as two triangles
+	inline void addPlane(std::vector<Triangle>& surfaces, const glm::mat4& modelMatrix){
+		Triangle t1;
+		t1.a = glm::vec3(modelMatrix*glm::vec4(-1.0,0.0,-1.0,1.0));
+		t1.c = glm::vec3(modelMatrix*glm::vec4(1.0,0.0,-1.0,1.0));
+		t1.b = glm::vec3(modelMatrix*glm::vec4(1.0,0.0,1.0,1.0));
+
+		Triangle t2;
+		t2.a = glm::vec3(modelMatrix*glm::vec4(-1.0,0.0,-1.0,1.0));
+		t2.c = glm::vec3(modelMatrix*glm::vec4(1.0,0.0,1.0,1.0));
+		t2.b = glm::vec3(modelMatrix*glm::vec4(-1.0,0.0,1.0,1.0));
+
+		surfaces.push_back(t1);
+		surfaces.push_back(t2);
+	}
+}
+
+#endif
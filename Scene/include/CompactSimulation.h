@@ -0,0 +1,143 @@
+#ifndef COMPACTSIMULATION_H
+#define COMPACTSIMULATION_H
+
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "Simulation.h"
+#include "CellMap.h"
+
+namespace Water{
+	//Low memory variant of Simulation for runs with millions of particles.
+	//
+	//Particles are kept sorted by the cell they are in. Cells are
+	//effectiveRadius wide, so neighbours are at most one cell away. A position
+	//is stored as three 16 bit fixed point offsets within its cell and a
+	//velocity as three half floats. Only the density is kept as a float and
+	//the presure is derived from it, so a particle takes 20 bytes against 64
+	//in Simulation. On top of that come about 60 bytes per occupied cell for
+	//the two cell maps, and 12 bytes for every particle within two cells
+	//along x of the one being worked on. The waterfall lattice needs 40 bytes
+	//per particle in total. Values are expanded to floats only while they are
+	//being worked on.
+	//
+	//Accuracy: positions are rounded to effectiveRadius/65536 after every
+	//step, 7.6e-6 for the default radius. Half floats keep 11 significant
+	//bits, so every velocity component is rounded by up to 2^-11 = 0.05% of
+	//its magnitude each step. This is the dominant loss. Under a steady
+	//acceleration the roundings do not cancel, a particle falling freely at
+	//4 m/s ends up about 0.5% slower after 50 steps.
+	//
+	//Ghost and boundary particles are not supported, and since every step reorders the
+	//particles an index only names the same particle until the next step.
+	class CompactSimulation{
+		public:
+			CompactSimulation(size_t particles, const SimulationParameters& params = SimulationParameters(), bool hugePages = false);
+
+			CompactSimulation(const CompactSimulation&) = delete;
+			CompactSimulation& operator=(const CompactSimulation&) = delete;
+
+			//Call this to progress the simulation one time step
+			void step();
+
+			glm::vec3 getPosition(size_t index);
+			glm::vec3 getVelocity(size_t index);
+			size_t getNumberOfParticles(){ return N; }
+
+			//Adds a particle, returns false if the simulation is full
+			bool addParticle(glm::vec3 position, glm::vec3 velocity);
+
+			//Timings and counters of the last step
+			const SimulationStats& stats(){ return statistics; }
+
+			GLfloat getEffectiveRadius(){ return effectiveRadius; }
+
+			//Bytes taken by the particles, the cells and the velocity window
+			size_t memoryBytes();
+
+			//Adds a collision plane which is the rectangle (-1,0,-1) x (1,0,1)
+			//transformed by modelMatrix
+			void addPlane(glm::mat4 modelMatrix);
+
+			//Collision surfaces
+			std::vector<Triangle> surfaces;
+
+		private:
+			size_t N;
+			size_t capacity;
+
+			//Owns the particle arrays
+			Arena arena;
+
+			SimulationStats statistics;
+
+			//Three fixed point offsets within the cell and three half float
+			//velocity components per particle
+			uint16_t* offsets;
+			uint16_t* velocities;
+			GLfloat* density;
+
+			//Cell of every particle in grid. While sorting it holds the
+			//destination of every particle instead
+			int* cellOf;
+
+			//Cells of the particles, and those they move to during a step
+			CellMap grid;
+			CellMap nextGrid;
+			std::vector<int> remap;
+			bool sorted;
+
+			//New velocities of the particles whose neighbours are not all
+			//done yet, the first one belongs to particle windowBegin
+			std::deque<glm::vec3> window;
+			size_t windowBegin;
+			size_t windowPeak;
+
+			//Decoded particles of the cells around the one being worked on
+			struct Neighbour{
+				glm::vec3 x;
+				glm::vec3 v;
+				GLfloat density;
+				GLfloat presure;
+				size_t index;
+			};
+			std::vector<Neighbour> near;
+
+			GLfloat v;
+			GLfloat k;
+			GLfloat g;
+			GLfloat pm;
+			GLfloat p_0;
+			GLfloat d_0;
+			GLfloat dt;
+			GLfloat c_R;
+			GLfloat effectiveRadius;
+
+			bool respawn;
+			glm::vec3 domainMin;
+			glm::vec3 domainMax;
+
+			unsigned int rngState;
+			GLfloat random();
+
+			glm::vec3 position(size_t i, const CellMap::Cell& cell);
+			glm::vec3 velocity(size_t i);
+			void store(size_t i, glm::vec3 position, glm::vec3 velocity, CellMap& map);
+
+			//Decodes the particles of cell and the occupied cells around it
+			//into near, with velocities, density and presure if withState
+			void gather(const CellMap::Cell& cell, bool withState);
+
+			//Sorts the particles by their cell in map, which becomes grid
+			void sortParticles(CellMap& map);
+
+			size_t computeDensity();
+			size_t computeForces();
+			void moveParticles();
+			void commitWindow(size_t end);
+	};
+}
+
+#endif
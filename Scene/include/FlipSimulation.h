@@ -0,0 +1,269 @@
+#ifndef FLIPSIMULATION_H
+#define FLIPSIMULATION_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "Simulation.h"
+#include "CellMap.h"
+#include "WorkerGroup.h"
+
+namespace Water{
+	struct FlipParameters{
+		//Width of a grid cell. Twice the spacing of the initial lattice, so
+		//the cells the water starts in hold 8 particles each. A particle
+		//should not move further than a cell in one step
+		GLfloat cellSize = 0.6;
+
+		//With apic every particle carries the velocity field around it to
+		//the grid and back (APIC). Without it particles keep flipRatio of
+		//their own velocity plus the change on the grid (FLIP) and take the
+		//rest from the grid (PIC)
+		bool apic = true;
+		GLfloat flipRatio = 0.95;
+
+		//The pressure solve stops once no cell is left with more than
+		//tolerance of the largest divergence, or after maxIterations
+		int maxIterations = 200;
+		GLfloat tolerance = 1e-4;
+
+		//Jacobi sweeps before and after the coarse correction on every
+		//multigrid level, and on the coarsest one
+		int smoothing = 2;
+		int bottomSmoothing = 16;
+
+		//Tiles without particles for this many steps give their grid back
+		int evictSteps = 60;
+	};
+
+	//Particle-grid hybrid solver for large volumes of water, with the
+	//interface of Simulation.
+	//
+	//Every step the particles splat their velocities onto a staggered grid,
+	//where gravity is added and the pressure projection makes the flow
+	//divergence free, and read them back before they move. The grid is
+	//sparse: tiles of 8^3 cells are only used around the particles, found
+	//in a CellMap of tiles, and evicted after FlipParameters::evictSteps
+	//unused steps. An evicted tile keeps which of its faces the collision
+	//surfaces cross, so it is not voxelised again when the water comes
+	//back. Faces a surface crosses are solid walls for the projection,
+	//particles still collide with the triangles themselves. Cells with
+	//particles are water, every other cell is air at zero pressure.
+	//
+	//The projection is solved with conjugate gradients preconditioned by a
+	//multigrid V-cycle (McAdams et al. 2010) which coarsens every tile down
+	//to one cell. Particle to grid transfers run on the workers in 8 passes
+	//over the tiles, so tiles running together are never next to each other
+	//and never write the same faces. Results do not depend on the number of
+	//workers.
+	//
+	//The phases of SimulationStats are reused: hash is finding the tiles,
+	//density the transfer to the grid, forces the projection and the
+	//transfer back, collision moving the particles. Ghost and boundary
+	//particles, level of detail and secondary metrics are not supported
+	class FlipSimulation{
+		public:
+			FlipSimulation(size_t particles, const SimulationParameters& params = SimulationParameters(),
+					const FlipParameters& flip = FlipParameters());
+
+			FlipSimulation(const FlipSimulation&) = delete;
+			FlipSimulation& operator=(const FlipSimulation&) = delete;
+
+			//Call this to progress the simulation one time step
+			void step();
+
+			glm::vec3 getPosition(size_t index){ return x[index]; }
+			glm::vec3 getVelocity(size_t index){ return v[index]; }
+
+			//Positions and velocities of all particles, see Simulation
+			ParticleView positions(){ return view(x); }
+			ParticleView velocities(){ return view(v); }
+			uint64_t getVersion(){ return version; }
+
+			size_t getNumberOfParticles(){ return N; }
+			size_t getCapacity(){ return capacity; }
+
+			//Number of worker threads, 0 if the passes run on the caller
+			size_t getThreads(){ return workers ? workers->size() : 0; }
+
+			//Adds a particle, returns false if the simulation is full
+			bool addParticle(glm::vec3 position, glm::vec3 velocity);
+
+			//Timings and counters of the last step
+			const SimulationStats& stats(){ return statistics; }
+
+			GLfloat getTimeStep(){ return dt; }
+			GLfloat getGravity(){ return g; }
+			GLfloat getCellSize(){ return cellSize; }
+
+			//Tiles and water cells of the last step, the iterations the
+			//pressure solve took and the tiles which have a grid
+			size_t getActiveTiles(){ return active.size(); }
+			size_t getResidentTiles(){ return resident.size(); }
+			size_t getFluidCells(){ return fluidCells; }
+			int getPressureIterations(){ return iterations; }
+
+			//Bytes taken by the particles and the tiles, evicted ones only
+			//count their blocked faces
+			size_t memoryBytes();
+
+			//Adds a collision plane which is the rectangle (-1,0,-1) x (1,0,1)
+			//transformed by modelMatrix
+			void addPlane(glm::mat4 modelMatrix);
+
+			//Collision surfaces
+			std::vector<Triangle> surfaces;
+
+		private:
+			static const int TILE = 8;
+			static const int CELLS = TILE*TILE*TILE;
+
+			//Multigrid levels of a tile are 8^3, 4^3, 2^3 and 1 cell, stored
+			//one after the other
+			static const int LEVELS = 4;
+			static const int LEVEL_CELLS = CELLS + CELLS/8 + CELLS/64 + 1;
+
+			enum CellType{ CELL_AIR, CELL_FLUID };
+
+			//Vectors of the pressure solve, every one over all levels
+			enum TileVector{ PRESSURE, RESIDUAL, DIRECTION, PRODUCT, LEVEL_X, LEVEL_B, LEVEL_R, VECTOR_COUNT };
+
+			struct Tile{
+				int x, y, z;
+				bool active;
+
+				//Tile on the -x, +x, -y, +y, -z, +z side, -1 if it is not in use
+				int neighbours[6];
+
+				//Bit a is set if a collision surface crosses the face of the
+				//cell on its minus side along axis a
+				uint8_t blocked[CELLS];
+
+				//Faces on the minus side of every cell along every axis: the
+				//velocity, the weight of the particles splatted onto it and
+				//the velocity before gravity and the projection
+				GLfloat velocity[3][CELLS];
+				GLfloat weight[3][CELLS];
+				GLfloat before[3][CELLS];
+
+				//Faces of the cell which are not blocked, the diagonal of the
+				//pressure matrix on the finest level
+				uint8_t open[CELLS];
+
+				uint8_t type[LEVEL_CELLS];
+				GLfloat vectors[VECTOR_COUNT][LEVEL_CELLS];
+			};
+
+			//What is left of a tile when it has no grid: the step it was
+			//last used in and, if kept is set, its blocked faces, empty if
+			//no surface crosses it
+			struct TileRecord{
+				uint64_t lastUsed = 0;
+				bool kept = false;
+				std::vector<uint8_t> blocked;
+			};
+
+			size_t N;
+			size_t capacity;
+			uint64_t version;
+			SimulationStats statistics;
+
+			std::vector<glm::vec3> x;
+			std::vector<glm::vec3> v;
+
+			//Rows of the affine velocity of every particle, for APIC
+			std::vector<glm::vec3> affine;
+
+			ParticleView view(const std::vector<glm::vec3>& data){
+				ParticleView view = {data.data(), N, version};
+				return view;
+			}
+
+			GLfloat g;
+			GLfloat dt;
+			GLfloat c_R;
+			GLfloat cellSize;
+			GLfloat inverseCell;
+			FlipParameters flip;
+
+			bool respawn;
+			glm::vec3 domainMin;
+			glm::vec3 domainMax;
+
+			unsigned int rngState;
+			GLfloat random();
+
+			//Every tile created so far, by the index tileMap gives it, NULL
+			//once evicted. The map is never cleared so the indices stay the
+			//same. resident holds the indices of the tiles with a grid
+			std::vector<std::unique_ptr<Tile>> tiles;
+			std::vector<TileRecord> records;
+			std::vector<int> resident;
+			CellMap tileMap;
+			size_t voxelised;
+
+			//Tiles in use in this step
+			std::vector<int> active;
+			size_t fluidCells;
+			int iterations;
+
+			//Particles grouped by the tile they are in, the tile every group
+			//is in and the groups of each of the 8 passes of the transfer
+			CellMap groups;
+			std::vector<int> groupOf;
+			std::vector<int> grouped;
+			std::vector<int> groupTile;
+			std::vector<int> passes[8];
+
+			//Sums over every active tile, added up in tile order
+			std::vector<double> tileSums;
+
+			std::unique_ptr<WorkerGroup> workers;
+
+			//Runs f(begin, end) on ranges of the active tiles, split over the
+			//workers if there are at least a few thousand cells of work
+			template<typename Function>
+			void forTiles(size_t cellsPerTile, Function f);
+
+			//Runs f(begin, end, counters) on ranges of [0, count), split over
+			//the workers, adding the counters to statistics
+			template<typename Function>
+			void forRange(size_t count, size_t work, Function f);
+
+			//Index of the tile at x, y, z, created and put in use if needed
+			int useTile(int x, int y, int z);
+
+			//Tile t and index n of the cell with global coordinates i, j, k,
+			//trying tile hint first. False if its tile is not in use
+			bool locate(int hint, int i, int j, int k, int& t, int& n);
+
+			//Tile nt and index n of the cell next to cell i, j, k of tile t
+			//on level l in direction d. False if that tile is not in use
+			bool adjacent(int t, int l, int i, int j, int k, int d, int& nt, int& n);
+
+			void voxelise(Tile& tile);
+			void evictTiles();
+
+			void findTiles();
+			void transferToGrid();
+			void splat(size_t i, int t);
+			void project();
+			void transferToParticles(size_t begin, size_t end);
+			void moveParticles(size_t begin, size_t end, SimulationStats& counters);
+			void respawnParticles();
+
+			//Steps of the pressure solve, vectors are given as TileVector.
+			//applyMatrix puts the matrix of level l times in into out, or
+			//rhs minus that if rhs is not -1
+			void prepareLevels();
+			double dot(int first, int second);
+			double largest(int vector);
+			void applyMatrix(int l, int in, int out, int rhs);
+			void smooth(int l, int sweeps);
+			void precondition();
+	};
+}
+
+#endif
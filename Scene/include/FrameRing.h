@@ -0,0 +1,130 @@
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+namespace Water{
+	template<typename Scalar> class BasicSimulation;
+	typedef BasicSimulation<float> Simulation;
+
+	//Layout of a frame ring, a POSIX shared memory object through which a
+	//simulation publishes its particles to other processes.
+	//
+	//The header is followed by slots slots of slotBytes bytes each. A slot
+	//starts with a FrameRingSlot, the positions follow at FRAME_RING_ALIGNMENT
+	//and the velocities after capacity positions, rounded up to the same
+	//alignment. Frame f goes to slot f % slots.
+	//
+	//The producer never waits for readers. Every slot is a seqlock: its
+	//sequence is 2f+1 while frame f is being written and 2f+2 once it is
+	//complete. A reader reads the sequence, the frame in place and then the
+	//sequence again, the frame is intact if it did not change. A slot is only
+	//overwritten slots-1 frames later, which is how long a reader has to
+	//consume a frame without copying it.
+	const char FRAME_RING_MAGIC[8] = {'W', 'A', 'T', 'E', 'R', 'R', 'N', 'G'};
+	const uint32_t FRAME_RING_VERSION = 1;
+	const uint64_t FRAME_RING_ALIGNMENT = 64;
+
+	struct FrameRingHeader{
+		char magic[8];
+		uint32_t version;
+		uint32_t slots;
+		uint64_t capacity;
+		uint64_t slotBytes;
+
+		//Process id of the producer, readers use it to tell that it is gone
+		uint64_t producer;
+
+		//Frames published so far, the newest is frame published-1
+		std::atomic<uint64_t> published;
+	};
+
+	struct FrameRingSlot{
+		std::atomic<uint64_t> sequence;
+		uint64_t step;
+		uint64_t particles;
+	};
+
+	//Publishes the particles of a simulation after every step
+	class FrameRingWriter{
+		public:
+			FrameRingWriter();
+
+			//Unmaps and removes the ring, readers which are attached keep
+			//their mapping
+			~FrameRingWriter();
+
+			FrameRingWriter(const FrameRingWriter&) = delete;
+			FrameRingWriter& operator=(const FrameRingWriter&) = delete;
+
+			//Creates the ring name, replacing one left over by a crashed run,
+			//with room for capacity particles per frame.
+			//Returns false if it could not be created
+			bool create(const std::string& name, size_t capacity, uint32_t slots = 4);
+
+			//Copies the particles of sim into the next slot. Returns false if
+			//there are more than the capacity, only those are published
+			bool publish(Simulation& sim);
+
+			uint64_t getPublished(){ return published; }
+
+		private:
+			std::string name;
+			char* base;
+			size_t bytes;
+			FrameRingHeader* header;
+			uint64_t published;
+	};
+
+	//A frame read in place from a ring
+	struct FrameRingFrame{
+		const glm::vec3* positions;
+		const glm::vec3* velocities;
+		size_t particles;
+		uint64_t step;
+		uint64_t frame;
+
+		const FrameRingSlot* slot;
+		uint64_t sequence;
+	};
+
+	//Attaches read only to a ring written by FrameRingWriter
+	class FrameRingReader{
+		public:
+			FrameRingReader();
+			~FrameRingReader();
+
+			FrameRingReader(const FrameRingReader&) = delete;
+			FrameRingReader& operator=(const FrameRingReader&) = delete;
+
+			//Returns false if name does not exist or is not a ring of this version
+			bool attach(const std::string& name);
+
+			//Points frame at the newest complete frame. Returns false if
+			//nothing has been published yet
+			bool latest(FrameRingFrame& frame);
+
+			//True if frame has not been overwritten since latest returned it.
+			//Check it after reading the frame, not before
+			bool isIntact(const FrameRingFrame& frame);
+
+			//Frames published so far
+			uint64_t getPublished();
+
+			//False once the producer has exited
+			bool isProducerAlive();
+
+			size_t getCapacity(){ return header->capacity; }
+
+		private:
+			const char* base;
+			size_t bytes;
+			const FrameRingHeader* header;
+	};
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cmath>
+#include <glm/glm.hpp>
+
+#include "Simulation.h"
+
+namespace Water{
+	//Double so the double solver gets them at full precision, the float
+	//one rounds them to the same values as before
+	const double PI = 3.14159265358979323846;
+	const double EPS = 1e-10;
+
+	//The kernels are evaluated in the precision of the simulation calling them
+
+	//Poly6 kernel, used for density
+	template<typename Scalar>
+	inline Scalar kernel(const glm::tvec3<Scalar>& r, Scalar r_e){
+		Scalar l = glm::length(r);
+		if(l > r_e) return Scalar(0);
+		return Scalar(315)*std::pow(r_e*r_e - l*l, Scalar(3)) / (Scalar(64)*Scalar(PI)*std::pow(r_e,Scalar(9)));
+	}
+
+	//Gradient of the spiky kernel, used for presure
+	template<typename Scalar>
+	inline glm::tvec3<Scalar> presurekernel(const glm::tvec3<Scalar>& r, Scalar r_e){
+		Scalar l = glm::length(r);
+		if(l > r_e) return glm::tvec3<Scalar>(0.0,0.0,0.0);
+		return Scalar(45)*std::pow(r_e - l,Scalar(3))*r / (Scalar(PI)*std::pow(r_e,Scalar(6))*l + Scalar(EPS));
+	}
+
+	//Laplacian of the viscosity kernel
+	template<typename Scalar>
+	inline Scalar viscositykernel(const glm::tvec3<Scalar>& r, Scalar r_e){
+		Scalar l = glm::length(r);
+		if(l > r_e) return Scalar(0);
+		return Scalar(45)*(r_e - l) / (Scalar(PI)*std::pow(r_e,Scalar(6)));
+	}
+}
+
+#endif
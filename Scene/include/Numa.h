@@ -0,0 +1,31 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <vector>
+
+namespace Water{
+	//NUMA nodes of the machine and the CPUs of each this process may run on.
+	//Read from sysfs, so there is no dependency on libnuma. Machines without
+	//NUMA, or where sysfs can not be read, have a single node with every CPU
+	struct NumaTopology{
+		std::vector<std::vector<int> > cpus;
+
+		//Number the kernel gives each node, nodes without CPUs are left out
+		//so they need not be consecutive
+		std::vector<int> ids;
+
+		static NumaTopology detect();
+
+		size_t nodes() const{ return cpus.size(); }
+	};
+
+	//Restricts the calling thread to the CPUs of node. Returns false if the
+	//node has no CPUs or the affinity could not be set
+	bool pinToNode(const NumaTopology& topology, int node);
+
+	//Node the page holding p is on, or -1 if it is not mapped yet or the
+	//kernel does not tell
+	int nodeOfPage(const void* p);
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+
+namespace Water{
+	//Flat coloured bars drawn on top of the scene in the top left corner
+	class Overlay{
+		public:
+			Overlay();
+
+			//Queues a bar on row made of consecutive segments. Widths are
+			//fractions of the full bar width, which is a quarter of the screen
+			void addBar(int row, const std::vector<GLfloat>& widths, const std::vector<glm::vec3>& colors);
+
+			//Draws and clears the queued bars
+			void draw();
+
+		private:
+			Shader shader;
+			GLuint VBO, VAO;
+
+			//x, y, r, g, b per vertex
+			std::vector<GLfloat> vertices;
+	};
+}
+
+#endif
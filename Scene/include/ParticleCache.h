@@ -0,0 +1,212 @@
+#ifndef PARTICLECACHE_H
+#define PARTICLECACHE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+namespace Water{
+	template<typename Scalar> class BasicSimulation;
+	typedef BasicSimulation<float> Simulation;
+
+	//Layout of a particle cache, a file holding every frame of a run.
+	//
+	//The file header is followed by one chunk per frame, a ParticleCacheFrame
+	//and its compressed payload. Closing the writer appends the frame index,
+	//one ParticleCacheIndexEntry per frame, and points the file header at it.
+	//A file without an index, from a run which did not finish, can still be
+	//read by walking the chunks.
+	//
+	//Positions are quantised to 16 bits and velocities, which only shade and
+	//blur the particles, to 12 bits relative to their bounds in the frame.
+	//Each quantised value is stored as the difference to a prediction from
+	//the previous decoded frames: velocities are extrapolated linearly and
+	//positions move from their last place along the decoded velocity, scaled
+	//by stepScale. Keyframes, every keyframeInterval frames, predict from the
+	//previous particle instead so decoding can start at any of them.
+	//Each of the six components is stored as its own plane of differences,
+	//split into a plane of low and one of high bytes, and the whole payload
+	//is deflated.
+	const char PARTICLE_CACHE_MAGIC[8] = {'W', 'A', 'T', 'E', 'R', 'P', 'C', 'H'};
+	const uint32_t PARTICLE_CACHE_VERSION = 1;
+	const uint32_t PARTICLE_CACHE_BYTE_ORDER = 0x01020304;
+
+	struct ParticleCacheHeader{
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder;
+
+		uint32_t keyframeInterval;
+		uint32_t reserved;
+
+		//Zero until the writer is closed
+		uint64_t indexOffset;
+		uint64_t frames;
+	};
+
+	struct ParticleCacheFrame{
+		uint64_t step;
+		uint64_t particles;
+		float positionMin[3];
+		float positionMax[3];
+		float velocityMin[3];
+		float velocityMax[3];
+		float stepScale;
+		uint32_t keyframe;
+		uint64_t payloadBytes;
+	};
+
+	struct ParticleCacheIndexEntry{
+		uint64_t offset;
+		uint64_t step;
+	};
+
+	//The last two decoded frames, which the next frame is predicted from.
+	//The encoder and the decoder each keep one
+	struct ParticleCacheHistory{
+		std::vector<glm::vec3> positions[2];
+		std::vector<glm::vec3> velocities[2];
+
+		//Number of frames in the history, at most 2
+		int frames = 0;
+	};
+
+	//Compresses a frame into payload, fills in frame and adds the frame as
+	//the decoder will see it to history
+	void encodeParticleFrame(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& velocities,
+			bool keyframe, ParticleCacheHistory& history, ParticleCacheFrame& frame, std::vector<char>& payload);
+
+	//Decompresses a frame into positions and velocities and adds it to history.
+	//history must hold the frames before this one unless it is a keyframe.
+	//Returns false if the payload is corrupt
+	bool decodeParticleFrame(const ParticleCacheFrame& frame, const char* payload, ParticleCacheHistory& history,
+			std::vector<glm::vec3>& positions, std::vector<glm::vec3>& velocities);
+
+	//Appends frames to a particle cache. addFrame copies the particles,
+	//quantising, compressing and writing happen on a background thread
+	class ParticleCacheWriter{
+		public:
+			//queueFrames bounds the frames waiting for the disk, addFrame
+			//blocks when the writer falls further behind
+			ParticleCacheWriter(size_t queueFrames = 4, uint32_t keyframeInterval = 30);
+
+			//Closes the file
+			~ParticleCacheWriter();
+
+			ParticleCacheWriter(const ParticleCacheWriter&) = delete;
+			ParticleCacheWriter& operator=(const ParticleCacheWriter&) = delete;
+
+			//Creates path, returns false if it could not be created
+			bool open(const std::string& path);
+
+			//Queues the current particles of sim as the next frame
+			void addFrame(Simulation& sim);
+
+			//Writes the queued frames and the index and closes the file.
+			//Returns false if any write failed
+			bool close();
+
+			//Number of frames written and their size on disk so far
+			uint64_t getFrames();
+			uint64_t getBytes();
+
+		private:
+			struct Pending{
+				uint64_t step;
+				std::vector<glm::vec3> positions;
+				std::vector<glm::vec3> velocities;
+			};
+
+			FILE* file;
+			std::thread writer;
+			std::mutex lock;
+			std::condition_variable hasWork;
+			std::condition_variable hasRoom;
+
+			size_t queueFrames;
+			uint32_t keyframeInterval;
+			std::deque<Pending*> queue;
+
+			//Buffers of written frames for addFrame to reuse
+			std::vector<Pending*> spare;
+			bool stopping;
+			bool failed;
+
+			std::vector<ParticleCacheIndexEntry> index;
+			uint64_t bytes;
+
+			void work();
+	};
+
+	//Reads a particle cache for playback. The file is mapped and a
+	//background thread decodes the frames after the one last asked for, so
+	//playing forwards, also across the loop back to the first frame, does
+	//not wait on decoding
+	class ParticleCacheReader{
+		public:
+			//prefetchFrames is how many frames are decoded ahead
+			ParticleCacheReader(size_t prefetchFrames = 8);
+			~ParticleCacheReader();
+
+			ParticleCacheReader(const ParticleCacheReader&) = delete;
+			ParticleCacheReader& operator=(const ParticleCacheReader&) = delete;
+
+			//Maps path and reads its frame index, walking the chunks if the
+			//writer was not closed. Returns false if it is not a particle cache
+			bool open(const std::string& path);
+			void close();
+
+			//Number of frames in the cache
+			size_t getFrames(){ return index.size(); }
+
+			//Simulation step at which frame was written
+			uint64_t getStep(size_t frame){ return index[frame].step; }
+
+			//Returns frame in positions and velocities. Blocks while the frame
+			//is decoded unless it was prefetched, which it is when it follows
+			//the frame of the previous call. Returns false if it is corrupt
+			bool read(size_t frame, std::vector<glm::vec3>& positions, std::vector<glm::vec3>& velocities);
+
+		private:
+			struct Decoded{
+				bool ok;
+				std::vector<glm::vec3> positions;
+				std::vector<glm::vec3> velocities;
+			};
+
+			const char* base;
+			size_t length;
+			uint32_t keyframeInterval;
+			std::vector<ParticleCacheIndexEntry> index;
+
+			std::thread prefetcher;
+			std::mutex lock;
+			std::condition_variable hasWork;
+			std::condition_variable hasFrame;
+			size_t prefetchFrames;
+			bool stopping;
+
+			//First frame of the prefetch window and the frames decoded so far
+			size_t cursor;
+			std::map<size_t, Decoded*> decoded;
+
+			//Decoder state of the prefetch thread, last is the frame the
+			//history ends at
+			ParticleCacheHistory history;
+			size_t last;
+
+			void work();
+			bool decode(size_t frame, Decoded& out);
+			ParticleCacheFrame chunk(size_t frame);
+	};
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef POOLRENDERER_H
+#define POOLRENDERER_H
+
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "ShallowWater.h"
+
+namespace Water{
+	//Draws the surface of a ShallowWater pool as a triangle mesh with a
+	//vertex at the center of every cell, with the shader of the particles
+	class PoolRenderer{
+		public:
+			PoolRenderer();
+
+			//s must be in use with its view and projection set
+			void draw(ShallowWater& pool, Shader s);
+
+		private:
+			GLuint VBO, EBO, VAO;
+			size_t columns, rows;
+			std::vector<glm::vec3> vertices;
+	};
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef QUALITYCONTROLLER_H
+#define QUALITYCONTROLLER_H
+
+#include <iostream>
+#include <cstdint>
+
+namespace Water{
+	//The knobs the controller turns
+	struct QualitySettings{
+		int sphereResolution;			//Rings of the particle spheres
+		float stepsPerFrame;			//Simulation steps per frame, on average
+		float lodDistance;				//See SimulationParameters::lodDistance
+		float renderScale;				//Resolution of the scene, 1 is the window
+
+		QualitySettings(int sphere, float steps, float distance, float scale)
+			: sphereResolution(sphere), stepsPerFrame(steps), lodDistance(distance), renderScale(scale){}
+	};
+
+	struct QualityParameters{
+		float targetSeconds = 1.0/60.0;
+
+		//Settings start at best and never go below worst. best is what the
+		//viewer does without the controller, one step per frame, so the
+		//water never runs faster than it did before. Below one step per
+		//frame some frames skip the simulation and the water slows down
+		QualitySettings best = QualitySettings(50, 1.0, 12.0, 1.0);
+		QualitySettings worst = QualitySettings(8, 0.5, 3.0, 0.5);
+
+		//A frame over target*(1 + tolerance) is too slow. Once the work of
+		//simulating and drawing stays under target*headroom for patience
+		//frames quality is raised again
+		float tolerance = 0.05;
+		float headroom = 0.7;
+		int patience = 120;
+
+		//Frames to wait after a change before judging its effect
+		int settle = 30;
+
+		//Weight of a new frame in the smoothed times
+		float smoothing = 0.1;
+	};
+
+	//Holds a frame time budget by trading quality for speed.
+	//
+	//Every frame it is given the time spent simulating, the time the CPU
+	//spent issuing draw calls and the wall time of the whole frame. When
+	//frames are too slow the smoothed simulation and render times decide
+	//what to lower: the level of detail distance, if the level of detail is
+	//on, and then the steps per frame for the simulation, the sphere
+	//tessellation and then the resolution for
+	//the renderer. Whatever the GPU spends beyond the draw calls shows up in
+	//the frame time, so anything the simulation does not account for is
+	//blamed on rendering. Quality comes back in the opposite order once there
+	//is time to spare. With vsync on a frame never finishes early, so spare
+	//time is judged by the work alone.
+	//
+	//Every change is written to log with the times that caused it.
+	class QualityController{
+		public:
+			QualityController(const QualityParameters& params = QualityParameters(), std::ostream& log = std::cout);
+
+			//Call once per frame. Returns true if the settings changed
+			bool update(double simSeconds, double renderSeconds, double frameSeconds);
+
+			const QualitySettings& settings(){ return current; }
+
+			//Whether the simulation uses the level of detail. While it does
+			//not the distance has no effect and is left alone
+			void setLevelOfDetail(bool enabled){ levelOfDetail = enabled; }
+
+			//Number of changes made so far
+			uint64_t getChanges(){ return changes; }
+
+		private:
+			QualityParameters params;
+			QualitySettings current;
+			std::ostream& log;
+			bool levelOfDetail;
+
+			double sim;
+			double render;
+			double work;
+			double frame;
+			uint64_t frames;
+			uint64_t changes;
+			int calmFrames;
+			int settleFrames;
+
+			bool lowerSimulation();
+			bool lowerRender();
+			bool raise();
+			void report(const char* what, double before, double after);
+	};
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef RENDERTARGET_H
+#define RENDERTARGET_H
+
+#include <GL/glew.h>
+
+namespace Water{
+	//Renders the scene at a fraction of the window resolution into an
+	//offscreen framebuffer and scales it up to the window afterwards. At a
+	//scale of 1 it draws straight into the window
+	class RenderTarget{
+		public:
+			RenderTarget();
+			~RenderTarget();
+
+			RenderTarget(const RenderTarget&) = delete;
+			RenderTarget& operator=(const RenderTarget&) = delete;
+
+			//Directs drawing to a buffer of scale times width x height, the
+			//size of the window's framebuffer
+			void begin(int width, int height, GLfloat scale);
+
+			//Copies the buffer into the window and directs drawing there
+			void end();
+
+		private:
+			GLuint framebuffer, color, depth;
+			int bufferWidth, bufferHeight;
+			int windowWidth, windowHeight;
+			bool offscreen;
+	};
+}
+
+#endif
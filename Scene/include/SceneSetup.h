@@ -0,0 +1,25 @@
+#ifndef SCENESETUP_H
+#define SCENESETUP_H
+
+#include <vector>
+
+#include "Simulation.h"
+#include "CompactSimulation.h"
+#include "FlipSimulation.h"
+
+namespace Water{
+	//Particles in the waterfall scene
+	const size_t WATERFALL_PARTICLES = 3000;
+
+	//Where the viewer's camera starts
+	const glm::vec3 WATERFALL_CAMERA(4.32825,-3.28939,9.06154);
+
+	//Adds the collision planes of the waterfall scene: the pool, the
+	//channel at the top, the cliff faces and the rocks at the bottom
+	void addWaterfallPlanes(std::vector<Triangle>& surfaces);
+	void addWaterfallPlanes(Simulation& sim);
+	void addWaterfallPlanes(CompactSimulation& sim);
+	void addWaterfallPlanes(FlipSimulation& sim);
+}
+
+#endif
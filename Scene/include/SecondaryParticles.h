@@ -0,0 +1,117 @@
+#ifndef SECONDARYPARTICLES_H
+#define SECONDARYPARTICLES_H
+
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "Simulation.h"
+#include "CellMap.h"
+
+namespace Water{
+	//Kinds of secondary particles, decided every step by how many fluid
+	//particles are around them
+	enum SecondaryType{
+		SECONDARY_SPRAY,
+		SECONDARY_FOAM,
+		SECONDARY_BUBBLE,
+		SECONDARY_TYPE_COUNT
+	};
+
+	struct SecondaryParameters{
+		//Metrics are mapped linearly from [min, max] to [0, 1]
+		GLfloat trappedAirMin = 10.0;
+		GLfloat trappedAirMax = 40.0;
+		GLfloat waveCrestMin = 4.0;
+		GLfloat waveCrestMax = 12.0;
+		GLfloat energyMin = 10.0;
+		GLfloat energyMax = 100.0;
+
+		//Particles seeded per second by a fluid particle with both metrics
+		//and its kinetic energy at the top of their range
+		GLfloat trappedAirRate = 400.0;
+		GLfloat waveCrestRate = 400.0;
+
+		//Fewer fluid neighbours than sprayNeighbours make spray, more than
+		//bubbleNeighbours a bubble and anything between foam
+		int sprayNeighbours = 6;
+		int bubbleNeighbours = 20;
+
+		//Seconds foam lives, spray and bubbles only die by leaving the domain
+		GLfloat foamLifetime = 2.0;
+
+		//Bubbles rise buoyancy times as fast as things fall and are dragged
+		//along with the fluid by drag per step
+		GLfloat buoyancy = 2.0;
+		GLfloat drag = 0.5;
+
+		//Particles outside this box are removed
+		glm::vec3 domainMin = glm::vec3(-2.0, -4.5, -8.0);
+		glm::vec3 domainMax = glm::vec3(6.0, 10.0, 10.0);
+
+		//Seeding stops while this many particles are alive
+		size_t capacity = 100000;
+
+		unsigned int seed = 1;
+	};
+
+	//Spray, foam and bubbles seeded from the trapped air and wave crest
+	//metrics of a Simulation (Ihmsen et al. 2012).
+	//
+	//They are advected by the fluid velocity interpolated at their position
+	//but never act on the fluid or on each other. The fluid is splatted onto
+	//a grid once per step, so a secondary particle costs a trilinear lookup
+	//instead of a neighbour search and there can be many more of them than
+	//fluid particles. The simulation has to compute its metrics, see
+	//SimulationParameters::secondaryMetrics and Simulation::setSecondaryMetrics
+	class SecondaryParticles{
+		public:
+			SecondaryParticles(const SecondaryParameters& params = SecondaryParameters());
+
+			//Moves the particles by one step of sim and seeds new ones from
+			//its metrics. Call after every sim.step()
+			void update(Simulation& sim);
+
+			size_t size(){ return positions.size(); }
+
+			//Number of particles of each type after the last update
+			size_t count(SecondaryType type){ return counts[type]; }
+
+			//Wall time of the last update, in seconds
+			double getUpdateSeconds(){ return updateSeconds; }
+
+			const std::vector<glm::vec3>& getPositions(){ return positions; }
+			const std::vector<uint8_t>& getTypes(){ return types; }
+
+		private:
+			SecondaryParameters params;
+
+			std::vector<glm::vec3> positions;
+			std::vector<glm::vec3> velocities;
+			std::vector<GLfloat> lifetimes;
+			std::vector<uint8_t> types;
+
+			size_t counts[SECONDARY_TYPE_COUNT];
+			double updateSeconds;
+
+			//The fluid splatted onto the corners of cells half an effective
+			//radius wide: the summed trilinear weights of the fluid particles
+			//and their weighted velocities, indexed like the cells of grid
+			CellMap grid;
+			std::vector<GLfloat> nodeWeight;
+			std::vector<glm::vec3> nodeVelocity;
+
+			//Collision and bounce counters of the spray, unused otherwise
+			SimulationStats collisions;
+
+			unsigned int rngState;
+			GLfloat random();
+
+			void splat(Simulation& sim);
+			void advect(Simulation& sim);
+			void seed(Simulation& sim);
+			void remove(size_t index);
+	};
+}
+
+#endif
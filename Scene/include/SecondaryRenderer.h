@@ -0,0 +1,27 @@
+#ifndef SECONDARYRENDERER_H
+#define SECONDARYRENDERER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "SecondaryParticles.h"
+
+namespace Water{
+	//Draws secondary particles as round, blended points, one draw call for
+	//all of them. Spray is white, foam greyish and bubbles light blue
+	class SecondaryRenderer{
+		public:
+			SecondaryRenderer();
+
+			//pointScale is the size in pixels of a point one unit in front of
+			//the camera, points shrink with distance
+			void draw(SecondaryParticles& secondary, const glm::mat4& view, const glm::mat4& projection, GLfloat pointScale);
+
+		private:
+			Shader shader;
+			GLuint positionVBO, typeVBO, VAO;
+	};
+}
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef SHALLOWWATER_H
+#define SHALLOWWATER_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Simulation.h"
+
+namespace Water{
+	struct ShallowWaterParameters{
+		//The pool is the rectangle [poolMin, poolMax] of x and z over a flat
+		//bed at height bed, split into square cells cellSize wide. Defaults
+		//are the pool at the bottom of the waterfall
+		glm::vec2 poolMin = glm::vec2(-2.0, -3.0);
+		glm::vec2 poolMax = glm::vec2(6.0, 10.0);
+		GLfloat bed = -4.0;
+		GLfloat cellSize = 0.2;
+
+		//Depth of the water the pool starts with and drains back to
+		GLfloat restDepth = 0.2;
+
+		//Fraction per second of the volume above the rest depth which drains
+		//away. With recycle it comes back as particles at the top of the
+		//waterfall, like the particles Simulation respawns, so the waterfall
+		//keeps running while the pool absorbs it
+		GLfloat drainRate = 0.5;
+		bool recycle = true;
+
+		//Particles less than absorbMargin above the surface which do not
+		//move up are absorbed. impactSpread of their downward speed pushes
+		//the water away from where they hit
+		GLfloat absorbMargin = 0.05;
+		GLfloat impactSpread = 0.5;
+
+		//Where the surface rises faster than splashSpeed the excess is
+		//emitted as particles, splashLift times as fast as the surface rose
+		//and emitHeight above it. At most maxEmitted per update
+		GLfloat splashSpeed = 1.0;
+		GLfloat splashLift = 1.5;
+		GLfloat emitHeight = 0.15;
+		size_t maxEmitted = 64;
+
+		//Fraction of the velocity lost per second to the bed
+		GLfloat friction = 0.2;
+
+		unsigned int seed = 1;
+	};
+
+	//Heightfield shallow water solver for a pool, coupled to a Simulation.
+	//
+	//The pool only keeps the depth of the water in every cell and its
+	//horizontal velocity on the cell faces, so a nearly flat pool costs a
+	//few thousand cells instead of thousands of particles. Particles which
+	//fall into it are removed from the simulation and their volume and
+	//momentum added to the water below them, and where the surface rises
+	//fast enough volume is taken out again as new particles. The pool is
+	//not part of checkpoints
+	class ShallowWater{
+		public:
+			ShallowWater(const ShallowWaterParameters& params = ShallowWaterParameters());
+
+			//Absorbs and emits particles of sim and advances the pool by one
+			//step of sim. Call after every sim.step()
+			void update(Simulation& sim);
+
+			size_t getColumns(){ return columns; }
+			size_t getRows(){ return rows; }
+			GLfloat getCellSize(){ return params.cellSize; }
+			glm::vec2 getMin(){ return params.poolMin; }
+
+			//Height of the surface above the center of cell i, j
+			GLfloat surface(size_t i, size_t j){ return params.bed + depth[i + columns*j]; }
+
+			//Height of the surface at x, z, interpolated between the cells.
+			//The bed outside the pool
+			GLfloat surfaceAt(GLfloat x, GLfloat z);
+
+			//Volume of the water in the pool
+			double volume();
+
+			//Particles absorbed, emitted as splashes and drained back to the
+			//top of the waterfall in the last update
+			size_t getAbsorbed(){ return absorbed; }
+			size_t getEmitted(){ return emitted; }
+			size_t getRecycled(){ return recycled; }
+
+			//Wall time of the last update, in seconds
+			double getUpdateSeconds(){ return updateSeconds; }
+
+		private:
+			ShallowWaterParameters params;
+			size_t columns, rows;
+
+			//depth at the cell centers, u on the faces between columns and w
+			//on the faces between rows. Faces on the walls stay zero
+			std::vector<GLfloat> depth;
+			std::vector<GLfloat> u;
+			std::vector<GLfloat> w;
+			std::vector<GLfloat> depthNext;
+			std::vector<GLfloat> uNext;
+			std::vector<GLfloat> wNext;
+
+			//Depth before the solver ran, the surface rises by the difference
+			std::vector<GLfloat> previous;
+
+			//Volume waiting to be emitted by every cell, and drained volume
+			//waiting to become particles at the source
+			std::vector<GLfloat> splash;
+			double drained;
+			double restVolume;
+
+			size_t absorbed, emitted, recycled;
+			double updateSeconds;
+
+			unsigned int rngState;
+			GLfloat random();
+
+			bool cellAt(GLfloat x, GLfloat z, size_t& i, size_t& j);
+			GLfloat sampleU(GLfloat x, GLfloat z);
+			GLfloat sampleW(GLfloat x, GLfloat z);
+
+			void absorb(Simulation& sim, GLfloat particleVolume);
+			void advance(GLfloat dt, GLfloat gravity);
+			void advect(GLfloat dt);
+			void emit(Simulation& sim, GLfloat particleVolume, GLfloat dt);
+			void drain(Simulation& sim, GLfloat particleVolume, GLfloat dt);
+	};
+}
+
+#endif
@@ -2,6 +2,8 @@
 #define SIMULATION_H
 
 #include <vector>
+#include <string>
+#include <memory>
 #include <iostream>
 #include <cmath>
 #include <glm/glm.hpp>
@@ -9,28 +11,238 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <cmath>
 
+#include "Arena.h"
+#include "CellMap.h"
+#include "SimulationStats.h"
+#include "WorkerGroup.h"
+
+//The solver does not use OpenGL, GLfloat only names the type of its
+//parameters. This is the same definition as in GL/gl.h so either header may
+//be included first
+typedef float GLfloat;
+
 
 namespace Water{
+	//Coarsest level of detail, a particle there is updated every 2^4 steps
+	const int MAX_LOD_LEVELS = 4;
+
 	struct Triangle{
 		glm::vec3 a,b,c;
 	};
 
-	class Simulation{
+	//Read only view of a particle array in place. It stays valid as long as
+	//the simulation, but the values change whenever version does
+	template<typename Scalar>
+	struct BasicParticleView{
+		const glm::tvec3<Scalar>* data;
+		size_t size;
+		uint64_t version;
+
+		const glm::tvec3<Scalar>& operator[](size_t i) const { return data[i]; }
+		const glm::tvec3<Scalar>* begin() const { return data; }
+		const glm::tvec3<Scalar>* end() const { return data + size; }
+	};
+
+	typedef BasicParticleView<float> ParticleView;
+
+	//Physical constants of a simulation, defaults are the waterfall scene
+	struct SimulationParameters{
+		GLfloat v = 3.5; 				//Viscosity
+		GLfloat k = 3.0;				//Presure constant
+		GLfloat g = -9.81;				//Gravitational force
+		GLfloat pm = 10.0;				//Particle mass
+		GLfloat p_0 = 2301.3;			//Rest presure
+		GLfloat d_0 = 1398.0;			//Rest density
+		GLfloat dt = 0.01;				//Time step
+		GLfloat c_R = 0.0;				//Coefficient of restitution
+
+		GLfloat effectiveRadius = 0.50;
+
+		//Seed for respawn positions, each instance has its own generator
+		unsigned int seed = 1;
+
+		//Particles which leave the box [domainMin, domainMax] are respawned
+		//at the top of the waterfall. Open scenes set respawn to false, the
+		//neighbour search itself has no bounds
+		bool respawn = true;
+		glm::vec3 domainMin = glm::vec3(-2.0, -4.5, -8.0);
+		glm::vec3 domainMax = glm::vec3(6.0, 1e30, 10.0);
+
+		//Samples the collision surfaces with static particles about
+		//boundarySpacing apart which push the fluid away through density and
+		//presure (Akinci et al. 2012) instead of testing every particle
+		//against every triangle after moving it
+		bool boundaryParticles = false;
+		GLfloat boundarySpacing = 0.2;
+
+		//Scales the push of the boundary particles. The soft equation of
+		//state needs more than the 1 of the paper to stop fast particles
+		//before they reach the surface
+		GLfloat boundaryStiffness = 3.0;
+
+		//Computes the trapped air and wave crest metrics which seed
+		//SecondaryParticles during the force pass. Can be changed later
+		//with Simulation::setSecondaryMetrics
+		bool secondaryMetrics = false;
+
+		//Level of detail around the viewer, see Simulation::setViewer.
+		//The SPH forces of particles further than lodDistance are updated
+		//every 2nd step, further than 2*lodDistance every 4th and so on up
+		//to every 2^lodLevels steps. Particles still move every step. Zero
+		//updates every particle every step
+		GLfloat lodDistance = 0.0;
+		int lodLevels = 2;
+
+		//Room for owned plus ghost particles, at least the initial particle count
+		size_t capacity = 0;
+
+		//Worker threads for the grid build and the density, force and
+		//collision passes, each owns a contiguous range of the particles. 1
+		//runs them on the calling thread. Results do not depend on the
+		//number of workers
+		int threads = 1;
+
+		//Spreads the workers over the NUMA nodes and pins them there. Each
+		//worker owns a range of the capacity and touches its part of every
+		//particle and grid array first, so the pages are placed on its node.
+		//Every reorderInterval steps the particles are sorted along x, so
+		//the range of a node is a slab of space and most neighbours are on
+		//the same node. This changes their indices. Reads across nodes are
+		//counted in SimulationStats::remoteNeighbors. Set capacity close to
+		//the particle count, workers owning only free room have nothing to do
+		bool numa = false;
+		int reorderInterval = 50;
+	};
+
+	//SPH solver with particles and all arithmetic in Scalar. It is
+	//instantiated for float, the Simulation the viewer and tools use, and
+	//for double, which is slower but drifts less over long offline runs, see
+	//watersim-precision. Parameters and collision surfaces are given in
+	//float either way
+	template<typename Scalar>
+	class BasicSimulation{
 		public:
-			Simulation(size_t particles);
+			typedef glm::tvec3<Scalar> Vector;
+			typedef BasicParticleView<Scalar> View;
+
+			//All particle and grid buffers are carved out of a single 64 byte
+			//aligned arena. Set hugePages to back it with transparent huge pages
+			BasicSimulation(size_t particles, bool hugePages = false);
+			BasicSimulation(size_t particles, const SimulationParameters& params, bool hugePages = false);
+
+			BasicSimulation(const BasicSimulation&) = delete;
+			BasicSimulation& operator=(const BasicSimulation&) = delete;
 
 			//Call this to progress the simulation one time step
 			void step();
 
 			//Returns the position of particle at index
-			glm::vec3 getPosition(size_t index);
+			Vector getPosition(size_t index){ return x[index]; }
 
 			//Returns the velocity of the particle at index
-			glm::vec3 getVelocity(size_t index);
+			Vector getVelocity(size_t index){ return dx[index]; }
+
+			//Positions and velocities of all particles, without the ghosts.
+			//Prefer these over the getters above when reading every particle
+			View positions(){ return view(x); }
+			View velocities(){ return view(dx); }
+
+			//Changes whenever the particles do, by a step, adding or removing
+			//particles or loading a checkpoint
+			uint64_t getVersion(){ return version; }
+
+			//Trapped air and wave crest metrics of the particle at index in the
+			//last step, zero unless SimulationParameters::secondaryMetrics is set
+			Scalar getTrappedAir(size_t index);
+			Scalar getWaveCrest(size_t index);
 
 			//Returns the number of particles in the simulation
 			size_t getNumberOfParticles(){ return N; }
 
+			//Room for particles and ghosts together
+			size_t getCapacity(){ return capacity; }
+
+			//Number of worker threads, 0 if the passes run on the caller
+			size_t getThreads(){ return workers ? workers->size() : 0; }
+
+			//Fraction of the pages of the particle positions which are on the
+			//node of the worker owning them, -1 without NUMA placement or if
+			//the kernel does not tell
+			double getLocalPageFraction();
+
+			//Adds a particle, returns false if the simulation is full.
+			//Clears the ghost particles
+			bool addParticle(Vector position, Vector velocity);
+
+			//Adds a particle where respawned particles start, at the top of
+			//the waterfall. Returns false if the simulation is full
+			bool addSourceParticle();
+
+			//Removes the particle at index by moving the last particle, with all
+			//its state, into its place. Clears the ghost particles
+			void removeParticle(size_t index);
+
+			//Replaces the ghost particles. Ghosts are owned by another
+			//simulation, they contribute to density and forces of this
+			//simulations particles but are not moved by step().
+			//Returns false and clears the ghosts if they do not fit
+			bool setGhosts(const Vector* positions, const Vector* velocities, size_t count);
+
+			//Returns the number of ghost particles
+			size_t getNumberOfGhosts(){ return ghosts; }
+
+			//Timings and counters of the last step
+			const SimulationStats& stats(){ return statistics; }
+
+			//Samples the collision surfaces into boundary particles if they
+			//changed since the last sampling and boundaryParticles is set.
+			//step() does this as well, calling it after adding the surfaces
+			//keeps the sampling out of the first step
+			void updateBoundary();
+
+			//Boundary particles and the seconds their last sampling took
+			size_t getBoundaryParticles(){ return boundary.size(); }
+			double getBoundarySeconds(){ return boundarySeconds; }
+
+			//Returns the radius of the smoothing kernels
+			Scalar getEffectiveRadius(){ return effectiveRadius; }
+
+			//Position the level of detail is measured from
+			void setViewer(Vector position){ viewer = position; }
+
+			//Changes the level of detail, see SimulationParameters::lodDistance.
+			//Every particle starts over at the finest level
+			void setLevelOfDetail(Scalar distance, int levels);
+
+			//Turns the trapped air and wave crest metrics on or off, see
+			//SimulationParameters::secondaryMetrics. They cost the density and
+			//force passes about half again while on. Turned on they start at
+			//zero and are filled in by the next step
+			void setSecondaryMetrics(bool enabled);
+			bool getSecondaryMetrics(){ return secondaryMetrics; }
+
+			Scalar getTimeStep(){ return dt; }
+			Scalar getGravity(){ return g; }
+			Scalar getParticleMass(){ return pm; }
+			Scalar getRestDensity(){ return d_0; }
+
+			//Writes particles, ghosts, parameters, generator state and collision
+			//surfaces to path, see Checkpoint.h for the format.
+			//Returns false if the file could not be written
+			bool save(const std::string& path);
+
+			//Replaces the state with a checkpoint written by save, converting
+			//it if it was written in the other precision. Returns false and
+			//leaves the simulation unchanged if path is not a checkpoint of
+			//this version or holds more particles than the capacity. The
+			//level of detail is not part of checkpoints: the simulation keeps
+			//its own distance and levels and every particle starts over at
+			//the finest level
+			bool load(const std::string& path);
+
+			//Serialises the state into out in the format written by save
+			void snapshot(std::vector<char>& out);
+
 			//Adds a collision plane which is the rectangle (-1,0,-1) x (1,0,1)
 			//transformed by modelMatrix
 			void addPlane(glm::mat4 modelMatrix);
@@ -38,47 +250,159 @@ namespace Water{
 			//Collision surfaces
 			std::vector<Triangle> surfaces;
 
-			void applyForces(int imod);
-			void applyForces();
 		private:
-			//Number of particles
+			//Number of particles, ghosts are stored after them in the arrays
 			size_t N;
+			size_t ghosts;
+			size_t capacity;
+
+			//Owns every buffer below
+			Arena arena;
+
+			uint64_t version;
+			View view(const Vector* data){
+				View v = {data, N, version};
+				return v;
+			}
+
+			SimulationStats statistics;
 
 			//Physical arrays
-			GLfloat* density;
-			GLfloat* presure;
-			glm::vec3* x;
-			glm::vec3* dx;
+			Scalar* density;
+			Scalar* presure;
+			Vector* x;
+			Vector* dx;
+
+			Vector* xcopy;
+			Vector* dxcopy;
+
+			//Cell of every particle and the particles sorted by cell, see CellMap
+			int* particleCell;
+			int* cellParticles;
 
-			glm::vec3* xcopy;
-			glm::vec3* dxcopy;
+			//Unit normals of the particles at the surface, zero inside, and
+			//the metrics computed from them. NULL until secondaryMetrics is
+			//first turned on, then kept
+			bool secondaryMetrics;
+			Vector* surfaceNormal;
+			Scalar* trappedAir;
+			Scalar* waveCrest;
+			void allocateMetrics();
 
-			int** ht;
-			int* htBuckets;
-			size_t htSize = 19753;
-			size_t htBucket = 100;
+			//Level of detail of every particle, the steps since its last
+			//update and the steps its force is applied over in this one,
+			//zero if it is skipped. Unused while lodDistance is zero
+			Scalar lodDistance;
+			int lodLevels;
+			Vector viewer;
+			uint8_t* lodLevel;
+			uint8_t* lodWaiting;
+			uint8_t* lodSteps;
+
+			//Time the SPH force on particle i is applied over in this step
+			Scalar forceTime(int i){ return lodDistance > 0.0f ? lodSteps[i]*dt : dt; }
 
 			//Physical constans
-			GLfloat v = 1.0; 				//Viscosity
-			GLfloat k = 0.0001;				//Presure constant
-			GLfloat g = -9.81;				//Gravitational force
-			GLfloat pm = 1.0;				//Particle mass
-			GLfloat p_0 = 1.0;				//Rest presure
-			GLfloat d_0 = 1.0;				//Rest density
-			GLfloat dt = 0.04;				//Time step
-			GLfloat c_R = 0.1;
-
-			GLfloat effectiveRadius = 0.4;
+			Scalar v = 1.0; 				//Viscosity
+			Scalar k = 0.0001;				//Presure constant
+			Scalar g = -9.81;				//Gravitational force
+			Scalar pm = 1.0;				//Particle mass
+			Scalar p_0 = 1.0;				//Rest presure
+			Scalar d_0 = 1.0;				//Rest density
+			Scalar dt = 0.04;				//Time step
+			Scalar c_R = 0.1;
+
+			Scalar effectiveRadius = 0.4;
+
+			bool respawn;
+			Vector domainMin;
+			Vector domainMax;
+
+			//State of the xorshift generator used for respawning
+			unsigned int rngState;
+			Scalar random();
 			GLfloat gridRes = 0.2;
 			int checkGridHalfWidth = 3;
 
+			//Occupied cells of size gridRes, rebuilt at the start of every step
+			CellMap grid;
+
+			//Static particles sampling the surfaces and their masses, which
+			//are larger where the sampling is sparse. They are sampled again
+			//whenever the number of surfaces changes. Their cells are as wide
+			//as the kernel, so only the 3^3 cells around a particle are read
+			bool useBoundary;
+			GLfloat boundarySpacing;
+			Scalar boundaryStiffness;
+			std::vector<Vector> boundary;
+			std::vector<Scalar> boundaryMass;
+			std::vector<int> boundaryCell;
+			std::vector<int> boundaryParticles;
+			CellMap boundaryGrid;
+			size_t boundarySurfaces;
+			double boundarySeconds;
+
+			//Phases of step(). Each works on the particles in [begin, end) so
+			//they can be split up and timed separately, and counts into
+			//counters so workers do not share them. The density and force
+			//passes return the number of particle pairs they visited
+			size_t computeDensity(size_t begin, size_t end, SimulationStats& counters);
+			size_t computeForces(size_t begin, size_t end, SimulationStats& counters);
+			void collideParticles(size_t begin, size_t end, SimulationStats& counters);
+			void respawnParticles(size_t begin, size_t end);
+			void placeAtSource(size_t i);
+
+			void accumulateMetrics(int i, int k, Scalar& air, Scalar& crest);
+			void updateLevelOfDetail();
+
+			//Worker threads, NULL when the passes run on the caller. With
+			//NUMA placement worker w owns the particles from owner[w] up to
+			//owner[w+1] and the particles from nodeBegin[n] up to
+			//nodeBegin[n+1] are on the n-th node with workers, which the
+			//kernel calls nodeIds[n]
+			std::unique_ptr<WorkerGroup> workers;
+			bool numa;
+			int reorderInterval;
+			std::vector<size_t> owner;
+			std::vector<size_t> nodeBegin;
+			std::vector<int> nodeIds;
+			int nodeOf(size_t i){
+				int n = 0;
+				while(i >= nodeBegin[n+1]) n++;
+				return n;
+			}
 
-			bool collideAndMove(int index, glm::vec3 &particleStep);
-			GLfloat findCollision(int index, Triangle tri, glm::vec3 &particleStep);
+			//Particles in [0, count) worker w works on
+			void partition(size_t w, size_t count, size_t& begin, size_t& end);
+
+			//Runs phase(begin, end, counters) on every worker and returns the
+			//sum of what it returned, adding the counters to statistics
+			template<typename Phase>
+			size_t parallel(size_t count, Phase phase);
+
+			//Has every worker write its part of the arrays first
+			void placeParticles(size_t metricCapacity);
+
+			//Sorts the particles by their cell, with cells ordered along x.
+			//Ghosts stay where they are
+			void sortParticles();
+			std::vector<int> sortRemap;
+			std::vector<int> sortDestination;
+			std::vector<unsigned int> sortStart;
+
+			bool collideAndMove(int index, Vector &particleStep, SimulationStats& counters);
+			Scalar findCollision(int index, Triangle tri, Vector &particleStep);
 
-			size_t hash(glm::vec3 t);
 			void hashParticles();
+			void sampleBoundary();
+
+			void init(size_t particles, const SimulationParameters& params, bool hugePages);
+
+			friend class Benchmark;
 	};
+
+	typedef BasicSimulation<float> Simulation;
+	typedef BasicSimulation<double> DoubleSimulation;
 }
 
 #endif
@@ -0,0 +1,75 @@
+#ifndef SIMULATIONSTATS_H
+#define SIMULATIONSTATS_H
+
+#include <chrono>
+#include <cstdint>
+
+//Build with -DWATERSIM_STATS=0 to compile the hot path counters out
+#ifndef WATERSIM_STATS
+#define WATERSIM_STATS 1
+#endif
+
+#if WATERSIM_STATS
+#define SIM_COUNT(counter, n) ((counter) += (n))
+#else
+#define SIM_COUNT(counter, n) ((void)0)
+#endif
+
+namespace Water{
+	//Phases of Simulation::step in the order they run
+	enum SimulationPhase{
+		PHASE_HASH,
+		PHASE_DENSITY,
+		PHASE_FORCES,
+		PHASE_COLLISION,
+		PHASE_RESPAWN,
+		PHASE_COUNT
+	};
+
+	//Timings and counters of the last step of a simulation
+	struct SimulationStats{
+		//Number of steps taken so far
+		uint64_t steps = 0;
+
+		//Wall time of the last step and of each of its phases, in seconds
+		double stepSeconds = 0.0;
+		double phaseSeconds[PHASE_COUNT] = {};
+
+		//Hot path counters of the last step, always zero when the
+		//simulation is built with WATERSIM_STATS=0
+		uint64_t neighborsVisited = 0;
+		uint64_t kernelEvaluations = 0;
+		uint64_t triangleTests = 0;
+		uint64_t bounces = 0;
+		uint64_t respawns = 0;
+
+		//Neighbour visits in the density and force passes whose particle is
+		//owned by a worker on another NUMA node, each one reads memory across
+		//nodes. Only counted with SimulationParameters::numa
+		uint64_t remoteNeighbors = 0;
+
+		//Particles updated in the last step, fewer than all of them when a
+		//level of detail is set
+		uint64_t activeParticles = 0;
+
+		static const char* phaseName(int phase){
+			static const char* names[PHASE_COUNT] = {"hash", "density", "forces", "collision", "respawn"};
+			return names[phase];
+		}
+	};
+
+	//Adds the time between construction and destruction to seconds
+	class ScopedTimer{
+		public:
+			ScopedTimer(double& s) : seconds(s), start(std::chrono::steady_clock::now()) {}
+			~ScopedTimer(){
+				seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			}
+
+		private:
+			double& seconds;
+			std::chrono::steady_clock::time_point start;
+	};
+}
+
+#endif
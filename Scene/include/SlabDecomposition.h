@@ -0,0 +1,55 @@
+#ifndef SLABDECOMPOSITION_H
+#define SLABDECOMPOSITION_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Simulation.h"
+#include "Transport.h"
+
+namespace Water{
+	//Runs the part of a simulation that lies in one slab of the domain.
+	//The domain is cut along z into one slab per rank. Every step particles
+	//which left the slab are sent to their new owner and particles close to
+	//a slab boundary are sent to the neighbouring slab as ghosts
+	class SlabDecomposition{
+		public:
+			//sim holds the particles and surfaces of this rank, transport
+			//must already be attached. zLow and zHigh bound the histogram
+			//used for rebalancing
+			SlabDecomposition(Simulation& sim, Transport& transport, GLfloat zLow, GLfloat zHigh);
+
+			//Removes every particle of sim which is not in this ranks slab
+			void keepOwnParticles();
+
+			//Migrates particles, exchanges halos and steps the simulation
+			void step();
+
+			//Moves the slab boundaries so every rank owns about the same
+			//number of particles. blend = 1 jumps straight to the balanced
+			//boundaries, smaller values follow the particles gradually
+			void rebalance(GLfloat blend);
+
+			//Width of the ghost layer on each side of a boundary
+			GLfloat haloWidth;
+
+			//Statistics of the last step
+			size_t migratedOut;
+			size_t migratedIn;
+
+			//Slab boundaries, rank r owns z in [boundaries[r], boundaries[r+1])
+			std::vector<GLfloat> boundaries;
+
+		private:
+			Simulation& sim;
+			Transport& transport;
+
+			GLfloat zLow, zHigh;
+
+			int owner(GLfloat z);
+			void migrate();
+			void exchangeHalos();
+	};
+}
+
+#endif
@@ -17,11 +17,22 @@ namespace Water{
 			Sphere(int resolution, GLfloat radius);
 
 			void draw(Shader s, glm::vec3 position, glm::vec3 velocity);
+
+			//Draws count spheres in one instanced call, uploading the
+			//positions and velocities first. s has to place every instance
+			//itself, like shaders/water_instanced.vs
+			void drawInstanced(Shader s, const glm::vec3* positions, const glm::vec3* velocities, size_t count);
+
+			//Replaces the vertices with those of a sphere of resolution rings
+			void setResolution(int resolution);
+			int getResolution(){ return resolution; }
 		private:
 			GLuint VBO, VAO;
+			GLuint positionVBO, velocityVBO, instancedVAO;
 
 			size_t numberOfVertices;
 			GLfloat radius;
+			int resolution;
 
 			std::vector<glm::vec3> Sphere::generateSphereVertices(int resolution);
 	};
@@ -0,0 +1,85 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <string>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+#include "SimulationStats.h"
+
+namespace Water{
+	//Serves the counters of a running simulation in the Prometheus text
+	//format, for example
+	//	curl http://127.0.0.1:9464/metrics
+	//	curl --unix-socket /tmp/watersim.sock http://localhost/metrics
+	//
+	//The frame loop only stores into atomics, a background thread answers
+	//the requests, so a slow or stuck scraper never holds up a frame.
+	//
+	//Setting WATERSIM_TELEMETRY=port or WATERSIM_TELEMETRY=path starts it
+	//at launch, see startFromEnvironment.
+	class Telemetry{
+		public:
+			Telemetry();
+
+			//Stops the server
+			~Telemetry();
+
+			Telemetry(const Telemetry&) = delete;
+			Telemetry& operator=(const Telemetry&) = delete;
+
+			//Listens on 127.0.0.1:port if address is a number and on a UNIX
+			//socket at address otherwise. Returns false if it could not bind
+			bool start(const std::string& address);
+			void stop();
+
+			//Reads WATERSIM_TELEMETRY, returns false if it is set but the
+			//server could not be started
+			bool startFromEnvironment();
+
+			//Publishes the counters of the last step and the number of
+			//particles after it
+			void recordStep(const SimulationStats& stats, size_t particles);
+
+			//Publishes the wall time of a displayed frame
+			void recordFrame(double seconds);
+
+			//Publishes the number of secondary particles
+			void recordSecondary(size_t particles);
+
+			//Requests answered so far
+			uint64_t getRequests(){ return requests.load(std::memory_order_relaxed); }
+
+		private:
+			//Written by the frame loop only, read by the server thread
+			std::atomic<uint64_t> steps;
+			std::atomic<uint64_t> frames;
+			std::atomic<uint64_t> respawns;
+			std::atomic<uint64_t> bounces;
+			std::atomic<uint64_t> neighbors;
+			std::atomic<uint64_t> remoteNeighbors;
+			std::atomic<uint64_t> particles;
+			std::atomic<uint64_t> activeParticles;
+			std::atomic<uint64_t> secondaryParticles;
+			std::atomic<double> stepSeconds;
+			std::atomic<double> stepSecondsTotal;
+			std::atomic<double> frameSeconds;
+			std::atomic<double> frameSecondsTotal;
+			std::atomic<double> phaseSeconds[PHASE_COUNT];
+
+			std::atomic<uint64_t> requests;
+
+			std::thread server;
+			int listener;
+			std::string socketPath;
+
+			//Written to by stop to wake the server thread
+			int wakeup[2];
+
+			void serve();
+			std::string render();
+	};
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace Water{
+	//Fixed set of worker threads that run submitted tasks in FIFO order
+	class ThreadPool{
+		public:
+			//threads = 0 uses one worker per hardware thread
+			ThreadPool(size_t threads = 0);
+
+			//Finishes all queued tasks before joining the workers
+			~ThreadPool();
+
+			ThreadPool(const ThreadPool&) = delete;
+			ThreadPool& operator=(const ThreadPool&) = delete;
+
+			//Queues a task to be run on one of the workers
+			void submit(std::function<void()> task);
+
+			//Blocks until the queue is empty and no task is running
+			void wait();
+
+			//Returns the number of worker threads
+			size_t size(){ return workers.size(); }
+
+		private:
+			std::vector<std::thread> workers;
+			std::deque<std::function<void()> > tasks;
+
+			std::mutex lock;
+			std::condition_variable hasWork;
+			std::condition_variable isIdle;
+			size_t running;
+			bool stopping;
+
+			void work();
+	};
+}
+
+#endif
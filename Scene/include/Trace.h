@@ -0,0 +1,70 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <cstdint>
+
+namespace Water{
+	//Timeline recorder which writes Chrome trace event JSON, open the files
+	//in chrome://tracing or ui.perfetto.dev.
+	//
+	//Every thread records into its own ring buffer without taking locks. The
+	//rings keep the most recent events, so a trace holds at most the last
+	//RING_EVENTS events of each thread.
+	//
+	//Setting WATERSIM_TRACE=file starts recording at launch, and
+	//WATERSIM_TRACE_SECONDS=s stops it and writes file after s seconds.
+	namespace Trace{
+		const size_t RING_EVENTS = 1 << 16;
+
+		//Nanoseconds on a monotonic clock
+		uint64_t now();
+
+		bool isRecording();
+
+		//Starts recording, events from before this call are dropped
+		void start();
+
+		//Stops recording and writes the events to path.
+		//Returns false if the file could not be written
+		bool stop(const std::string& path);
+
+		//Starts or stops recording, a new file name is chosen for every trace
+		void toggle();
+
+		//Records an event. name must outlive the trace, use string literals
+		void record(const char* name, uint64_t begin, uint64_t end);
+
+		//Names the calling thread in the trace
+		void setThreadName(const char* name);
+
+		//Reads WATERSIM_TRACE and WATERSIM_TRACE_SECONDS
+		void startFromEnvironment();
+
+		//Call once per frame, stops a trace started from the environment
+		//once its time is up
+		void update();
+
+		//Writes a trace which is still recording, call before exiting
+		void shutdown();
+	}
+
+	//Records the lifetime of the scope as one event
+	class TraceScope{
+		public:
+			TraceScope(const char* n) : name(n), begin(Trace::isRecording() ? Trace::now() : 0) {}
+			~TraceScope(){
+				if(begin != 0) Trace::record(name, begin, Trace::now());
+			}
+
+		private:
+			const char* name;
+			uint64_t begin;
+	};
+}
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) Water::TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <vector>
+#include <cstddef>
+
+namespace Water{
+	//Message passing between the processes of a decomposed simulation.
+	//A transport is created in the launching process for a fixed number of
+	//ranks, the launcher then forks one process per rank and each child
+	//calls attach with its rank before sending anything.
+	class Transport{
+		public:
+			Transport(int size);
+			virtual ~Transport(){}
+
+			Transport(const Transport&) = delete;
+			Transport& operator=(const Transport&) = delete;
+
+			//Binds this process to rank
+			virtual void attach(int rank) = 0;
+
+			//Sends a whole message to peer, blocks until it is buffered
+			virtual void send(int peer, const std::vector<char>& message) = 0;
+
+			//Receives the next message from peer, blocks until it arrives
+			virtual void receive(int peer, std::vector<char>& message) = 0;
+
+			//Swaps messages with peer. The lower rank sends first so two
+			//ranks exchanging large messages can not deadlock
+			void exchange(int peer, const std::vector<char>& out, std::vector<char>& in);
+
+			int rank(){ return myRank; }
+			int size(){ return worldSize; }
+
+		protected:
+			int myRank;
+			int worldSize;
+	};
+
+	//Transport over single producer single consumer byte rings in a shared
+	//anonymous mapping, one ring per ordered pair of ranks
+	class ShmTransport : public Transport{
+		public:
+			ShmTransport(int size, size_t ringBytes = 4*1024*1024);
+			~ShmTransport();
+
+			void attach(int rank);
+			void send(int peer, const std::vector<char>& message);
+			void receive(int peer, std::vector<char>& message);
+
+		private:
+			struct Ring;
+
+			char* region;
+			size_t regionBytes;
+			size_t ringBytes;
+
+			Ring* ring(int from, int to);
+			void write(Ring* r, const char* data, size_t bytes);
+			void read(Ring* r, char* data, size_t bytes);
+	};
+
+	//Transport over TCP connections on the loopback interface, one
+	//connection per pair of ranks
+	class TcpTransport : public Transport{
+		public:
+			TcpTransport(int size);
+			~TcpTransport();
+
+			void attach(int rank);
+			void send(int peer, const std::vector<char>& message);
+			void receive(int peer, std::vector<char>& message);
+
+		private:
+			//Listening socket of every rank, created before forking
+			std::vector<int> listeners;
+			std::vector<unsigned short> ports;
+
+			//Connected socket to every peer, -1 for this rank
+			std::vector<int> peers;
+
+			void write(int fd, const char* data, size_t bytes);
+			void read(int fd, char* data, size_t bytes);
+	};
+}
+
+#endif
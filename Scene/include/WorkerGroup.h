@@ -0,0 +1,64 @@
+#ifndef WORKERGROUP_H
+#define WORKERGROUP_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+#include "Numa.h"
+
+namespace Water{
+	//Fixed team of worker threads which all run the same function, each
+	//with its own index, and are waited for together.
+	//
+	//Unlike ThreadPool the work is not queued: worker w is always the same
+	//thread, so it can own a part of the data and touch it first. With a
+	//topology the workers are spread evenly over its nodes in order, the
+	//first ones on node 0, and pinned to the CPUs of their node
+	class WorkerGroup{
+		public:
+			WorkerGroup(size_t threads, const NumaTopology* topology = NULL);
+
+			//Joins the workers, they must be idle
+			~WorkerGroup();
+
+			WorkerGroup(const WorkerGroup&) = delete;
+			WorkerGroup& operator=(const WorkerGroup&) = delete;
+
+			//Runs f(worker) on every worker and returns once all are done
+			void run(const std::function<void(size_t)>& f);
+
+			size_t size(){ return workers.size(); }
+
+			//Node worker runs on, 0 without a topology
+			int nodeOf(size_t worker){ return nodes[worker]; }
+
+			//Number the kernel gives the node of worker
+			int systemNodeOf(size_t worker){ return pin ? topology.ids[nodes[worker]] : 0; }
+
+			//Number of workers whose affinity could be set
+			size_t getPinned();
+
+		private:
+			std::vector<std::thread> workers;
+			std::vector<int> nodes;
+			NumaTopology topology;
+			bool pin;
+
+			std::mutex lock;
+			std::condition_variable started;
+			std::condition_variable finished;
+			const std::function<void(size_t)>* task;
+			uint64_t generation;
+			size_t pending;
+			size_t pinned;
+			bool stopping;
+
+			void work(size_t worker);
+	};
+}
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef WATERSIM_H
+#define WATERSIM_H
+
+//C interface of libwatersim.so, for embedding the solver in other programs.
+//
+//Only plain C types cross it, so it can be loaded from C, Python ctypes or a
+//plugin built with another compiler. Functions are only ever added, and
+//watersim_params only grows at its end: callers set its size field, and
+//fields past that size take their defaults.
+//
+//The library exports nothing but these functions, and none of them lets a
+//C++ exception escape: failures are reported through their return values.
+//
+//Particle buffers are handed out in place. The pointers stay valid until the
+//simulation is destroyed and are updated by every step, so read them between
+//steps, never while one runs on another thread.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+//Bumped when a function changes in a way old callers would notice
+#define WATERSIM_ABI_VERSION 1
+
+typedef struct watersim watersim;
+
+//Mirrors Water::SimulationParameters
+typedef struct watersim_params{
+	//sizeof(watersim_params) of the caller, set by watersim_default_params
+	size_t size;
+
+	float viscosity;
+	float stiffness;
+	float gravity;
+	float particle_mass;
+	float rest_pressure;
+	float rest_density;
+	float time_step;
+	float restitution;
+	float effective_radius;
+	uint32_t seed;
+
+	//Particles leaving the box are respawned at the top of the waterfall
+	//unless respawn is zero
+	int32_t respawn;
+	float domain_min[3];
+	float domain_max[3];
+
+	//Boundary particles instead of triangle collisions
+	int32_t boundary_particles;
+	float boundary_spacing;
+	float boundary_stiffness;
+
+	//Level of detail around the viewer, zero distance turns it off
+	float lod_distance;
+	int32_t lod_levels;
+
+	//Room for particles, at least the initial count
+	size_t capacity;
+
+	//Worker threads, and whether to pin them to NUMA nodes with the
+	//particles they own on the same node
+	int32_t threads;
+	int32_t numa;
+	int32_t reorder_interval;
+} watersim_params;
+
+//A particle buffer: count elements of three floats, stride bytes apart
+typedef struct watersim_buffer{
+	const float* data;
+	size_t count;
+	size_t stride;
+} watersim_buffer;
+
+//WATERSIM_ABI_VERSION the library was built with
+uint32_t watersim_abi_version(void);
+
+//Fills params with the defaults of the waterfall scene
+void watersim_default_params(watersim_params* params);
+
+//Creates a simulation with particles on the initial lattice. params may be
+//NULL for the defaults. Returns NULL if an allocation fails, but like the
+//rest of the solver it aborts if the particle arrays can not be mapped
+watersim* watersim_create(size_t particles, const watersim_params* params);
+void watersim_destroy(watersim* sim);
+
+//Progresses the simulation by steps time steps. Returns zero if a step
+//failed, after which the particles are left in an unknown state
+int watersim_step(watersim* sim, int steps);
+
+//Adds a particle, returns zero if the simulation is full
+int watersim_add_particle(watersim* sim, const float position[3], const float velocity[3]);
+
+//Collision surfaces. A plane is the rectangle (-1,0,-1) x (1,0,1) transformed
+//by a column major 4x4 matrix, as in OpenGL. Return zero if the surfaces
+//could not grow
+int watersim_add_triangle(watersim* sim, const float a[3], const float b[3], const float c[3]);
+int watersim_add_plane(watersim* sim, const float matrix[16]);
+
+//Adds the collision surfaces of the waterfall scene, returns zero on failure
+int watersim_add_waterfall(watersim* sim);
+
+//Position the level of detail is measured from
+void watersim_set_viewer(watersim* sim, const float position[3]);
+
+size_t watersim_particle_count(watersim* sim);
+
+//Positions and velocities of the particles, read in place. The count only
+//holds until particles are added or a checkpoint is loaded
+watersim_buffer watersim_positions(watersim* sim);
+watersim_buffer watersim_velocities(watersim* sim);
+
+//Changes whenever the buffers do, a host can skip reading them while it
+//stays the same
+uint64_t watersim_version(watersim* sim);
+
+//Wall time of the last step in seconds
+double watersim_step_seconds(watersim* sim);
+
+//Checkpoints, see Checkpoint.h. Return zero on failure
+int watersim_save(watersim* sim, const char* path);
+int watersim_load(watersim* sim, const char* path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,9 @@
+#version 330 core
+out vec4 color;
+
+in vec3 Color;
+
+void main()
+{
+	color = vec4(Color, 0.8);
+}
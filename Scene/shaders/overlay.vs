@@ -0,0 +1,11 @@
+#version 330 core
+layout (location = 0) in vec2 position;
+layout (location = 1) in vec3 color;
+
+out vec3 Color;
+
+void main()
+{
+	gl_Position = vec4(position, 0.0, 1.0);
+	Color = color;
+}
@@ -0,0 +1,14 @@
+#version 330 core
+out vec4 color;
+
+in vec4 Color;
+
+void main()
+{
+	// Round points fading towards the edge
+	vec2 p = 2.0*gl_PointCoord - 1.0;
+	float r = dot(p, p);
+	if(r > 1.0) discard;
+
+	color = vec4(Color.rgb, Color.a*(1.0 - r));
+}
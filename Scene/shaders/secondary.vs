@@ -0,0 +1,20 @@
+#version 330 core
+layout (location = 0) in vec3 position;
+layout (location = 1) in float type;
+
+out vec4 Color;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform float pointScale;
+
+void main()
+{
+	gl_Position = projection * view * vec4(position, 1.0);
+	gl_PointSize = max(pointScale / gl_Position.w, 1.0);
+
+	// Spray, foam, bubble
+	if(type < 0.5) Color = vec4(1.0, 1.0, 1.0, 0.9);
+	else if(type < 1.5) Color = vec4(0.85, 0.9, 0.95, 0.6);
+	else Color = vec4(0.6, 0.8, 1.0, 0.4);
+}
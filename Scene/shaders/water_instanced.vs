@@ -0,0 +1,22 @@
+#version 330 core
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
+layout (location = 2) in vec3 center;
+layout (location = 3) in vec3 velocity;
+
+out vec3 Normal;
+out vec3 FragPos;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+	// Same stretch along the velocity as Sphere::draw
+	vec3 stretch = length(velocity) > 0.0 ? abs(normalize(velocity)) : vec3(0.0);
+	vec3 world = center + (1.0 + 1.8*stretch)*0.5*position;
+	gl_Position = projection * view * vec4(world, 1.0);
+
+	FragPos = world;
+	Normal = normal;
+}
@@ -0,0 +1,76 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstdint>
+#include <sys/mman.h>
+
+#include "Arena.h"
+
+using namespace Water;
+using namespace std;
+
+static const size_t HUGE_PAGE = 2*1024*1024;
+
+Arena::Arena(){
+	base = NULL;
+	used = 0;
+	cap = 0;
+	mapped = 0;
+}
+
+Arena::~Arena(){
+	if(base != NULL){
+		munmap(base, mapped);
+	}
+}
+
+size_t Arena::padded(size_t bytes){
+	return (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+void Arena::reserve(size_t bytes, bool hugePages){
+	if(base != NULL){
+		cerr << "Arena::reserve called twice" << endl;
+		abort();
+	}
+
+	cap = padded(bytes);
+	if(cap == 0) cap = ALIGNMENT;
+
+	//Anonymous mappings are page aligned and already zero filled
+	size_t length = hugePages ? (cap + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1) : cap;
+	size_t request = hugePages ? length + HUGE_PAGE : length;
+
+	void* p = mmap(NULL, request, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED){
+		cerr << "Arena: failed to map " << request << " bytes" << endl;
+		abort();
+	}
+
+	char* start = (char*)p;
+	if(hugePages){
+		//Trim the mapping so the block starts on a huge page boundary
+		char* aligned = (char*)(((uintptr_t)start + HUGE_PAGE - 1) & ~(uintptr_t)(HUGE_PAGE - 1));
+		if(aligned != start) munmap(start, aligned - start);
+		size_t tail = (start + request) - (aligned + length);
+		if(tail > 0) munmap(aligned + length, tail);
+		start = aligned;
+#ifdef MADV_HUGEPAGE
+		madvise(start, length, MADV_HUGEPAGE);
+#endif
+	}
+
+	base = start;
+	mapped = length;
+	used = 0;
+}
+
+void* Arena::allocateBytes(size_t bytes){
+	size_t n = padded(bytes);
+	if(base == NULL || used + n > cap){
+		cerr << "Arena: out of memory (" << used << " + " << n << " > " << cap << ")" << endl;
+		abort();
+	}
+	void* p = base + used;
+	used += n;
+	return p;
+}
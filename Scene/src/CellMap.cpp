@@ -0,0 +1,310 @@
+#include <algorithm>
+
+#include "CellMap.h"
+#include "WorkerGroup.h"
+
+using namespace Water;
+using namespace std;
+
+static const size_t MIN_SLOTS = 64;
+
+//Digits of the radix sort of the parallel build
+static const int RADIX_BITS = 11;
+static const size_t RADIX = 1 << RADIX_BITS;
+
+CellMap::CellMap(float size){
+	cellSize = size;
+	inverseSize = 1.0f / size;
+	table.assign(MIN_SLOTS, -1);
+	mask = MIN_SLOTS - 1;
+}
+
+void CellMap::resize(size_t slots){
+	table.assign(slots, -1);
+	mask = slots - 1;
+	for(size_t c=0; c<cells.size(); c++){
+		size_t s = hash(cells[c].x, cells[c].y, cells[c].z) & mask;
+		while(table[s] >= 0) s = (s + 1) & mask;
+		table[s] = c;
+	}
+}
+
+int CellMap::insert(int x, int y, int z){
+	size_t s = hash(x, y, z) & mask;
+	while(true){
+		int c = table[s];
+		if(c < 0) break;
+		if(cells[c].x == x && cells[c].y == y && cells[c].z == z) return c;
+		s = (s + 1) & mask;
+	}
+
+	//Keep the table at most half full so probe sequences stay short
+	if(2*(cells.size() + 1) > table.size()){
+		resize(2*table.size());
+		s = hash(x, y, z) & mask;
+		while(table[s] >= 0) s = (s + 1) & mask;
+	}
+
+	Cell cell;
+	cell.x = x;
+	cell.y = y;
+	cell.z = z;
+	cell.begin = 0;
+	cell.count = 0;
+	table[s] = cells.size();
+	cells.push_back(cell);
+	return table[s];
+}
+
+void CellMap::clear(){
+	//Keep the table sized for the cells of the last build, shrinking it
+	//when most of them were vacated
+	size_t slots = table.size();
+	while(slots > MIN_SLOTS && 8*cells.size() < slots) slots /= 2;
+	cells.clear();
+	if(slots != table.size()) resize(slots);
+	else table.assign(slots, -1);
+}
+
+static bool cellBefore(const CellMap::Cell& a, const CellMap::Cell& b){
+	if(a.x != b.x) return a.x < b.x;
+	if(a.y != b.y) return a.y < b.y;
+	return a.z < b.z;
+}
+
+void CellMap::sort(vector<int>& remap){
+	//begin temporarily holds the old index of every cell
+	for(size_t c=0; c<cells.size(); c++){
+		cells[c].begin = c;
+	}
+	std::sort(cells.begin(), cells.end(), cellBefore);
+
+	remap.resize(cells.size());
+	for(size_t c=0; c<cells.size(); c++){
+		remap[cells[c].begin] = c;
+		cells[c].begin = 0;
+	}
+	resize(table.size());
+}
+
+template<typename Scalar>
+void CellMap::build(const glm::tvec3<Scalar>* positions, size_t count, int* cellOf, int* particles){
+	clear();
+
+	for(size_t i=0; i<count; i++){
+		int x, y, z;
+		coordinates(positions[i], x, y, z);
+		int c = insert(x, y, z);
+		cellOf[i] = c;
+		cells[c].count++;
+	}
+
+	//Counting sort of the particles by cell
+	unsigned int begin = 0;
+	for(size_t c=0; c<cells.size(); c++){
+		cells[c].begin = begin;
+		begin += cells[c].count;
+		cells[c].count = 0;
+	}
+	for(size_t i=0; i<count; i++){
+		Cell& cell = cells[cellOf[i]];
+		particles[cell.begin + cell.count++] = i;
+	}
+}
+
+//Part of n items worker w of workers works on
+static void split(size_t w, size_t workers, size_t n, size_t& begin, size_t& end){
+	begin = n*w / workers;
+	end = n*(w+1) / workers;
+}
+
+//The keys are written in an earlier pass, so the slots are the only shared
+//state and relaxed ordering is enough
+bool CellMap::claim(size_t begin, size_t end, atomic<size_t>& claimed){
+	for(size_t i=begin; i<end; i++){
+		const Coordinates& k = keys[i];
+		size_t s = hash(k.x, k.y, k.z) & mask;
+		while(true){
+			int c = claims[s].load(memory_order_relaxed);
+			if(c < 0){
+				//A slot is counted before it is taken so the table never
+				//gets more than half full, even while it overflows
+				if(2*(claimed.fetch_add(1, memory_order_relaxed) + 1) > claims.size()) return false;
+				if(claims[s].compare_exchange_strong(c, (int)i, memory_order_relaxed)) break;
+				claimed.fetch_sub(1, memory_order_relaxed);
+				continue;
+			}
+			const Coordinates& o = keys[c];
+			if(o.x == k.x && o.y == k.y && o.z == k.z){
+				//Only particles of this cell write to the slot from now on
+				while(c > (int)i && !claims[s].compare_exchange_weak(c, (int)i, memory_order_relaxed)) {}
+				break;
+			}
+			s = (s + 1) & mask;
+		}
+		slotOf[i] = s;
+	}
+	return true;
+}
+
+//build adds a cell when it meets its first particle, so the cells are in
+//the order of the lowest particle in them. Here every cell claims a slot of
+//the table, keeping the lowest particle, and the cells are numbered by a
+//prefix sum over the particles which kept their slot. A stable radix sort
+//by cell then groups the particles with each cell in increasing order, so
+//nothing depends on the order the workers ran in
+template<typename Scalar>
+void CellMap::build(const glm::tvec3<Scalar>* positions, size_t count, int* cellOf, int* particles, WorkerGroup& workers){
+	size_t T = workers.size();
+	size_t slots = table.size();
+	while(slots > MIN_SLOTS && 8*cells.size() < slots) slots /= 2;
+	keys.resize(count);
+	slotOf.resize(count);
+	offsets.resize(T + 1);
+	offsets[0] = 0;
+
+	workers.run([&](size_t w){
+		size_t begin, end;
+		split(w, T, count, begin, end);
+		for(size_t i=begin; i<end; i++){
+			Coordinates& k = keys[i];
+			coordinates(positions[i], k.x, k.y, k.z);
+		}
+	});
+
+	//The table keeps its size from the last build and doubles until every
+	//cell fits
+	while(true){
+		if(claims.size() != slots) claims = vector<atomic<int> >(slots);
+		mask = slots - 1;
+		atomic<size_t> claimed(0);
+		atomic<bool> full(false);
+		workers.run([&](size_t w){
+			size_t begin, end;
+			split(w, T, slots, begin, end);
+			for(size_t s=begin; s<end; s++){
+				claims[s].store(-1, memory_order_relaxed);
+			}
+		});
+		workers.run([&](size_t w){
+			size_t begin, end;
+			split(w, T, count, begin, end);
+			if(!claim(begin, end, claimed)) full.store(true);
+		});
+		if(!full.load()) break;
+		slots *= 2;
+	}
+
+	//Cells are numbered by their lowest particle
+	workers.run([&](size_t w){
+		size_t begin, end;
+		split(w, T, count, begin, end);
+		size_t first = 0;
+		for(size_t i=begin; i<end; i++){
+			if(claims[slotOf[i]].load(memory_order_relaxed) == (int)i) first++;
+		}
+		offsets[w+1] = first;
+	});
+	for(size_t w=0; w<T; w++){
+		offsets[w+1] += offsets[w];
+	}
+	cells.resize(offsets[T]);
+
+	workers.run([&](size_t w){
+		size_t begin, end;
+		split(w, T, count, begin, end);
+		int next = offsets[w];
+		for(size_t i=begin; i<end; i++){
+			if(claims[slotOf[i]].load(memory_order_relaxed) != (int)i) continue;
+			Cell& cell = cells[next];
+			cell.x = keys[i].x;
+			cell.y = keys[i].y;
+			cell.z = keys[i].z;
+			cell.begin = 0;
+			cell.count = 0;
+			cellOf[i] = next++;
+		}
+	});
+
+	//Every other particle takes the cell of the lowest one in it
+	pairs.resize(count);
+	sorted.resize(count);
+	workers.run([&](size_t w){
+		size_t begin, end;
+		split(w, T, count, begin, end);
+		for(size_t i=begin; i<end; i++){
+			int first = claims[slotOf[i]].load(memory_order_relaxed);
+			if(first != (int)i) cellOf[i] = cellOf[first];
+			pairs[i] = (uint64_t)cellOf[i] << 32 | i;
+		}
+	});
+
+	//Least significant digit radix sort by cell. Each worker histograms
+	//its block, a prefix sum over digits then workers gives every worker
+	//where its particles of each digit go, and it scatters them in order,
+	//which keeps the sort stable
+	int bits = 0;
+	while(bits < 32 && (cells.size() - 1) >> bits > 0) bits++;
+	histogram.resize(T*RADIX);
+	for(int shift=32; shift<32+bits; shift+=RADIX_BITS){
+		workers.run([&](size_t w){
+			size_t begin, end;
+			split(w, T, count, begin, end);
+			size_t* h = histogram.data() + w*RADIX;
+			fill(h, h + RADIX, 0);
+			for(size_t i=begin; i<end; i++){
+				h[(pairs[i] >> shift) & (RADIX - 1)]++;
+			}
+		});
+		size_t next = 0;
+		for(size_t d=0; d<RADIX; d++){
+			for(size_t w=0; w<T; w++){
+				size_t n = histogram[w*RADIX + d];
+				histogram[w*RADIX + d] = next;
+				next += n;
+			}
+		}
+		workers.run([&](size_t w){
+			size_t begin, end;
+			split(w, T, count, begin, end);
+			size_t* h = histogram.data() + w*RADIX;
+			for(size_t i=begin; i<end; i++){
+				sorted[h[(pairs[i] >> shift) & (RADIX - 1)]++] = pairs[i];
+			}
+		});
+		pairs.swap(sorted);
+	}
+
+	//A cell begins where its index first appears
+	workers.run([&](size_t w){
+		size_t begin, end;
+		split(w, T, count, begin, end);
+		for(size_t i=begin; i<end; i++){
+			uint32_t c = pairs[i] >> 32;
+			particles[i] = (uint32_t)pairs[i];
+			if(i == 0 || (uint32_t)(pairs[i-1] >> 32) != c) cells[c].begin = i;
+		}
+	});
+
+	table.resize(slots);
+	workers.run([&](size_t w){
+		size_t begin, end;
+		split(w, T, cells.size(), begin, end);
+		for(size_t c=begin; c<end; c++){
+			cells[c].count = (c+1 < cells.size() ? cells[c+1].begin : count) - cells[c].begin;
+		}
+
+		//The claimed slots become the table, lookups only need every cell
+		//reachable from its hash
+		split(w, T, slots, begin, end);
+		for(size_t s=begin; s<end; s++){
+			int first = claims[s].load(memory_order_relaxed);
+			table[s] = first < 0 ? -1 : cellOf[first];
+		}
+	});
+}
+
+template void CellMap::build<float>(const glm::tvec3<float>* positions, size_t count, int* cellOf, int* particles);
+template void CellMap::build<double>(const glm::tvec3<double>* positions, size_t count, int* cellOf, int* particles);
+template void CellMap::build<float>(const glm::tvec3<float>* positions, size_t count, int* cellOf, int* particles, WorkerGroup& workers);
+template void CellMap::build<double>(const glm::tvec3<double>* positions, size_t count, int* cellOf, int* particles, WorkerGroup& workers);
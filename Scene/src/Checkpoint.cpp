@@ -0,0 +1,297 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Simulation.h"
+#include "Checkpoint.h"
+
+using namespace Water;
+using namespace std;
+
+static_assert(sizeof(glm::vec3) == 3*sizeof(float), "checkpoint sections are stored as packed floats");
+static_assert(sizeof(glm::dvec3) == 3*sizeof(double), "checkpoint sections are stored as packed doubles");
+static_assert(sizeof(Triangle) == 9*sizeof(float), "checkpoint sections are stored as packed floats");
+
+static uint64_t aligned(uint64_t offset){
+	return (offset + CHECKPOINT_ALIGNMENT - 1) & ~(CHECKPOINT_ALIGNMENT - 1);
+}
+
+//Copies count scalars of size bytes from src into out, converting them if
+//the checkpoint was written in the other precision
+template<typename Scalar>
+static void readScalars(const char* src, uint32_t bytes, Scalar* out, size_t count){
+	if(bytes == sizeof(Scalar)){
+		memcpy(out, src, count*sizeof(Scalar));
+	}else if(bytes == sizeof(float)){
+		const float* in = (const float*)src;
+		for(size_t i=0; i<count; i++) out[i] = in[i];
+	}else{
+		const double* in = (const double*)src;
+		for(size_t i=0; i<count; i++) out[i] = in[i];
+	}
+}
+
+template<typename Scalar>
+void BasicSimulation<Scalar>::snapshot(vector<char>& out){
+	size_t count = N + ghosts;
+
+	CheckpointHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+	h.version = CHECKPOINT_VERSION;
+	h.byteOrder = CHECKPOINT_BYTE_ORDER;
+	h.v = v;
+	h.k = k;
+	h.g = g;
+	h.pm = pm;
+	h.p_0 = p_0;
+	h.d_0 = d_0;
+	h.dt = dt;
+	h.c_R = c_R;
+	h.effectiveRadius = effectiveRadius;
+	h.rngState = rngState;
+	for(int c=0; c<3; c++){
+		h.domainMin[c] = domainMin[c];
+		h.domainMax[c] = domainMax[c];
+	}
+	h.respawn = respawn;
+	h.boundaryParticles = useBoundary;
+	h.boundarySpacing = boundarySpacing;
+	h.boundaryStiffness = boundaryStiffness;
+	h.scalarBytes = sizeof(Scalar);
+	h.steps = statistics.steps;
+	h.particles = N;
+	h.ghosts = ghosts;
+	h.surfaces = surfaces.size();
+
+	h.surfacesOffset = aligned(sizeof(h));
+	h.densityOffset = aligned(h.surfacesOffset + surfaces.size()*sizeof(Triangle));
+	h.presureOffset = aligned(h.densityOffset + count*sizeof(Scalar));
+	h.positionsOffset = aligned(h.presureOffset + count*sizeof(Scalar));
+	h.velocitiesOffset = aligned(h.positionsOffset + count*sizeof(Vector));
+	h.fileBytes = h.velocitiesOffset + count*sizeof(Vector);
+
+	//Padding between sections stays zero so equal states give equal files
+	out.assign(h.fileBytes, 0);
+	char* base = out.data();
+	memcpy(base, &h, sizeof(h));
+	if(!surfaces.empty()) memcpy(base + h.surfacesOffset, surfaces.data(), surfaces.size()*sizeof(Triangle));
+	memcpy(base + h.densityOffset, density, count*sizeof(Scalar));
+	memcpy(base + h.presureOffset, presure, count*sizeof(Scalar));
+	memcpy(base + h.positionsOffset, x, count*sizeof(Vector));
+	memcpy(base + h.velocitiesOffset, dx, count*sizeof(Vector));
+}
+
+template<typename Scalar>
+bool BasicSimulation<Scalar>::save(const string& path){
+	vector<char> bytes;
+	snapshot(bytes);
+	return writeCheckpointFile(path, bytes);
+}
+
+template<typename Scalar>
+bool BasicSimulation<Scalar>::load(const string& path){
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0){
+		cerr << "Checkpoint: could not open " << path << endl;
+		return false;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CheckpointHeader)){
+		cerr << "Checkpoint: " << path << " is too short" << endl;
+		close(fd);
+		return false;
+	}
+
+	size_t length = st.st_size;
+	void* p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED){
+		cerr << "Checkpoint: could not map " << path << endl;
+		return false;
+	}
+	const char* base = (const char*)p;
+
+	CheckpointHeader h;
+	memcpy(&h, base, sizeof(h));
+
+	const char* error = NULL;
+	uint64_t count = h.particles + h.ghosts;
+	uint64_t scalar = h.scalarBytes;
+	if(memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) != 0) error = "is not a checkpoint";
+	else if(h.byteOrder != CHECKPOINT_BYTE_ORDER) error = "was written with a different byte order";
+	else if(h.version != CHECKPOINT_VERSION) error = "has an unsupported version";
+	else if(scalar != sizeof(float) && scalar != sizeof(double)) error = "has an unsupported precision";
+	else if(h.fileBytes != length) error = "is truncated";
+	else if(h.surfacesOffset + h.surfaces*sizeof(Triangle) > length
+			|| h.densityOffset + count*scalar > length
+			|| h.presureOffset + count*scalar > length
+			|| h.positionsOffset + 3*count*scalar > length
+			|| h.velocitiesOffset + 3*count*scalar > length) error = "has sections outside the file";
+	else if(count > capacity) error = "holds more particles than the simulation has room for";
+
+	if(error != NULL){
+		cerr << "Checkpoint: " << path << " " << error << endl;
+		munmap(p, length);
+		return false;
+	}
+
+	v = h.v;
+	k = h.k;
+	g = h.g;
+	pm = h.pm;
+	p_0 = h.p_0;
+	d_0 = h.d_0;
+	dt = h.dt;
+	c_R = h.c_R;
+	effectiveRadius = h.effectiveRadius;
+	checkGridHalfWidth = (int)ceil(effectiveRadius / gridRes);
+	rngState = h.rngState;
+	domainMin = Vector(h.domainMin[0], h.domainMin[1], h.domainMin[2]);
+	domainMax = Vector(h.domainMax[0], h.domainMax[1], h.domainMax[2]);
+	respawn = h.respawn != 0;
+	useBoundary = h.boundaryParticles != 0;
+	boundarySpacing = h.boundarySpacing;
+	boundaryStiffness = h.boundaryStiffness;
+	statistics.steps = h.steps;
+	version++;
+
+	N = h.particles;
+	ghosts = h.ghosts;
+	readScalars(base + h.densityOffset, h.scalarBytes, density, count);
+	readScalars(base + h.presureOffset, h.scalarBytes, presure, count);
+	readScalars(base + h.positionsOffset, h.scalarBytes, (Scalar*)x, 3*count);
+	readScalars(base + h.velocitiesOffset, h.scalarBytes, (Scalar*)dx, 3*count);
+
+	//The level of detail is not saved, the loaded particles start over at
+	//the finest level as after setLevelOfDetail
+	memset(lodLevel, 0, count);
+	memset(lodWaiting, 0, count);
+
+	const Triangle* tris = (const Triangle*)(base + h.surfacesOffset);
+	surfaces.assign(tris, tris + h.surfaces);
+
+	//Samples the loaded surfaces on the next step
+	boundarySurfaces = (size_t)-1;
+
+	munmap(p, length);
+	return true;
+}
+
+template void BasicSimulation<float>::snapshot(vector<char>& out);
+template void BasicSimulation<double>::snapshot(vector<char>& out);
+template bool BasicSimulation<float>::save(const string& path);
+template bool BasicSimulation<double>::save(const string& path);
+template bool BasicSimulation<float>::load(const string& path);
+template bool BasicSimulation<double>::load(const string& path);
+
+bool Water::writeCheckpointFile(const string& path, const vector<char>& bytes){
+	string temporary = path + ".tmp";
+	int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0){
+		cerr << "Checkpoint: could not create " << temporary << endl;
+		return false;
+	}
+
+	size_t done = 0;
+	while(done < bytes.size()){
+		ssize_t n = write(fd, bytes.data() + done, bytes.size() - done);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0){
+			cerr << "Checkpoint: could not write " << temporary << endl;
+			close(fd);
+			unlink(temporary.c_str());
+			return false;
+		}
+		done += n;
+	}
+
+	//The data has to be on disk before the rename makes it visible
+	if(fsync(fd) != 0 || close(fd) != 0 || rename(temporary.c_str(), path.c_str()) != 0){
+		cerr << "Checkpoint: could not write " << path << endl;
+		unlink(temporary.c_str());
+		return false;
+	}
+	return true;
+}
+
+CheckpointWriter::CheckpointWriter(){
+	busy = false;
+	stopping = false;
+	written = 0;
+	failed = 0;
+	writer = thread(&CheckpointWriter::work, this);
+}
+
+CheckpointWriter::~CheckpointWriter(){
+	{
+		unique_lock<mutex> l(lock);
+		stopping = true;
+	}
+	hasWork.notify_one();
+	writer.join();
+}
+
+template<typename Scalar>
+bool CheckpointWriter::submit(BasicSimulation<Scalar>& sim, const string& path){
+	{
+		unique_lock<mutex> l(lock);
+		if(busy) return false;
+
+		//The writer thread only touches pending while busy is set
+		sim.snapshot(pending);
+		pendingPath = path;
+		busy = true;
+	}
+	hasWork.notify_one();
+	return true;
+}
+
+template bool CheckpointWriter::submit<float>(BasicSimulation<float>& sim, const string& path);
+template bool CheckpointWriter::submit<double>(BasicSimulation<double>& sim, const string& path);
+
+void CheckpointWriter::wait(){
+	unique_lock<mutex> l(lock);
+	while(busy){
+		isIdle.wait(l);
+	}
+}
+
+uint64_t CheckpointWriter::getWritten(){
+	unique_lock<mutex> l(lock);
+	return written;
+}
+
+uint64_t CheckpointWriter::getFailed(){
+	unique_lock<mutex> l(lock);
+	return failed;
+}
+
+void CheckpointWriter::work(){
+	while(true){
+		string path;
+		{
+			unique_lock<mutex> l(lock);
+			while(!busy && !stopping){
+				hasWork.wait(l);
+			}
+			if(!busy) return;
+			path = pendingPath;
+		}
+
+		bool ok = writeCheckpointFile(path, pending);
+
+		{
+			unique_lock<mutex> l(lock);
+			if(ok) written++;
+			else failed++;
+			busy = false;
+		}
+		isIdle.notify_all();
+	}
+}
@@ -0,0 +1,330 @@
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include "CompactSimulation.h"
+#include "Kernels.h"
+#include "Collision.h"
+#include "Trace.h"
+
+using namespace Water;
+using namespace std;
+
+//Steps of the fixed point offsets within a cell
+static const GLfloat OFFSET_STEPS = 65536.0f;
+
+CompactSimulation::CompactSimulation(size_t particles, const SimulationParameters& params, bool hugePages)
+		: grid(params.effectiveRadius), nextGrid(params.effectiveRadius){
+	v = params.v;
+	k = params.k;
+	g = params.g;
+	pm = params.pm;
+	p_0 = params.p_0;
+	d_0 = params.d_0;
+	dt = params.dt;
+	c_R = params.c_R;
+	effectiveRadius = params.effectiveRadius;
+	respawn = params.respawn;
+	domainMin = params.domainMin;
+	domainMax = params.domainMax;
+
+	rngState = params.seed != 0 ? params.seed : 1;
+
+	N = 0;
+	capacity = max(particles, params.capacity);
+	windowBegin = 0;
+	windowPeak = 0;
+	sorted = true;
+
+	arena.reserve(2*Arena::bytesFor<uint16_t>(3*capacity)
+			+ Arena::bytesFor<GLfloat>(capacity)
+			+ Arena::bytesFor<int>(capacity), hugePages);
+
+	offsets = arena.allocate<uint16_t>(3*capacity);
+	velocities = arena.allocate<uint16_t>(3*capacity);
+	density = arena.allocate<GLfloat>(capacity);
+	cellOf = arena.allocate<int>(capacity);
+
+	//The lattice of Simulation, continued upwards instead of stacking the
+	//particles past the first 10000 at the origin
+	for(int m=0; N < particles; m++)
+	for(int l=0; l<10 && N < particles; l++)
+	for(int n=0; n<10 && N < particles; n++)
+		addParticle(glm::vec3(l*0.3 + 0.5, m*0.3 - 1.19, n*0.3 - 4.37), glm::vec3(0.0));
+}
+
+void CompactSimulation::step(){
+	statistics.steps++;
+	statistics.stepSeconds = 0.0;
+	for(int p=0; p<PHASE_COUNT; p++){
+		statistics.phaseSeconds[p] = 0.0;
+	}
+	statistics.neighborsVisited = 0;
+	statistics.kernelEvaluations = 0;
+	statistics.triangleTests = 0;
+	statistics.bounces = 0;
+	statistics.respawns = 0;
+
+	ScopedTimer stepTimer(statistics.stepSeconds);
+	TRACE_SCOPE("step");
+	if(!sorted){
+		ScopedTimer t(statistics.phaseSeconds[PHASE_HASH]);
+		TRACE_SCOPE("hash");
+		sortParticles(grid);
+	}
+
+	{
+		ScopedTimer t(statistics.phaseSeconds[PHASE_DENSITY]);
+		TRACE_SCOPE("density");
+		computeDensity();
+	}
+	{
+		ScopedTimer t(statistics.phaseSeconds[PHASE_FORCES]);
+		TRACE_SCOPE("forces");
+		computeForces();
+	}
+
+	//Respawning happens in the same pass and is timed with the collisions
+	{
+		ScopedTimer t(statistics.phaseSeconds[PHASE_COLLISION]);
+		TRACE_SCOPE("collision");
+		moveParticles();
+	}
+
+	//Sorting into the new cells ends the step so the particles are in
+	//order for getPosition and the next step
+	{
+		ScopedTimer t(statistics.phaseSeconds[PHASE_HASH]);
+		TRACE_SCOPE("hash");
+		sortParticles(nextGrid);
+	}
+}
+
+glm::vec3 CompactSimulation::position(size_t i, const CellMap::Cell& cell){
+	const uint16_t* o = offsets + 3*i;
+	GLfloat step = effectiveRadius / OFFSET_STEPS;
+	return glm::vec3(cell.x, cell.y, cell.z)*effectiveRadius
+		+ (glm::vec3(o[0], o[1], o[2]) + 0.5f)*step;
+}
+
+glm::vec3 CompactSimulation::velocity(size_t i){
+	const uint16_t* h = velocities + 3*i;
+	return glm::vec3(glm::unpackHalf1x16(h[0]), glm::unpackHalf1x16(h[1]), glm::unpackHalf1x16(h[2]));
+}
+
+void CompactSimulation::store(size_t i, glm::vec3 position, glm::vec3 velocity, CellMap& map){
+	int x, y, z;
+	map.coordinates(position, x, y, z);
+	cellOf[i] = map.insert(x, y, z);
+
+	glm::vec3 o = (position - glm::vec3(x, y, z)*effectiveRadius) * (OFFSET_STEPS / effectiveRadius);
+	for(int c=0; c<3; c++){
+		offsets[3*i + c] = (uint16_t)min(max(floor(o[c]), 0.0f), OFFSET_STEPS - 1.0f);
+		velocities[3*i + c] = glm::packHalf1x16(velocity[c]);
+	}
+}
+
+void CompactSimulation::gather(const CellMap::Cell& cell, bool withState){
+	near.clear();
+	for(int l=-1; l<=1; l++){
+		for(int m=-1; m<=1; m++){
+			for(int n=-1; n<=1; n++){
+				const CellMap::Cell* c = grid.find(cell.x + l, cell.y + m, cell.z + n);
+				if(c == NULL) continue;
+				for(size_t j=c->begin; j<c->begin + c->count; j++){
+					Neighbour nb;
+					nb.x = position(j, *c);
+					nb.index = j;
+					if(withState){
+						nb.v = velocity(j);
+						nb.density = density[j];
+						nb.presure = p_0 + k*(density[j] - d_0);
+					}
+					near.push_back(nb);
+				}
+			}
+		}
+	}
+}
+
+size_t CompactSimulation::computeDensity(){
+	size_t pairs = 0;
+	for(size_t c=0; c<grid.size(); c++){
+		const CellMap::Cell& home = grid.cell(c);
+		gather(home, false);
+		for(size_t i=home.begin; i<home.begin + home.count; i++){
+			glm::vec3 x = position(i, home);
+			GLfloat d = 0.0;
+			for(size_t j=0; j<near.size(); j++){
+				d += kernel(x - near[j].x, effectiveRadius);
+			}
+			density[i] = pm*d;
+			pairs += near.size();
+		}
+	}
+	SIM_COUNT(statistics.neighborsVisited, pairs);
+	SIM_COUNT(statistics.kernelEvaluations, pairs);
+	return pairs;
+}
+
+size_t CompactSimulation::computeForces(){
+	size_t pairs = 0;
+#if WATERSIM_STATS
+	uint64_t evaluations = 0;
+#endif
+	window.clear();
+	windowBegin = 0;
+	windowPeak = 0;
+
+	//Cells are sorted by x, so once a cell at x is reached nothing at x-2 or
+	//below is read again and those velocities can be overwritten
+	size_t done = 0;
+	for(size_t c=0; c<grid.size(); c++){
+		const CellMap::Cell& home = grid.cell(c);
+		while(done < c && grid.cell(done).x < home.x - 1) done++;
+		commitWindow(grid.cell(done).begin);
+
+		gather(home, true);
+		for(size_t i=home.begin; i<home.begin + home.count; i++){
+			glm::vec3 x = position(i, home);
+			glm::vec3 dx = velocity(i);
+			GLfloat presure = p_0 + k*(density[i] - d_0);
+
+			glm::vec3 f(0.0,0.0,0.0);
+			for(size_t j=0; j<near.size(); j++){
+				const Neighbour& nb = near[j];
+				if(nb.index == i) continue;
+				SIM_COUNT(evaluations, 2);
+				f += (presure + nb.presure) / (2.0f*nb.density) * presurekernel(x - nb.x, effectiveRadius);
+				f +=  - v * (dx - nb.v) / nb.density * viscositykernel(x - nb.x, effectiveRadius);
+			}
+			pairs += near.size();
+
+			glm::vec3 next = dx + dt*f;
+			next.y += dt*g;
+			window.push_back(next);
+		}
+		windowPeak = max(windowPeak, window.size());
+	}
+	commitWindow(N);
+	SIM_COUNT(statistics.neighborsVisited, pairs);
+	SIM_COUNT(statistics.kernelEvaluations, evaluations);
+	return pairs;
+}
+
+void CompactSimulation::commitWindow(size_t end){
+	for(; windowBegin < end; windowBegin++){
+		glm::vec3 next = window.front();
+		window.pop_front();
+		for(int c=0; c<3; c++){
+			velocities[3*windowBegin + c] = glm::packHalf1x16(next[c]);
+		}
+	}
+}
+
+void CompactSimulation::moveParticles(){
+	nextGrid.clear();
+	for(size_t c=0; c<grid.size(); c++){
+		const CellMap::Cell& home = grid.cell(c);
+		for(size_t i=home.begin; i<home.begin + home.count; i++){
+			glm::vec3 x = position(i, home);
+			glm::vec3 dx = velocity(i);
+
+			glm::vec3 d = dt*dx;
+			while(collideAndMove(x, dx, d, surfaces, c_R, statistics)) {}
+			x += d;
+
+			if(respawn && (glm::any(glm::lessThan(x, domainMin)) || glm::any(glm::greaterThan(x, domainMax)))){
+				x = glm::vec3(1.60767 + 2.0*random() - 1.0,-0.9 + random()*0.2,-7.0 + 2.0*random() - 1.0);
+				dx = glm::vec3(0.0, 0.0, 1.7);
+				SIM_COUNT(statistics.respawns, 1);
+			}
+
+			store(i, x, dx, nextGrid);
+		}
+	}
+}
+
+void CompactSimulation::sortParticles(CellMap& map){
+	map.sort(remap);
+	for(size_t c=0; c<map.size(); c++){
+		map.cell(c).count = 0;
+	}
+	for(size_t i=0; i<N; i++){
+		cellOf[i] = remap[cellOf[i]];
+		map.cell(cellOf[i]).count++;
+	}
+
+	unsigned int begin = 0;
+	for(size_t c=0; c<map.size(); c++){
+		CellMap::Cell& cell = map.cell(c);
+		cell.begin = begin;
+		begin += cell.count;
+		cell.count = 0;
+	}
+
+	//Destination of every particle, then apply the permutation in place by
+	//following its cycles. Densities are recomputed so they are not moved
+	for(size_t i=0; i<N; i++){
+		CellMap::Cell& cell = map.cell(cellOf[i]);
+		cellOf[i] = cell.begin + cell.count++;
+	}
+	for(size_t i=0; i<N; i++){
+		while((size_t)cellOf[i] != i){
+			int to = cellOf[i];
+			for(int c=0; c<3; c++){
+				swap(offsets[3*i + c], offsets[3*to + c]);
+				swap(velocities[3*i + c], velocities[3*to + c]);
+			}
+			swap(cellOf[i], cellOf[to]);
+		}
+	}
+
+	for(size_t c=0; c<map.size(); c++){
+		const CellMap::Cell& cell = map.cell(c);
+		for(size_t i=cell.begin; i<cell.begin + cell.count; i++){
+			cellOf[i] = c;
+		}
+	}
+
+	if(&map != &grid) swap(grid, map);
+	sorted = true;
+}
+
+//Uniform in [0,1), the same generator as Simulation
+GLfloat CompactSimulation::random(){
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return (rngState % 100000) / 100000.0;
+}
+
+bool CompactSimulation::addParticle(glm::vec3 position, glm::vec3 velocity){
+	if(N >= capacity) return false;
+
+	//New cells are appended to grid out of order, the next step sorts them
+	store(N, position, velocity, grid);
+	N++;
+	sorted = false;
+	return true;
+}
+
+glm::vec3 CompactSimulation::getPosition(size_t index){
+	return position(index, grid.cell(cellOf[index]));
+}
+
+glm::vec3 CompactSimulation::getVelocity(size_t index){
+	return velocity(index);
+}
+
+size_t CompactSimulation::memoryBytes(){
+	return arena.capacity() + grid.memoryBytes() + nextGrid.memoryBytes()
+		+ remap.capacity()*sizeof(int)
+		+ windowPeak*sizeof(glm::vec3)
+		+ near.capacity()*sizeof(Neighbour);
+}
+
+void CompactSimulation::addPlane(glm::mat4 modelMatrix){
+	Water::addPlane(surfaces, modelMatrix);
+}
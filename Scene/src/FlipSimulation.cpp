@@ -0,0 +1,762 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <glm/glm.hpp>
+
+#include "FlipSimulation.h"
+#include "Collision.h"
+#include "Trace.h"
+
+using namespace Water;
+using namespace std;
+
+//Cells along every side of a tile on each multigrid level, and where the
+//level starts in the arrays of a tile
+static const int LEVEL_SIDE[4] = {8, 4, 2, 1};
+static const int LEVEL_OFFSET[4] = {0, 512, 576, 584};
+
+//Neighbours in the order of Tile::neighbours
+static const int STEP[6][3] = {{-1,0,0}, {1,0,0}, {0,-1,0}, {0,1,0}, {0,0,-1}, {0,0,1}};
+
+//Where the faces along each axis are within their cell, in cells
+static const glm::vec3 FACE_OFFSET[3] = {glm::vec3(0.0, 0.5, 0.5), glm::vec3(0.5, 0.0, 0.5), glm::vec3(0.5, 0.5, 0.0)};
+
+//Weight of the damped Jacobi smoother
+static const GLfloat JACOBI_WEIGHT = 2.0/3.0;
+
+//Below this much work in a pass waiting for the workers costs more than
+//they save
+static const size_t PARALLEL_CELLS = 8192;
+static const size_t PARALLEL_PARTICLES = 4096;
+
+//Rounds a / b towards minus infinity, b > 0
+static int floorDiv(int a, int b){
+	return a >= 0 ? a / b : -((b - 1 - a) / b);
+}
+
+FlipSimulation::FlipSimulation(size_t particles, const SimulationParameters& params, const FlipParameters& flipParams)
+		: flip(flipParams), tileMap(TILE*flipParams.cellSize), groups(TILE*flipParams.cellSize){
+	g = params.g;
+	dt = params.dt;
+	c_R = params.c_R;
+	cellSize = flip.cellSize;
+	inverseCell = 1.0f / cellSize;
+	respawn = params.respawn;
+	domainMin = params.domainMin;
+	domainMax = params.domainMax;
+
+	rngState = params.seed != 0 ? params.seed : 1;
+
+	N = 0;
+	version = 0;
+	voxelised = 0;
+	fluidCells = 0;
+	iterations = 0;
+	capacity = max(particles, params.capacity);
+	x.resize(capacity);
+	v.resize(capacity);
+	affine.resize(3*capacity);
+	groupOf.resize(capacity);
+	grouped.resize(capacity);
+
+	if(params.threads > 1) workers.reset(new WorkerGroup(params.threads));
+
+	//The lattice of Simulation, continued upwards instead of stacking the
+	//particles past the first 10000 at the origin
+	for(int m=0; N < particles; m++)
+	for(int l=0; l<10 && N < particles; l++)
+	for(int n=0; n<10 && N < particles; n++)
+		addParticle(glm::vec3(l*0.3 + 0.5, m*0.3 - 1.19, n*0.3 - 4.37), glm::vec3(0.0));
+}
+
+template<typename Function>
+void FlipSimulation::forTiles(size_t cellsPerTile, Function f){
+	size_t count = active.size();
+	if(!workers || count*cellsPerTile < PARALLEL_CELLS){
+		f(0, count);
+		return;
+	}
+	size_t T = workers->size();
+	workers->run([&](size_t w){
+		f(count*w / T, count*(w+1) / T);
+	});
+}
+
+template<typename Function>
+void FlipSimulation::forRange(size_t count, size_t work, Function f){
+	if(!workers || work < PARALLEL_PARTICLES){
+		f(0, count, statistics);
+		return;
+	}
+	size_t T = workers->size();
+	vector<SimulationStats> counted(T);
+	workers->run([&](size_t w){
+		f(count*w / T, count*(w+1) / T, counted[w]);
+	});
+	for(size_t w=0; w<T; w++){
+		statistics.triangleTests += counted[w].triangleTests;
+		statistics.bounces += counted[w].bounces;
+	}
+}
+
+void FlipSimulation::step(){
+	statistics.steps++;
+	version++;
+	statistics.stepSeconds = 0.0;
+	for(int p=0; p<PHASE_COUNT; p++){
+		statistics.phaseSeconds[p] = 0.0;
+	}
+	statistics.neighborsVisited = 0;
+	statistics.kernelEvaluations = 0;
+	statistics.triangleTests = 0;
+	statistics.bounces = 0;
+	statistics.respawns = 0;
+	statistics.activeParticles = N;
+
+	ScopedTimer stepTimer(statistics.stepSeconds);
+	TRACE_SCOPE("step");
+	{
+		ScopedTimer t(statistics.phaseSeconds[PHASE_HASH]);
+		TRACE_SCOPE("hash");
+		findTiles();
+	}
+	{
+		ScopedTimer t(statistics.phaseSeconds[PHASE_DENSITY]);
+		TRACE_SCOPE("density");
+		transferToGrid();
+	}
+	{
+		ScopedTimer t(statistics.phaseSeconds[PHASE_FORCES]);
+		TRACE_SCOPE("forces");
+		project();
+		forRange(N, N, [this](size_t begin, size_t end, SimulationStats&){
+			transferToParticles(begin, end);
+		});
+	}
+	{
+		ScopedTimer t(statistics.phaseSeconds[PHASE_COLLISION]);
+		TRACE_SCOPE("collision");
+		forRange(N, N, [this](size_t begin, size_t end, SimulationStats& counters){
+			moveParticles(begin, end, counters);
+		});
+	}
+	{
+		ScopedTimer t(statistics.phaseSeconds[PHASE_RESPAWN]);
+		TRACE_SCOPE("respawn");
+		respawnParticles();
+	}
+}
+
+int FlipSimulation::useTile(int tx, int ty, int tz){
+	int t = tileMap.insert(tx, ty, tz);
+	if(t == (int)tiles.size()){
+		tiles.emplace_back();
+		records.emplace_back();
+	}
+	if(!tiles[t]){
+		tiles[t].reset(new Tile);
+		Tile& tile = *tiles[t];
+		tile.x = tx;
+		tile.y = ty;
+		tile.z = tz;
+		tile.active = false;
+
+		//Faces kept when the tile was evicted are still right unless the
+		//surfaces changed since
+		TileRecord& record = records[t];
+		if(!record.kept) voxelise(tile);
+		else if(record.blocked.empty()) memset(tile.blocked, 0, sizeof(tile.blocked));
+		else memcpy(tile.blocked, record.blocked.data(), sizeof(tile.blocked));
+		record.kept = false;
+		vector<uint8_t>().swap(record.blocked);
+		resident.push_back(t);
+	}
+	records[t].lastUsed = statistics.steps;
+	if(!tiles[t]->active){
+		tiles[t]->active = true;
+		active.push_back(t);
+	}
+	return t;
+}
+
+//Gives the grid of tiles unused for flip.evictSteps back, keeping their
+//blocked faces only if a surface crosses them
+void FlipSimulation::evictTiles(){
+	size_t kept = 0;
+	for(size_t r=0; r<resident.size(); r++){
+		int t = resident[r];
+		if(statistics.steps - records[t].lastUsed < (uint64_t)flip.evictSteps){
+			resident[kept++] = t;
+			continue;
+		}
+		const Tile& tile = *tiles[t];
+		TileRecord& record = records[t];
+		record.kept = true;
+		for(int n=0; n<CELLS; n++){
+			if(!tile.blocked[n]) continue;
+			record.blocked.assign(tile.blocked, tile.blocked + CELLS);
+			break;
+		}
+		tiles[t].reset();
+	}
+	resident.resize(kept);
+}
+
+bool FlipSimulation::locate(int hint, int i, int j, int k, int& t, int& n){
+	int tx = floorDiv(i, TILE);
+	int ty = floorDiv(j, TILE);
+	int tz = floorDiv(k, TILE);
+	t = hint;
+	if(tiles[t]->x != tx || tiles[t]->y != ty || tiles[t]->z != tz){
+		const CellMap::Cell* cell = tileMap.find(tx, ty, tz);
+		if(!cell) return false;
+		t = (int)(cell - &tileMap.cell(0));
+		if(!tiles[t] || !tiles[t]->active) return false;
+	}
+	n = (i - tx*TILE) + TILE*((j - ty*TILE) + TILE*(k - tz*TILE));
+	return true;
+}
+
+bool FlipSimulation::adjacent(int t, int l, int i, int j, int k, int d, int& nt, int& n){
+	int side = LEVEL_SIDE[l];
+	int c[3] = {i + STEP[d][0], j + STEP[d][1], k + STEP[d][2]};
+	int a = d/2;
+	nt = t;
+	if(c[a] < 0 || c[a] >= side){
+		nt = tiles[t]->neighbours[d];
+		if(nt < 0) return false;
+		c[a] = c[a] < 0 ? side - 1 : 0;
+	}
+	n = LEVEL_OFFSET[l] + c[0] + side*(c[1] + side*c[2]);
+	return true;
+}
+
+//A face is blocked if the segment between the centers of its two cells
+//crosses a surface. Thin surfaces like the planes of the waterfall block
+//the faces across them without filling any cell
+void FlipSimulation::voxelise(Tile& tile){
+	memset(tile.blocked, 0, sizeof(tile.blocked));
+	glm::vec3 corner = glm::vec3(tile.x, tile.y, tile.z)*(GLfloat)(TILE*cellSize);
+	glm::vec3 low = corner - cellSize;
+	glm::vec3 high = corner + (GLfloat)TILE*cellSize;
+	SimulationStats counters;
+	for(size_t s=0; s<surfaces.size(); s++){
+		const Triangle& tri = surfaces[s];
+		glm::vec3 lo = glm::min(tri.a, glm::min(tri.b, tri.c));
+		glm::vec3 hi = glm::max(tri.a, glm::max(tri.b, tri.c));
+		if(glm::any(glm::lessThan(hi, low)) || glm::any(glm::greaterThan(lo, high))) continue;
+
+		for(int k=0; k<TILE; k++)
+		for(int j=0; j<TILE; j++)
+		for(int i=0; i<TILE; i++){
+			int n = i + TILE*(j + TILE*k);
+			glm::vec3 center = corner + glm::vec3(i + 0.5, j + 0.5, k + 0.5)*cellSize;
+			for(int a=0; a<3; a++){
+				if(tile.blocked[n] & (1 << a)) continue;
+				glm::vec3 step(0.0);
+				step[a] = cellSize;
+				if(findCollision(center - step, tri, step) >= 0.0f) tile.blocked[n] |= 1 << a;
+			}
+		}
+	}
+}
+
+void FlipSimulation::findTiles(){
+	for(size_t a=0; a<active.size(); a++){
+		tiles[active[a]]->active = false;
+	}
+	active.clear();
+
+	//Surfaces were added since the tiles were voxelised. Evicted tiles
+	//forget their faces and are voxelised when they are used again
+	if(voxelised != surfaces.size()){
+		for(size_t t=0; t<tiles.size(); t++){
+			if(tiles[t]) voxelise(*tiles[t]);
+			records[t].kept = false;
+			vector<uint8_t>().swap(records[t].blocked);
+		}
+		voxelised = surfaces.size();
+	}
+
+	if(workers && N >= PARALLEL_PARTICLES) groups.build(x.data(), N, groupOf.data(), grouped.data(), *workers);
+	else groups.build(x.data(), N, groupOf.data(), grouped.data());
+
+	//Particles in the outer cells of a tile splat onto faces of the tiles
+	//next to it, which have to be in use too
+	groupTile.resize(groups.size());
+	for(int p=0; p<8; p++){
+		passes[p].clear();
+	}
+	for(size_t c=0; c<groups.size(); c++){
+		const CellMap::Cell& cell = groups.cell(c);
+		int corner[3] = {cell.x*TILE, cell.y*TILE, cell.z*TILE};
+		int low[3] = {0, 0, 0};
+		int high[3] = {0, 0, 0};
+		for(unsigned int p=cell.begin; p<cell.begin + cell.count; p++){
+			glm::vec3 s = x[grouped[p]]*inverseCell;
+			for(int a=0; a<3; a++){
+				int local = (int)floor(s[a]) - corner[a];
+				if(local <= 0) low[a] = -1;
+				if(local >= TILE - 1) high[a] = 1;
+			}
+		}
+		for(int k=low[2]; k<=high[2]; k++)
+		for(int j=low[1]; j<=high[1]; j++)
+		for(int i=low[0]; i<=high[0]; i++){
+			useTile(cell.x + i, cell.y + j, cell.z + k);
+		}
+		groupTile[c] = useTile(cell.x, cell.y, cell.z);
+		passes[(cell.x & 1) | (cell.y & 1) << 1 | (cell.z & 1) << 2].push_back(c);
+	}
+	evictTiles();
+
+	tileSums.resize(active.size());
+	forTiles(CELLS, [this](size_t begin, size_t end){
+		for(size_t a=begin; a<end; a++){
+			Tile& tile = *tiles[active[a]];
+			for(int d=0; d<6; d++){
+				const CellMap::Cell* cell = tileMap.find(tile.x + STEP[d][0], tile.y + STEP[d][1], tile.z + STEP[d][2]);
+				int n = cell ? (int)(cell - &tileMap.cell(0)) : -1;
+				tile.neighbours[d] = n >= 0 && tiles[n] && tiles[n]->active ? n : -1;
+			}
+			memset(tile.velocity, 0, sizeof(tile.velocity));
+			memset(tile.weight, 0, sizeof(tile.weight));
+			memset(tile.type, CELL_AIR, sizeof(tile.type));
+			memset(tile.vectors, 0, sizeof(tile.vectors));
+		}
+	});
+}
+
+//The particles of tiles with the same parity of each coordinate splat
+//together. Their writes reach at most one cell into the next tile, so
+//they never meet
+void FlipSimulation::transferToGrid(){
+	for(int p=0; p<8; p++){
+		const vector<int>& pass = passes[p];
+		auto work = [&](size_t begin, size_t end){
+			for(size_t c=begin; c<end; c++){
+				const CellMap::Cell& cell = groups.cell(pass[c]);
+				int t = groupTile[pass[c]];
+				for(unsigned int q=cell.begin; q<cell.begin + cell.count; q++){
+					splat(grouped[q], t);
+				}
+			}
+		};
+		if(!workers || N < PARALLEL_PARTICLES){
+			work(0, pass.size());
+		}else{
+			size_t T = workers->size();
+			workers->run([&](size_t w){
+				work(pass.size()*w / T, pass.size()*(w+1) / T);
+			});
+		}
+	}
+
+	//Velocities before the grid changes them are kept for FLIP. Gravity
+	//only acts on faces with water around them
+	forTiles(CELLS, [this](size_t begin, size_t end){
+		for(size_t a=begin; a<end; a++){
+			Tile& tile = *tiles[active[a]];
+			for(int c=0; c<3; c++)
+			for(int n=0; n<CELLS; n++){
+				GLfloat w = tile.weight[c][n];
+				GLfloat u = w > 0.0f ? tile.velocity[c][n] / w : 0.0f;
+				tile.before[c][n] = u;
+				if(c == 1 && w > 0.0f) u += dt*g;
+				if(tile.blocked[n] & (1 << c)) u = 0.0f;
+				tile.velocity[c][n] = u;
+			}
+		}
+	});
+}
+
+void FlipSimulation::splat(size_t i, int t){
+	glm::vec3 s = x[i]*inverseCell;
+	int c, n;
+	if(locate(t, (int)floor(s.x), (int)floor(s.y), (int)floor(s.z), c, n)) tiles[c]->type[n] = CELL_FLUID;
+
+	for(int a=0; a<3; a++){
+		glm::vec3 f = s - FACE_OFFSET[a];
+		glm::ivec3 base(glm::floor(f));
+		f -= glm::vec3(base);
+		for(int corner=0; corner<8; corner++){
+			glm::ivec3 o(corner & 1, (corner >> 1) & 1, corner >> 2);
+			glm::ivec3 node = base + o;
+			if(!locate(t, node.x, node.y, node.z, c, n)) continue;
+
+			GLfloat w = (o.x ? f.x : 1.0f - f.x)*(o.y ? f.y : 1.0f - f.y)*(o.z ? f.z : 1.0f - f.z);
+			GLfloat u = v[i][a];
+			if(flip.apic) u += glm::dot(affine[3*i + a], (glm::vec3(node) + FACE_OFFSET[a])*cellSize - x[i]);
+			tiles[c]->velocity[a][n] += w*u;
+			tiles[c]->weight[a][n] += w;
+		}
+	}
+}
+
+//Finds the open faces of the water cells, their divergence and which cells
+//of the coarser levels are water: those whose 8 cells all are
+void FlipSimulation::prepareLevels(){
+	forTiles(CELLS, [this](size_t begin, size_t end){
+		for(size_t a=begin; a<end; a++){
+			int t = active[a];
+			Tile& tile = *tiles[t];
+			size_t fluid = 0;
+			for(int k=0; k<TILE; k++)
+			for(int j=0; j<TILE; j++)
+			for(int i=0; i<TILE; i++){
+				int n = i + TILE*(j + TILE*k);
+				if(tile.type[n] != CELL_FLUID) continue;
+
+				GLfloat divergence = 0.0f;
+				int open = 0;
+				for(int c=0; c<3; c++){
+					int nt, m;
+					bool next = adjacent(t, 0, i, j, k, 2*c + 1, nt, m);
+					if(!(tile.blocked[n] & (1 << c))) open++;
+					if(!next || !(tiles[nt]->blocked[m] & (1 << c))) open++;
+					divergence += (next ? tiles[nt]->velocity[c][m] : 0.0f) - tile.velocity[c][n];
+				}
+
+				//Water walled in on every side has no pressure to solve for
+				tile.open[n] = open;
+				if(open == 0){
+					tile.type[n] = CELL_AIR;
+					continue;
+				}
+				tile.vectors[RESIDUAL][n] = -cellSize*divergence;
+				fluid++;
+			}
+
+			for(int l=1; l<LEVELS; l++){
+				int side = LEVEL_SIDE[l];
+				for(int k=0; k<side; k++)
+				for(int j=0; j<side; j++)
+				for(int i=0; i<side; i++){
+					bool fluid = true;
+					for(int c=0; c<8 && fluid; c++){
+						int child = LEVEL_OFFSET[l-1] + (2*i + (c & 1)) + 2*side*((2*j + ((c >> 1) & 1)) + 2*side*(2*k + (c >> 2)));
+						fluid = tile.type[child] == CELL_FLUID;
+					}
+					tile.type[LEVEL_OFFSET[l] + i + side*(j + side*k)] = fluid ? CELL_FLUID : CELL_AIR;
+				}
+			}
+			tileSums[a] = fluid;
+		}
+	});
+
+	fluidCells = 0;
+	for(size_t a=0; a<active.size(); a++){
+		fluidCells += (size_t)tileSums[a];
+	}
+}
+
+double FlipSimulation::dot(int first, int second){
+	forTiles(CELLS, [this, first, second](size_t begin, size_t end){
+		for(size_t a=begin; a<end; a++){
+			Tile& tile = *tiles[active[a]];
+			double sum = 0.0;
+			for(int n=0; n<CELLS; n++){
+				sum += (double)tile.vectors[first][n]*tile.vectors[second][n];
+			}
+			tileSums[a] = sum;
+		}
+	});
+	double sum = 0.0;
+	for(size_t a=0; a<active.size(); a++){
+		sum += tileSums[a];
+	}
+	return sum;
+}
+
+double FlipSimulation::largest(int vector){
+	forTiles(CELLS, [this, vector](size_t begin, size_t end){
+		for(size_t a=begin; a<end; a++){
+			Tile& tile = *tiles[active[a]];
+			GLfloat most = 0.0f;
+			for(int n=0; n<CELLS; n++){
+				most = max(most, fabs(tile.vectors[vector][n]));
+			}
+			tileSums[a] = most;
+		}
+	});
+	double most = 0.0;
+	for(size_t a=0; a<active.size(); a++){
+		most = max(most, tileSums[a]);
+	}
+	return most;
+}
+
+//On the finest level the matrix is the Laplacian over the open faces, on
+//the coarser ones over all faces. Air is zero and only adds to the
+//diagonal. Cells which are not water get zero
+void FlipSimulation::applyMatrix(int l, int in, int out, int rhs){
+	int side = LEVEL_SIDE[l];
+	forTiles(side*side*side, [this, l, in, out, rhs, side](size_t begin, size_t end){
+		for(size_t a=begin; a<end; a++){
+			int t = active[a];
+			Tile& tile = *tiles[t];
+			for(int k=0; k<side; k++)
+			for(int j=0; j<side; j++)
+			for(int i=0; i<side; i++){
+				int n = LEVEL_OFFSET[l] + i + side*(j + side*k);
+				if(tile.type[n] != CELL_FLUID){
+					tile.vectors[out][n] = 0.0f;
+					continue;
+				}
+
+				GLfloat sum = 0.0f;
+				for(int d=0; d<6; d++){
+					int nt, m;
+					if(!adjacent(t, l, i, j, k, d, nt, m) || tiles[nt]->type[m] != CELL_FLUID) continue;
+					if(l == 0 && ((d & 1) ? tiles[nt]->blocked[m] : tile.blocked[n]) & (1 << d/2)) continue;
+					sum += tiles[nt]->vectors[in][m];
+				}
+				GLfloat diagonal = l == 0 ? tile.open[n] : 6.0f;
+				GLfloat product = diagonal*tile.vectors[in][n] - sum;
+				tile.vectors[out][n] = rhs >= 0 ? tile.vectors[rhs][n] - product : product;
+			}
+		}
+	});
+}
+
+void FlipSimulation::smooth(int l, int sweeps){
+	int side = LEVEL_SIDE[l];
+	for(int s=0; s<sweeps; s++){
+		applyMatrix(l, LEVEL_X, LEVEL_R, LEVEL_B);
+		forTiles(side*side*side, [this, l, side](size_t begin, size_t end){
+			for(size_t a=begin; a<end; a++){
+				Tile& tile = *tiles[active[a]];
+				for(int n=LEVEL_OFFSET[l]; n<LEVEL_OFFSET[l] + side*side*side; n++){
+					if(tile.type[n] != CELL_FLUID) continue;
+					GLfloat diagonal = l == 0 ? tile.open[n] : 6.0f;
+					tile.vectors[LEVEL_X][n] += JACOBI_WEIGHT*tile.vectors[LEVEL_R][n] / diagonal;
+				}
+			}
+		});
+	}
+}
+
+//Puts a V-cycle applied to RESIDUAL into LEVEL_X of the finest level. The
+//residual is restricted as half the sum over the 8 cells, which makes
+//restriction the transpose of prolongation and, with as many sweeps on the
+//way down as up, the cycle symmetric as conjugate gradients needs
+void FlipSimulation::precondition(){
+	forTiles(CELLS, [this](size_t begin, size_t end){
+		for(size_t a=begin; a<end; a++){
+			Tile& tile = *tiles[active[a]];
+			memcpy(tile.vectors[LEVEL_B], tile.vectors[RESIDUAL], CELLS*sizeof(GLfloat));
+			memset(tile.vectors[LEVEL_X], 0, CELLS*sizeof(GLfloat));
+		}
+	});
+
+	for(int l=0; l<LEVELS-1; l++){
+		smooth(l, flip.smoothing);
+		applyMatrix(l, LEVEL_X, LEVEL_R, LEVEL_B);
+
+		int side = LEVEL_SIDE[l+1];
+		forTiles(side*side*side, [this, l, side](size_t begin, size_t end){
+			for(size_t a=begin; a<end; a++){
+				Tile& tile = *tiles[active[a]];
+				for(int k=0; k<side; k++)
+				for(int j=0; j<side; j++)
+				for(int i=0; i<side; i++){
+					int n = LEVEL_OFFSET[l+1] + i + side*(j + side*k);
+					GLfloat sum = 0.0f;
+					if(tile.type[n] == CELL_FLUID){
+						for(int c=0; c<8; c++){
+							sum += tile.vectors[LEVEL_R][LEVEL_OFFSET[l] + (2*i + (c & 1)) + 2*side*((2*j + ((c >> 1) & 1)) + 2*side*(2*k + (c >> 2)))];
+						}
+					}
+					tile.vectors[LEVEL_B][n] = 0.5f*sum;
+					tile.vectors[LEVEL_X][n] = 0.0f;
+				}
+			}
+		});
+	}
+
+	smooth(LEVELS-1, flip.bottomSmoothing);
+
+	for(int l=LEVELS-2; l>=0; l--){
+		int side = LEVEL_SIDE[l];
+		forTiles(side*side*side, [this, l, side](size_t begin, size_t end){
+			for(size_t a=begin; a<end; a++){
+				Tile& tile = *tiles[active[a]];
+				for(int k=0; k<side; k++)
+				for(int j=0; j<side; j++)
+				for(int i=0; i<side; i++){
+					int n = LEVEL_OFFSET[l] + i + side*(j + side*k);
+					if(tile.type[n] != CELL_FLUID) continue;
+					tile.vectors[LEVEL_X][n] += tile.vectors[LEVEL_X][LEVEL_OFFSET[l+1] + i/2 + side/2*(j/2 + side/2*(k/2))];
+				}
+			}
+		});
+		smooth(l, flip.smoothing);
+	}
+}
+
+//Solves for the pressure which makes the flow out of every water cell
+//zero, in units which subtract its difference over a face from the
+//velocity there directly
+void FlipSimulation::project(){
+	prepareLevels();
+
+	iterations = 0;
+	double target = flip.tolerance*largest(RESIDUAL);
+	if(target > 0.0){
+		precondition();
+		forTiles(CELLS, [this](size_t begin, size_t end){
+			for(size_t a=begin; a<end; a++){
+				Tile& tile = *tiles[active[a]];
+				memcpy(tile.vectors[DIRECTION], tile.vectors[LEVEL_X], CELLS*sizeof(GLfloat));
+			}
+		});
+		double rho = dot(RESIDUAL, LEVEL_X);
+
+		while(iterations < flip.maxIterations && rho > 0.0){
+			applyMatrix(0, DIRECTION, PRODUCT, -1);
+			double curvature = dot(DIRECTION, PRODUCT);
+			if(curvature <= 0.0) break;
+			GLfloat alpha = rho / curvature;
+			forTiles(CELLS, [this, alpha](size_t begin, size_t end){
+				for(size_t a=begin; a<end; a++){
+					Tile& tile = *tiles[active[a]];
+					for(int n=0; n<CELLS; n++){
+						tile.vectors[PRESSURE][n] += alpha*tile.vectors[DIRECTION][n];
+						tile.vectors[RESIDUAL][n] -= alpha*tile.vectors[PRODUCT][n];
+					}
+				}
+			});
+			iterations++;
+			if(largest(RESIDUAL) <= target) break;
+
+			precondition();
+			double next = dot(RESIDUAL, LEVEL_X);
+			GLfloat beta = next / rho;
+			rho = next;
+			forTiles(CELLS, [this, beta](size_t begin, size_t end){
+				for(size_t a=begin; a<end; a++){
+					Tile& tile = *tiles[active[a]];
+					for(int n=0; n<CELLS; n++){
+						tile.vectors[DIRECTION][n] = tile.vectors[LEVEL_X][n] + beta*tile.vectors[DIRECTION][n];
+					}
+				}
+			});
+		}
+	}
+
+	//Every open face next to water loses the pressure difference across it
+	forTiles(CELLS, [this](size_t begin, size_t end){
+		for(size_t a=begin; a<end; a++){
+			int t = active[a];
+			Tile& tile = *tiles[t];
+			for(int k=0; k<TILE; k++)
+			for(int j=0; j<TILE; j++)
+			for(int i=0; i<TILE; i++){
+				int n = i + TILE*(j + TILE*k);
+				bool water = tile.type[n] == CELL_FLUID;
+				GLfloat p = water ? tile.vectors[PRESSURE][n] : 0.0f;
+				for(int c=0; c<3; c++){
+					if(tile.blocked[n] & (1 << c)) continue;
+					int nt, m;
+					bool other = adjacent(t, 0, i, j, k, 2*c, nt, m) && tiles[nt]->type[m] == CELL_FLUID;
+					if(!water && !other) continue;
+					GLfloat q = other ? tiles[nt]->vectors[PRESSURE][m] : 0.0f;
+					tile.velocity[c][n] -= (p - q)*inverseCell;
+				}
+			}
+		}
+	});
+}
+
+void FlipSimulation::transferToParticles(size_t begin, size_t end){
+	for(size_t i=begin; i<end; i++){
+		glm::vec3 s = x[i]*inverseCell;
+		int t = groupTile[groupOf[i]];
+		glm::vec3 grid = v[i];
+		glm::vec3 change(0.0);
+		for(int a=0; a<3; a++){
+			glm::vec3 f = s - FACE_OFFSET[a];
+			glm::ivec3 base(glm::floor(f));
+			f -= glm::vec3(base);
+
+			GLfloat sum = 0.0f;
+			GLfloat delta = 0.0f;
+			GLfloat total = 0.0f;
+			glm::vec3 gradient(0.0);
+			for(int corner=0; corner<8; corner++){
+				glm::ivec3 o(corner & 1, (corner >> 1) & 1, corner >> 2);
+				glm::ivec3 node = base + o;
+				int c, n;
+				if(!locate(t, node.x, node.y, node.z, c, n) || tiles[c]->weight[a][n] <= 0.0f) continue;
+
+				GLfloat wx = o.x ? f.x : 1.0f - f.x;
+				GLfloat wy = o.y ? f.y : 1.0f - f.y;
+				GLfloat wz = o.z ? f.z : 1.0f - f.z;
+				GLfloat w = wx*wy*wz;
+				GLfloat u = tiles[c]->velocity[a][n];
+				sum += w*u;
+				delta += w*(u - tiles[c]->before[a][n]);
+				total += w;
+				gradient += glm::vec3((o.x ? 1.0f : -1.0f)*wy*wz, wx*(o.y ? 1.0f : -1.0f)*wz, wx*wy*(o.z ? 1.0f : -1.0f))*(u*inverseCell);
+			}
+			if(total > 0.0f){
+				grid[a] = sum / total;
+				change[a] = delta / total;
+			}
+			affine[3*i + a] = flip.apic ? gradient : glm::vec3(0.0);
+		}
+
+		if(flip.apic) v[i] = grid;
+		else v[i] = flip.flipRatio*(v[i] + change) + (1.0f - flip.flipRatio)*grid;
+	}
+}
+
+void FlipSimulation::moveParticles(size_t begin, size_t end, SimulationStats& counters){
+	for(size_t i=begin; i<end; i++){
+		glm::vec3 step = dt*v[i];
+		while(collideAndMove(x[i], v[i], step, surfaces, c_R, counters));
+		x[i] += step;
+	}
+}
+
+void FlipSimulation::respawnParticles(){
+	for(size_t i=0; i<N; i++){
+		if(respawn && (glm::any(glm::lessThan(x[i], domainMin)) || glm::any(glm::greaterThan(x[i], domainMax)))){
+			x[i] = glm::vec3(1.60767 + 2.0*random() - 1.0,-0.9 + random()*0.2,-7.0 + 2.0*random() - 1.0);
+			v[i] = glm::vec3(0.0, 0.0, 1.7);
+			affine[3*i] = affine[3*i + 1] = affine[3*i + 2] = glm::vec3(0.0);
+			SIM_COUNT(statistics.respawns, 1);
+		}
+	}
+}
+
+GLfloat FlipSimulation::random(){
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return (rngState % 100000) / 100000.0;
+}
+
+bool FlipSimulation::addParticle(glm::vec3 position, glm::vec3 velocity){
+	if(N >= capacity) return false;
+	x[N] = position;
+	v[N] = velocity;
+	affine[3*N] = affine[3*N + 1] = affine[3*N + 2] = glm::vec3(0.0);
+	N++;
+	version++;
+	return true;
+}
+
+size_t FlipSimulation::memoryBytes(){
+	size_t kept = 0;
+	for(size_t t=0; t<records.size(); t++){
+		kept += records[t].blocked.capacity();
+	}
+	return (2*x.capacity() + affine.capacity())*sizeof(glm::vec3) + (groupOf.capacity() + grouped.capacity())*sizeof(int)
+		+ resident.size()*sizeof(Tile) + tiles.capacity()*sizeof(std::unique_ptr<Tile>) + records.capacity()*sizeof(TileRecord)
+		+ resident.capacity()*sizeof(int) + kept + tileMap.memoryBytes() + groups.memoryBytes();
+}
+
+void FlipSimulation::addPlane(glm::mat4 modelMatrix){
+	Water::addPlane(surfaces, modelMatrix);
+}
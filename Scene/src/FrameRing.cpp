@@ -0,0 +1,187 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <new>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "FrameRing.h"
+#include "Simulation.h"
+
+using namespace Water;
+using namespace std;
+
+static uint64_t aligned(uint64_t bytes){
+	return (bytes + FRAME_RING_ALIGNMENT - 1) / FRAME_RING_ALIGNMENT * FRAME_RING_ALIGNMENT;
+}
+
+//Shared memory names are a single path component starting with a slash
+static string objectName(const string& name){
+	return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+static uint64_t velocitiesOffset(uint64_t capacity){
+	return FRAME_RING_ALIGNMENT + aligned(capacity*sizeof(glm::vec3));
+}
+
+static const FrameRingSlot* slotAt(const char* base, const FrameRingHeader* header, uint64_t frame){
+	return (const FrameRingSlot*)(base + aligned(sizeof(FrameRingHeader)) + frame % header->slots * header->slotBytes);
+}
+
+FrameRingWriter::FrameRingWriter(){
+	base = NULL;
+	bytes = 0;
+	header = NULL;
+	published = 0;
+}
+
+FrameRingWriter::~FrameRingWriter(){
+	if(base != NULL){
+		munmap(base, bytes);
+		shm_unlink(name.c_str());
+	}
+}
+
+bool FrameRingWriter::create(const string& ringName, size_t capacity, uint32_t slots){
+	if(base != NULL || slots < 2) return false;
+
+	name = objectName(ringName);
+	uint64_t slotBytes = velocitiesOffset(capacity) + aligned(capacity*sizeof(glm::vec3));
+	bytes = aligned(sizeof(FrameRingHeader)) + slots*slotBytes;
+
+	shm_unlink(name.c_str());
+	int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+	if(fd < 0){
+		cerr << "FrameRing: can not create " << name << ": " << strerror(errno) << endl;
+		return false;
+	}
+	if(ftruncate(fd, bytes) < 0){
+		cerr << "FrameRing: can not size " << name << ": " << strerror(errno) << endl;
+		close(fd);
+		shm_unlink(name.c_str());
+		return false;
+	}
+	void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED){
+		shm_unlink(name.c_str());
+		return false;
+	}
+	base = (char*)p;
+
+	//The object starts zero filled, so every slot reads as never written
+	//and published as zero until the header is complete
+	header = new (base) FrameRingHeader;
+	memcpy(header->magic, FRAME_RING_MAGIC, sizeof(header->magic));
+	header->version = FRAME_RING_VERSION;
+	header->slots = slots;
+	header->capacity = capacity;
+	header->slotBytes = slotBytes;
+	header->producer = getpid();
+	for(uint32_t s=0; s<slots; s++){
+		new ((char*)slotAt(base, header, s)) FrameRingSlot;
+	}
+	header->published.store(0, memory_order_release);
+	return true;
+}
+
+bool FrameRingWriter::publish(Simulation& sim){
+	ParticleView positions = sim.positions();
+	ParticleView velocities = sim.velocities();
+	size_t n = min(positions.size, (size_t)header->capacity);
+
+	uint64_t frame = published;
+	FrameRingSlot* slot = (FrameRingSlot*)slotAt(base, header, frame);
+	char* data = (char*)slot;
+
+	//Readers still on the frame this slot held see the sequence change
+	slot->sequence.store(2*frame + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	slot->step = sim.stats().steps;
+	slot->particles = n;
+	memcpy(data + FRAME_RING_ALIGNMENT, positions.data, n*sizeof(glm::vec3));
+	memcpy(data + velocitiesOffset(header->capacity), velocities.data, n*sizeof(glm::vec3));
+
+	slot->sequence.store(2*frame + 2, memory_order_release);
+	published = frame + 1;
+	header->published.store(published, memory_order_release);
+	return n == positions.size;
+}
+
+FrameRingReader::FrameRingReader(){
+	base = NULL;
+	bytes = 0;
+	header = NULL;
+}
+
+FrameRingReader::~FrameRingReader(){
+	if(base != NULL) munmap((void*)base, bytes);
+}
+
+bool FrameRingReader::attach(const string& ringName){
+	if(base != NULL) return false;
+
+	int fd = shm_open(objectName(ringName).c_str(), O_RDONLY, 0);
+	if(fd < 0) return false;
+
+	struct stat st;
+	if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(FrameRingHeader)){
+		close(fd);
+		return false;
+	}
+	bytes = st.st_size;
+	void* p = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) return false;
+	base = (const char*)p;
+	header = (const FrameRingHeader*)base;
+
+	if(memcmp(header->magic, FRAME_RING_MAGIC, sizeof(header->magic)) != 0 || header->version != FRAME_RING_VERSION
+			|| header->slots == 0 || aligned(sizeof(FrameRingHeader)) + header->slots*header->slotBytes > bytes){
+		munmap((void*)base, bytes);
+		base = NULL;
+		header = NULL;
+		return false;
+	}
+	return true;
+}
+
+bool FrameRingReader::latest(FrameRingFrame& frame){
+	//Only fails if the producer laps the reader between the two loads,
+	//which takes slots frames
+	while(true){
+		uint64_t published = header->published.load(memory_order_acquire);
+		if(published == 0) return false;
+
+		uint64_t f = published - 1;
+		const FrameRingSlot* slot = slotAt(base, header, f);
+		uint64_t sequence = slot->sequence.load(memory_order_acquire);
+		if(sequence != 2*f + 2) continue;
+
+		frame.slot = slot;
+		frame.sequence = sequence;
+		frame.frame = f;
+		frame.step = slot->step;
+		frame.particles = slot->particles;
+		frame.positions = (const glm::vec3*)((const char*)slot + FRAME_RING_ALIGNMENT);
+		frame.velocities = (const glm::vec3*)((const char*)slot + velocitiesOffset(header->capacity));
+		if(isIntact(frame)) return true;
+	}
+}
+
+bool FrameRingReader::isIntact(const FrameRingFrame& frame){
+	atomic_thread_fence(memory_order_acquire);
+	return frame.slot->sequence.load(memory_order_relaxed) == frame.sequence;
+}
+
+uint64_t FrameRingReader::getPublished(){
+	return header->published.load(memory_order_acquire);
+}
+
+bool FrameRingReader::isProducerAlive(){
+	return kill((pid_t)header->producer, 0) == 0 || errno == EPERM;
+}
@@ -0,0 +1,99 @@
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "Numa.h"
+
+using namespace Water;
+using namespace std;
+
+//Parses a sysfs CPU or node list like 0-3,8-11
+static vector<int> parseList(const string& list){
+	vector<int> res;
+	stringstream ss(list);
+	string item;
+	while(getline(ss, item, ',')){
+		if(item.empty()) continue;
+		size_t dash = item.find('-');
+		int first = atoi(item.c_str());
+		int last = dash == string::npos ? first : atoi(item.c_str() + dash + 1);
+		for(int c=first; c<=last; c++) res.push_back(c);
+	}
+	return res;
+}
+
+NumaTopology NumaTopology::detect(){
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+	//Node numbers can have gaps, offline and memory-less nodes are left out
+	string online;
+	ifstream nodes("/sys/devices/system/node/online");
+	if(nodes) getline(nodes, online);
+	vector<int> ids = parseList(online);
+
+	NumaTopology topology;
+	for(size_t i=0; i<ids.size(); i++){
+		int node = ids[i];
+		stringstream path;
+		path << "/sys/devices/system/node/node" << node << "/cpulist";
+		ifstream in(path.str().c_str());
+		if(!in) continue;
+
+		string list;
+		getline(in, list);
+		vector<int> cpus;
+		vector<int> all = parseList(list);
+		for(size_t c=0; c<all.size(); c++){
+			if(!restricted || (all[c] < CPU_SETSIZE && CPU_ISSET(all[c], &allowed))) cpus.push_back(all[c]);
+		}
+
+		//Nodes with memory but no CPUs get no workers
+		if(!cpus.empty()){
+			topology.cpus.push_back(cpus);
+			topology.ids.push_back(node);
+		}
+	}
+
+	if(topology.cpus.empty()){
+		vector<int> cpus;
+		int count = thread::hardware_concurrency();
+		for(int c=0; c<max(count, 1); c++) cpus.push_back(c);
+		topology.cpus.push_back(cpus);
+		topology.ids.push_back(0);
+	}
+	return topology;
+}
+
+bool Water::pinToNode(const NumaTopology& topology, int node){
+	if(node < 0 || node >= (int)topology.nodes()) return false;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	const vector<int>& cpus = topology.cpus[node];
+	for(size_t c=0; c<cpus.size(); c++){
+		if(cpus[c] < CPU_SETSIZE) CPU_SET(cpus[c], &set);
+	}
+	return CPU_COUNT(&set) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+int Water::nodeOfPage(const void* p){
+#ifdef SYS_move_pages
+	//With no target nodes move_pages only reports where the pages are
+	void* page = (void*)((uintptr_t)p & ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1));
+	int status = -1;
+	if(syscall(SYS_move_pages, 0, 1UL, &page, NULL, &status, 0) != 0) return -1;
+	return status >= 0 ? status : -1;
+#else
+	return -1;
+#endif
+}
@@ -0,0 +1,78 @@
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "Overlay.h"
+#include "Trace.h"
+
+using namespace Water;
+using namespace std;
+
+//Layout in normalized device coordinates
+const GLfloat LEFT = -0.98f;
+const GLfloat TOP = 0.96f;
+const GLfloat WIDTH = 0.5f;
+const GLfloat ROW_HEIGHT = 0.03f;
+const GLfloat ROW_GAP = 0.01f;
+
+Overlay::Overlay() : shader("shaders/overlay.vs", "shaders/overlay.frag"){
+	glGenBuffers(1, &VBO);
+	glGenVertexArrays(1, &VAO);
+
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5*sizeof(GLfloat), (GLvoid*)0);
+	glEnableVertexAttribArray(0);
+
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5*sizeof(GLfloat), (GLvoid*)(2*sizeof(GLfloat)));
+	glEnableVertexAttribArray(1);
+	glBindVertexArray(0);
+}
+
+void Overlay::addBar(int row, const vector<GLfloat>& widths, const vector<glm::vec3>& colors){
+	GLfloat top = TOP - row*(ROW_HEIGHT + ROW_GAP);
+	GLfloat bottom = top - ROW_HEIGHT;
+	GLfloat x = LEFT;
+
+	for(size_t i=0; i<widths.size() && i<colors.size(); i++){
+		GLfloat next = x + WIDTH*widths[i];
+		GLfloat corners[6][2] = {
+			{x, bottom}, {next, bottom}, {next, top},
+			{x, bottom}, {next, top}, {x, top}
+		};
+		for(int c=0; c<6; c++){
+			vertices.push_back(corners[c][0]);
+			vertices.push_back(corners[c][1]);
+			vertices.push_back(colors[i].x);
+			vertices.push_back(colors[i].y);
+			vertices.push_back(colors[i].z);
+		}
+		x = next;
+	}
+}
+
+void Overlay::draw(){
+	if(vertices.empty()) return;
+	TRACE_SCOPE("draw overlay");
+
+	shader.Use();
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	{
+		TRACE_SCOPE("upload overlay");
+		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*vertices.size(), vertices.data(), GL_STREAM_DRAW);
+	}
+	glDrawArrays(GL_TRIANGLES, 0, vertices.size()/5);
+	glBindVertexArray(0);
+
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+
+	vertices.clear();
+}
@@ -0,0 +1,565 @@
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Simulation.h"
+#include "ParticleCache.h"
+
+using namespace Water;
+using namespace std;
+
+//Deflate level, the fastest one already removes most of the redundancy
+//left after delta coding and keeps the writer ahead of the simulation
+static const int COMPRESSION_LEVEL = 1;
+
+static void bounds(const vector<glm::vec3>& v, float* lo, float* hi){
+	for(int c=0; c<3; c++){
+		lo[c] = 0.0f;
+		hi[c] = 0.0f;
+	}
+	if(v.empty()) return;
+
+	for(int c=0; c<3; c++){
+		lo[c] = v[0][c];
+		hi[c] = v[0][c];
+	}
+	for(size_t i=1; i<v.size(); i++){
+		for(int c=0; c<3; c++){
+			lo[c] = min(lo[c], v[i][c]);
+			hi[c] = max(hi[c], v[i][c]);
+		}
+	}
+}
+
+//Quantisation levels of positions and velocities
+static const float POSITION_LEVELS = 65535.0f;
+static const float VELOCITY_LEVELS = 4095.0f;
+
+static uint16_t quantise(float value, float lo, float hi, float levels){
+	float scale = hi > lo ? levels / (hi - lo) : 0.0f;
+	return (uint16_t)min(levels, max(0.0f, floor((value - lo)*scale + 0.5f)));
+}
+
+static float dequantise(uint16_t q, float lo, float hi, float levels){
+	return lo + q*((hi - lo) / levels);
+}
+
+static uint16_t zigzag(uint16_t q, uint16_t prediction){
+	int16_t delta = (int16_t)(uint16_t)(q - prediction);
+	return (uint16_t)((delta << 1) ^ (delta >> 15));
+}
+
+static uint16_t unzigzag(uint16_t z, uint16_t prediction){
+	uint16_t delta = (z >> 1) ^ (uint16_t)-(int)(z & 1);
+	return (uint16_t)(prediction + delta);
+}
+
+//Prediction of component c of particle i, in the same units as value.
+//Particles that are new since the last frame and all particles of a
+//keyframe are predicted from the previous particle instead
+static bool predictVelocity(const ParticleCacheHistory& history, bool keyframe, size_t i, int c, float& value){
+	const vector<glm::vec3>* h = history.velocities;
+	if(keyframe || history.frames == 0 || i >= h[0].size()) return false;
+	if(history.frames == 1 || i >= h[1].size()) value = h[0][i][c];
+	else value = 2.0f*h[0][i][c] - h[1][i][c];
+	return true;
+}
+
+static bool predictPosition(const ParticleCacheHistory& history, bool keyframe, size_t i, int c,
+		float stepScale, const vector<glm::vec3>& velocities, float& value){
+	const vector<glm::vec3>& h = history.positions[0];
+	if(keyframe || history.frames == 0 || i >= h.size()) return false;
+	value = h[i][c] + stepScale*velocities[i][c];
+	return true;
+}
+
+//Writes the low and high bytes of the zigzag coded difference between q
+//and its prediction
+static void store(uint16_t q, uint16_t prediction, unsigned char* low, unsigned char* high, size_t i){
+	uint16_t z = zigzag(q, prediction);
+	low[i] = z & 0xff;
+	high[i] = z >> 8;
+}
+
+//Velocities are coded first, positions are then predicted by moving the
+//previous position along the decoded velocity
+static void codeVelocities(const vector<glm::vec3>* in, size_t n, const ParticleCacheFrame& frame, bool keyframe,
+		const ParticleCacheHistory& history, unsigned char* planes, vector<glm::vec3>& decoded){
+	for(int c=0; c<3; c++){
+		float lo = frame.velocityMin[c];
+		float hi = frame.velocityMax[c];
+		unsigned char* low = planes + 2*c*n;
+		unsigned char* high = planes + (2*c + 1)*n;
+
+		uint16_t previous = 0;
+		for(size_t i=0; i<n; i++){
+			float predicted;
+			uint16_t prediction = predictVelocity(history, keyframe, i, c, predicted) ? quantise(predicted, lo, hi, VELOCITY_LEVELS) : previous;
+			uint16_t q;
+			if(in != NULL){
+				q = quantise((*in)[i][c], lo, hi, VELOCITY_LEVELS);
+				store(q, prediction, low, high, i);
+			}else{
+				q = unzigzag(low[i] | (high[i] << 8), prediction);
+			}
+			previous = q;
+			decoded[i][c] = dequantise(q, lo, hi, VELOCITY_LEVELS);
+		}
+	}
+}
+
+static void codePositions(const vector<glm::vec3>* in, size_t n, const ParticleCacheFrame& frame, bool keyframe,
+		const ParticleCacheHistory& history, const vector<glm::vec3>& velocities, unsigned char* planes, vector<glm::vec3>& decoded){
+	for(int c=0; c<3; c++){
+		float lo = frame.positionMin[c];
+		float hi = frame.positionMax[c];
+		unsigned char* low = planes + 2*c*n;
+		unsigned char* high = planes + (2*c + 1)*n;
+
+		uint16_t previous = 0;
+		for(size_t i=0; i<n; i++){
+			float predicted;
+			uint16_t prediction = predictPosition(history, keyframe, i, c, frame.stepScale, velocities, predicted) ? quantise(predicted, lo, hi, POSITION_LEVELS) : previous;
+			uint16_t q;
+			if(in != NULL){
+				q = quantise((*in)[i][c], lo, hi, POSITION_LEVELS);
+				store(q, prediction, low, high, i);
+			}else{
+				q = unzigzag(low[i] | (high[i] << 8), prediction);
+			}
+			previous = q;
+			decoded[i][c] = dequantise(q, lo, hi, POSITION_LEVELS);
+		}
+	}
+}
+
+//Least squares fit of the time between the history and this frame, the
+//factor which best moves the previous positions onto the current ones
+//along the decoded velocities
+static float fitStepScale(const ParticleCacheHistory& history, const vector<glm::vec3>& positions, const vector<glm::vec3>& velocities){
+	if(history.frames == 0) return 0.0f;
+	const vector<glm::vec3>& previous = history.positions[0];
+	double num = 0.0;
+	double den = 0.0;
+	for(size_t i=0; i<positions.size() && i<previous.size(); i++){
+		glm::vec3 d = positions[i] - previous[i];
+		num += glm::dot(d, velocities[i]);
+		den += glm::dot(velocities[i], velocities[i]);
+	}
+	return den > 0.0 ? num / den : 0.0f;
+}
+
+static void remember(ParticleCacheHistory& history, bool keyframe, const vector<glm::vec3>& positions, const vector<glm::vec3>& velocities){
+	if(keyframe) history.frames = 0;
+	history.positions[1].swap(history.positions[0]);
+	history.velocities[1].swap(history.velocities[0]);
+	history.positions[0] = positions;
+	history.velocities[0] = velocities;
+	history.frames = min(2, history.frames + 1);
+}
+
+void Water::encodeParticleFrame(const vector<glm::vec3>& positions, const vector<glm::vec3>& velocities,
+		bool keyframe, ParticleCacheHistory& history, ParticleCacheFrame& frame, vector<char>& payload){
+	size_t n = positions.size();
+	frame.particles = n;
+	frame.keyframe = keyframe;
+	bounds(positions, frame.positionMin, frame.positionMax);
+	bounds(velocities, frame.velocityMin, frame.velocityMax);
+
+	vector<unsigned char> planes(12*n);
+	vector<glm::vec3> decodedPositions(n);
+	vector<glm::vec3> decodedVelocities(n);
+	codeVelocities(&velocities, n, frame, keyframe, history, &planes[6*n], decodedVelocities);
+	frame.stepScale = keyframe ? 0.0f : fitStepScale(history, positions, decodedVelocities);
+	codePositions(&positions, n, frame, keyframe, history, decodedVelocities, &planes[0], decodedPositions);
+	remember(history, keyframe, decodedPositions, decodedVelocities);
+
+	uLongf compressed = compressBound(planes.size());
+	payload.resize(compressed);
+	if(compress2((Bytef*)payload.data(), &compressed, planes.data(), planes.size(), COMPRESSION_LEVEL) != Z_OK){
+		cerr << "ParticleCache: compression failed" << endl;
+		abort();
+	}
+	payload.resize(compressed);
+	frame.payloadBytes = compressed;
+}
+
+bool Water::decodeParticleFrame(const ParticleCacheFrame& frame, const char* payload, ParticleCacheHistory& history,
+		vector<glm::vec3>& positions, vector<glm::vec3>& velocities){
+	size_t n = frame.particles;
+	bool keyframe = frame.keyframe != 0;
+	if(!keyframe && history.frames == 0) return false;
+
+	vector<unsigned char> planes(12*n);
+	uLongf length = planes.size();
+	if(uncompress(planes.data(), &length, (const Bytef*)payload, frame.payloadBytes) != Z_OK || length != planes.size()){
+		return false;
+	}
+
+	positions.resize(n);
+	velocities.resize(n);
+	codeVelocities(NULL, n, frame, keyframe, history, &planes[6*n], velocities);
+	codePositions(NULL, n, frame, keyframe, history, velocities, &planes[0], positions);
+	remember(history, keyframe, positions, velocities);
+	return true;
+}
+
+ParticleCacheWriter::ParticleCacheWriter(size_t q, uint32_t interval){
+	file = NULL;
+	queueFrames = max((size_t)1, q);
+	keyframeInterval = max((uint32_t)1, interval);
+	stopping = false;
+	failed = false;
+	bytes = 0;
+}
+
+ParticleCacheWriter::~ParticleCacheWriter(){
+	close();
+	for(size_t i=0; i<spare.size(); i++){
+		delete spare[i];
+	}
+}
+
+bool ParticleCacheWriter::open(const string& path){
+	close();
+
+	file = fopen(path.c_str(), "wb");
+	if(file == NULL){
+		cerr << "ParticleCache: could not create " << path << endl;
+		return false;
+	}
+
+	ParticleCacheHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, PARTICLE_CACHE_MAGIC, sizeof(h.magic));
+	h.version = PARTICLE_CACHE_VERSION;
+	h.byteOrder = PARTICLE_CACHE_BYTE_ORDER;
+	h.keyframeInterval = keyframeInterval;
+	failed = fwrite(&h, sizeof(h), 1, file) != 1;
+	bytes = sizeof(h);
+	index.clear();
+
+	stopping = false;
+	writer = thread(&ParticleCacheWriter::work, this);
+	return !failed;
+}
+
+void ParticleCacheWriter::addFrame(Simulation& sim){
+	Pending* p;
+	{
+		unique_lock<mutex> l(lock);
+		while(queue.size() >= queueFrames){
+			hasRoom.wait(l);
+		}
+		if(spare.empty()){
+			p = new Pending();
+		}else{
+			p = spare.back();
+			spare.pop_back();
+		}
+	}
+
+	ParticleView positions = sim.positions();
+	ParticleView velocities = sim.velocities();
+	p->step = sim.stats().steps;
+	p->positions.assign(positions.begin(), positions.end());
+	p->velocities.assign(velocities.begin(), velocities.end());
+
+	{
+		unique_lock<mutex> l(lock);
+		queue.push_back(p);
+	}
+	hasWork.notify_one();
+}
+
+bool ParticleCacheWriter::close(){
+	if(file == NULL) return true;
+
+	{
+		unique_lock<mutex> l(lock);
+		stopping = true;
+	}
+	hasWork.notify_one();
+	writer.join();
+
+	ParticleCacheHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, PARTICLE_CACHE_MAGIC, sizeof(h.magic));
+	h.version = PARTICLE_CACHE_VERSION;
+	h.byteOrder = PARTICLE_CACHE_BYTE_ORDER;
+	h.keyframeInterval = keyframeInterval;
+	h.indexOffset = bytes;
+	h.frames = index.size();
+
+	if(!index.empty() && fwrite(index.data(), sizeof(ParticleCacheIndexEntry), index.size(), file) != index.size()) failed = true;
+	if(fseek(file, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, file) != 1) failed = true;
+	if(fclose(file) != 0) failed = true;
+	file = NULL;
+
+	if(failed) cerr << "ParticleCache: writing failed" << endl;
+	return !failed;
+}
+
+uint64_t ParticleCacheWriter::getFrames(){
+	unique_lock<mutex> l(lock);
+	return index.size();
+}
+
+uint64_t ParticleCacheWriter::getBytes(){
+	unique_lock<mutex> l(lock);
+	return bytes;
+}
+
+void ParticleCacheWriter::work(){
+	ParticleCacheFrame frame;
+	ParticleCacheHistory history;
+	vector<char> payload;
+	while(true){
+		Pending* p;
+		{
+			unique_lock<mutex> l(lock);
+			while(queue.empty() && !stopping){
+				hasWork.wait(l);
+			}
+			if(queue.empty()) return;
+			p = queue.front();
+		}
+
+		memset(&frame, 0, sizeof(frame));
+		frame.step = p->step;
+		bool keyframe = index.size() % keyframeInterval == 0;
+		encodeParticleFrame(p->positions, p->velocities, keyframe, history, frame, payload);
+
+		bool ok = fwrite(&frame, sizeof(frame), 1, file) == 1
+			&& (payload.empty() || fwrite(payload.data(), payload.size(), 1, file) == 1);
+
+		{
+			unique_lock<mutex> l(lock);
+			ParticleCacheIndexEntry e;
+			e.offset = bytes;
+			e.step = frame.step;
+			index.push_back(e);
+			bytes += sizeof(frame) + payload.size();
+			if(!ok) failed = true;
+
+			queue.pop_front();
+			spare.push_back(p);
+		}
+		hasRoom.notify_one();
+	}
+}
+
+ParticleCacheReader::ParticleCacheReader(size_t p){
+	base = NULL;
+	length = 0;
+	keyframeInterval = 1;
+	prefetchFrames = max((size_t)1, p);
+	stopping = false;
+	cursor = 0;
+	last = (size_t)-1;
+}
+
+ParticleCacheReader::~ParticleCacheReader(){
+	close();
+}
+
+bool ParticleCacheReader::open(const string& path){
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0){
+		cerr << "ParticleCache: could not open " << path << endl;
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ParticleCacheHeader)){
+		cerr << "ParticleCache: " << path << " is too short" << endl;
+		::close(fd);
+		return false;
+	}
+	length = st.st_size;
+	void* p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if(p == MAP_FAILED){
+		cerr << "ParticleCache: could not map " << path << endl;
+		return false;
+	}
+	base = (const char*)p;
+
+	ParticleCacheHeader h;
+	memcpy(&h, base, sizeof(h));
+	const char* error = NULL;
+	if(memcmp(h.magic, PARTICLE_CACHE_MAGIC, sizeof(h.magic)) != 0) error = "is not a particle cache";
+	else if(h.byteOrder != PARTICLE_CACHE_BYTE_ORDER) error = "was written with a different byte order";
+	else if(h.version != PARTICLE_CACHE_VERSION) error = "has an unsupported version";
+	else if(h.indexOffset != 0 && h.indexOffset + h.frames*sizeof(ParticleCacheIndexEntry) > length) error = "has its index outside the file";
+
+	if(error == NULL && h.indexOffset != 0){
+		index.resize(h.frames);
+		if(h.frames > 0) memcpy(index.data(), base + h.indexOffset, h.frames*sizeof(ParticleCacheIndexEntry));
+		for(size_t f=0; f<index.size() && error == NULL; f++){
+			if(index[f].offset + sizeof(ParticleCacheFrame) > length
+					|| index[f].offset + sizeof(ParticleCacheFrame) + chunk(f).payloadBytes > length) error = "has frames outside the file";
+		}
+	}else if(error == NULL){
+		//The writer did not finish, keep the frames which are complete
+		uint64_t offset = sizeof(h);
+		while(offset + sizeof(ParticleCacheFrame) <= length){
+			ParticleCacheFrame frame;
+			memcpy(&frame, base + offset, sizeof(frame));
+			if(offset + sizeof(frame) + frame.payloadBytes > length) break;
+
+			ParticleCacheIndexEntry e;
+			e.offset = offset;
+			e.step = frame.step;
+			index.push_back(e);
+			offset += sizeof(frame) + frame.payloadBytes;
+		}
+		cerr << "ParticleCache: " << path << " has no index, found " << index.size() << " frames" << endl;
+	}
+
+	if(error == NULL && (index.empty() || !chunk(0).keyframe)) error = "does not start with a keyframe";
+	if(error != NULL){
+		cerr << "ParticleCache: " << path << " " << error << endl;
+		close();
+		return false;
+	}
+
+	keyframeInterval = max((uint32_t)1, h.keyframeInterval);
+	stopping = false;
+	cursor = 0;
+	last = (size_t)-1;
+	history.frames = 0;
+	prefetcher = thread(&ParticleCacheReader::work, this);
+	return true;
+}
+
+void ParticleCacheReader::close(){
+	if(prefetcher.joinable()){
+		{
+			unique_lock<mutex> l(lock);
+			stopping = true;
+		}
+		hasWork.notify_one();
+		prefetcher.join();
+	}
+
+	for(map<size_t, Decoded*>::iterator it=decoded.begin(); it!=decoded.end(); it++){
+		delete it->second;
+	}
+	decoded.clear();
+	index.clear();
+
+	if(base != NULL){
+		munmap((void*)base, length);
+		base = NULL;
+		length = 0;
+	}
+}
+
+ParticleCacheFrame ParticleCacheReader::chunk(size_t frame){
+	//Chunks are packed, so the header is copied out rather than read in place
+	ParticleCacheFrame f;
+	memcpy(&f, base + index[frame].offset, sizeof(f));
+	return f;
+}
+
+bool ParticleCacheReader::read(size_t frame, vector<glm::vec3>& positions, vector<glm::vec3>& velocities){
+	Decoded* d;
+	{
+		unique_lock<mutex> l(lock);
+		cursor = frame;
+		hasWork.notify_one();
+		while(decoded.find(frame) == decoded.end()){
+			hasFrame.wait(l);
+		}
+		d = decoded[frame];
+		decoded.erase(frame);
+
+		//The window moves on so the prefetcher decodes the frames after this
+		cursor = (frame + 1) % index.size();
+	}
+	hasWork.notify_one();
+
+	positions.swap(d->positions);
+	velocities.swap(d->velocities);
+	bool ok = d->ok;
+	delete d;
+	return ok;
+}
+
+bool ParticleCacheReader::decode(size_t frame, Decoded& out){
+	//Continue from the last decoded frame if it is on the way, otherwise
+	//start over at the keyframe before frame
+	size_t first = frame;
+	while(first > 0 && !chunk(first).keyframe) first--;
+	if(last != (size_t)-1 && last < frame && last >= first) first = last + 1;
+	else history.frames = 0;
+
+	for(size_t f=first; f<=frame; f++){
+		ParticleCacheFrame c = chunk(f);
+		if(!decodeParticleFrame(c, base + index[f].offset + sizeof(c), history, out.positions, out.velocities)){
+			cerr << "ParticleCache: frame " << f << " is corrupt" << endl;
+			last = (size_t)-1;
+			history.frames = 0;
+			return false;
+		}
+	}
+	last = frame;
+	return true;
+}
+
+void ParticleCacheReader::work(){
+	size_t n = index.size();
+	long page = sysconf(_SC_PAGESIZE);
+	while(true){
+		size_t target;
+		{
+			unique_lock<mutex> l(lock);
+			while(true){
+				if(stopping) return;
+
+				//Drop frames which fell out of the window
+				size_t window = min(prefetchFrames, n);
+				for(map<size_t, Decoded*>::iterator it=decoded.begin(); it!=decoded.end();){
+					if((it->first + n - cursor) % n >= window){
+						delete it->second;
+						decoded.erase(it++);
+					}else{
+						it++;
+					}
+				}
+
+				target = n;
+				for(size_t k=0; k<window && target == n; k++){
+					size_t f = (cursor + k) % n;
+					if(decoded.find(f) == decoded.end()) target = f;
+				}
+				if(target != n) break;
+				hasWork.wait(l);
+			}
+		}
+
+		//Ask the kernel to read the chunk after this one while decoding
+		if(target + 1 < n){
+			uint64_t begin = index[target + 1].offset & ~(uint64_t)(page - 1);
+			uint64_t end = index[target + 1].offset + sizeof(ParticleCacheFrame) + chunk(target + 1).payloadBytes;
+			madvise((void*)(base + begin), end - begin, MADV_WILLNEED);
+		}
+
+		Decoded* d = new Decoded();
+		d->ok = decode(target, *d);
+
+		{
+			unique_lock<mutex> l(lock);
+			decoded[target] = d;
+		}
+		hasFrame.notify_all();
+	}
+}
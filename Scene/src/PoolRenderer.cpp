@@ -0,0 +1,79 @@
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Shader.h"
+#include "PoolRenderer.h"
+#include "Trace.h"
+
+using namespace Water;
+using namespace std;
+
+PoolRenderer::PoolRenderer(){
+	columns = 0;
+	rows = 0;
+
+	glGenBuffers(1, &VBO);
+	glGenBuffers(1, &EBO);
+	glGenVertexArrays(1, &VAO);
+
+	//Positions and normals are interleaved
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6*sizeof(GLfloat), (GLvoid*)0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6*sizeof(GLfloat), (GLvoid*)(3*sizeof(GLfloat)));
+	glEnableVertexAttribArray(1);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBindVertexArray(0);
+}
+
+void PoolRenderer::draw(ShallowWater& pool, Shader s){
+	TRACE_SCOPE("draw pool water");
+	size_t C = pool.getColumns();
+	size_t R = pool.getRows();
+	if(C < 2 || R < 2) return;
+
+	//The triangles only change with the size of the pool
+	glBindVertexArray(VAO);
+	if(C != columns || R != rows){
+		columns = C;
+		rows = R;
+		vector<GLuint> indices;
+		for(size_t j=0; j+1<R; j++){
+			for(size_t i=0; i+1<C; i++){
+				GLuint a = i + C*j;
+				indices.push_back(a);
+				indices.push_back(a + C);
+				indices.push_back(a + 1);
+				indices.push_back(a + 1);
+				indices.push_back(a + C);
+				indices.push_back(a + C + 1);
+			}
+		}
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*indices.size(), indices.data(), GL_STATIC_DRAW);
+	}
+
+	//Normals from central differences of the surface
+	GLfloat dx = pool.getCellSize();
+	glm::vec2 origin = pool.getMin();
+	vertices.resize(2*C*R);
+	for(size_t j=0; j<R; j++){
+		for(size_t i=0; i<C; i++){
+			size_t l = i > 0 ? i-1 : i, r = i+1 < C ? i+1 : i;
+			size_t d = j > 0 ? j-1 : j, u = j+1 < R ? j+1 : j;
+			GLfloat sx = (pool.surface(r, j) - pool.surface(l, j)) / ((r - l)*dx);
+			GLfloat sz = (pool.surface(i, u) - pool.surface(i, d)) / ((u - d)*dx);
+			vertices[2*(i + C*j)] = glm::vec3(origin.x + (i + 0.5f)*dx, pool.surface(i, j), origin.y + (j + 0.5f)*dx);
+			vertices[2*(i + C*j) + 1] = glm::normalize(glm::vec3(-sx, 1.0f, -sz));
+		}
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*vertices.size(), vertices.data(), GL_STREAM_DRAW);
+
+	glm::mat4 model(1.0);
+	glUniformMatrix4fv(glGetUniformLocation(s.Program, "model"), 1, GL_FALSE, glm::value_ptr(model));
+	glDrawElements(GL_TRIANGLES, 6*(C-1)*(R-1), GL_UNSIGNED_INT, 0);
+	glBindVertexArray(0);
+}
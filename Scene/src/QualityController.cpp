@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <cmath>
+
+#include "QualityController.h"
+
+using namespace Water;
+using namespace std;
+
+//Fraction of its value a knob loses or regains in one change
+static const float KNOB_STEP = 0.75;
+static const float SCALE_STEP = 0.125;
+
+QualityController::QualityController(const QualityParameters& p, ostream& out) : params(p), current(p.best), log(out){
+	levelOfDetail = true;
+	sim = 0.0;
+	render = 0.0;
+	work = 0.0;
+	frame = 0.0;
+	frames = 0;
+	changes = 0;
+	calmFrames = 0;
+
+	//The first frames include loading and warming up
+	settleFrames = params.settle;
+}
+
+bool QualityController::update(double simSeconds, double renderSeconds, double frameSeconds){
+	//Time the frame took beyond the simulation is blamed on rendering, it
+	//includes what the GPU did after the draw calls were issued
+	double renderEstimate = max(renderSeconds, frameSeconds - simSeconds);
+	double a = frames == 0 ? 1.0 : params.smoothing;
+	sim += a*(simSeconds - sim);
+	render += a*(renderEstimate - render);
+	work += a*(simSeconds + renderSeconds - work);
+	frame += a*(frameSeconds - frame);
+	frames++;
+
+	if(settleFrames > 0){
+		settleFrames--;
+		return false;
+	}
+
+	bool changed = false;
+	if(frame > params.targetSeconds*(1.0 + params.tolerance)){
+		calmFrames = 0;
+		if(sim >= render) changed = lowerSimulation() || lowerRender();
+		else changed = lowerRender() || lowerSimulation();
+	}else if(work < params.targetSeconds*params.headroom){
+		if(++calmFrames >= params.patience){
+			calmFrames = 0;
+			changed = raise();
+		}
+	}else{
+		calmFrames = 0;
+	}
+
+	if(changed){
+		changes++;
+		settleFrames = params.settle;
+	}
+	return changed;
+}
+
+bool QualityController::lowerSimulation(){
+	if(levelOfDetail && current.lodDistance > params.worst.lodDistance){
+		float next = max(current.lodDistance*KNOB_STEP, params.worst.lodDistance);
+		report("lowered level of detail distance", current.lodDistance, next);
+		current.lodDistance = next;
+		return true;
+	}
+	if(current.stepsPerFrame > params.worst.stepsPerFrame){
+		float next = max(current.stepsPerFrame*KNOB_STEP, params.worst.stepsPerFrame);
+		report("lowered steps per frame", current.stepsPerFrame, next);
+		current.stepsPerFrame = next;
+		return true;
+	}
+	return false;
+}
+
+bool QualityController::lowerRender(){
+	if(current.sphereResolution > params.worst.sphereResolution){
+		int next = max((int)(current.sphereResolution*KNOB_STEP), params.worst.sphereResolution);
+		report("lowered sphere resolution", current.sphereResolution, next);
+		current.sphereResolution = next;
+		return true;
+	}
+	if(current.renderScale > params.worst.renderScale){
+		float next = max(current.renderScale - SCALE_STEP, params.worst.renderScale);
+		report("lowered render scale", current.renderScale, next);
+		current.renderScale = next;
+		return true;
+	}
+	return false;
+}
+
+//The last knob lowered on either side comes back first
+bool QualityController::raise(){
+	if(current.renderScale < params.best.renderScale){
+		float next = min(current.renderScale + SCALE_STEP, params.best.renderScale);
+		report("raised render scale", current.renderScale, next);
+		current.renderScale = next;
+		return true;
+	}
+	if(current.stepsPerFrame < params.best.stepsPerFrame){
+		float next = min(current.stepsPerFrame/KNOB_STEP, params.best.stepsPerFrame);
+		report("raised steps per frame", current.stepsPerFrame, next);
+		current.stepsPerFrame = next;
+		return true;
+	}
+	if(current.sphereResolution < params.best.sphereResolution){
+		int next = min((int)ceil(current.sphereResolution/KNOB_STEP), params.best.sphereResolution);
+		report("raised sphere resolution", current.sphereResolution, next);
+		current.sphereResolution = next;
+		return true;
+	}
+	if(levelOfDetail && current.lodDistance < params.best.lodDistance){
+		float next = min(current.lodDistance/KNOB_STEP, params.best.lodDistance);
+		report("raised level of detail distance", current.lodDistance, next);
+		current.lodDistance = next;
+		return true;
+	}
+	return false;
+}
+
+void QualityController::report(const char* what, double before, double after){
+	log << "Quality at frame " << frames << ": frame " << 1000.0*frame << " ms (simulation " << 1000.0*sim
+		<< ", render " << 1000.0*render << ") against " << 1000.0*params.targetSeconds << " ms, "
+		<< what << " from " << before << " to " << after << endl;
+}
@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <GL/glew.h>
+
+#include "RenderTarget.h"
+
+using namespace Water;
+using namespace std;
+
+RenderTarget::RenderTarget(){
+	framebuffer = color = depth = 0;
+	bufferWidth = bufferHeight = 0;
+	windowWidth = windowHeight = 0;
+	offscreen = false;
+}
+
+RenderTarget::~RenderTarget(){
+	if(framebuffer != 0){
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteRenderbuffers(1, &color);
+		glDeleteRenderbuffers(1, &depth);
+	}
+}
+
+void RenderTarget::begin(int width, int height, GLfloat scale){
+	windowWidth = width;
+	windowHeight = height;
+	offscreen = scale < 1.0f;
+	if(!offscreen){
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, width, height);
+		return;
+	}
+
+	int w = max(1, (int)(width*scale));
+	int h = max(1, (int)(height*scale));
+	if(framebuffer == 0){
+		glGenFramebuffers(1, &framebuffer);
+		glGenRenderbuffers(1, &color);
+		glGenRenderbuffers(1, &depth);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+	//Buffers are only reallocated when the scale changes
+	if(w != bufferWidth || h != bufferHeight){
+		bufferWidth = w;
+		bufferHeight = h;
+		glBindRenderbuffer(GL_RENDERBUFFER, color);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+		glBindRenderbuffer(GL_RENDERBUFFER, depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+	}
+	glViewport(0, 0, bufferWidth, bufferHeight);
+}
+
+void RenderTarget::end(){
+	if(offscreen){
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, bufferWidth, bufferHeight, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+	glViewport(0, 0, windowWidth, windowHeight);
+}
@@ -0,0 +1,54 @@
+//Angles below are in radians, as in main.cpp
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Simulation.h"
+#include "Collision.h"
+#include "SceneSetup.h"
+
+using namespace Water;
+
+void Water::addWaterfallPlanes(std::vector<Triangle>& surfaces){
+	GLfloat PI = 3.14159265;
+	addPlane(surfaces, glm::scale(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(0.0,-4.0,2.0)),0.0f,glm::vec3(1.0,0.0,0.1)),glm::vec3(20.0,20.0,20.0)));
+
+	addPlane(surfaces, glm::scale(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(1.44,-1.28,-7.67)),0.10f,glm::vec3(1.0,0.0,0.1)),glm::vec3(2.0,2.0,5.0)));
+
+	addPlane(surfaces, glm::scale(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(-0.53,-2.43,-2.0)),-PI/2.1f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,2.0,2.0)));
+	addPlane(surfaces, glm::scale(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(-0.53+0.3,-3.43+0.3,-2.0)),-PI/4.1f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,2.0,2.0)));
+	addPlane(surfaces, glm::scale(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(3.32,-2.43,-2.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,2.0,2.0)));
+
+	addPlane(surfaces, glm::scale(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(1.43,-3.81,-2.16)),PI/2.5f,glm::vec3(1.0,0.0,0.0)),glm::vec3(2.0,2.0,2.0)));
+	addPlane(surfaces, glm::scale(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(1.43,0.2,-8.16)),PI/2.0f,glm::vec3(1.0,0.0,0.0)),glm::vec3(2.0,2.0,2.0)));
+
+	addPlane(surfaces, glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(3.06,-0.99,-5.53)),0.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,2.0,4.0)));
+	addPlane(surfaces, glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(0.55,-1.44,-5.56)),0.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,2.0,4.0)));
+	addPlane(surfaces, glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(-0.42,-2.43,0.93)),PI/6.0f,glm::vec3(0.0,1.0,0.0)),-PI/2.1f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,2.0,2.0)));
+	addPlane(surfaces, glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(-0.60,-3.46,0.04)),-PI/5.0f,glm::vec3(0.0,1.0,0.0)),-PI/3.2f,glm::vec3(0.0,0.0,1.0)),glm::vec3(1.4,0.4,0.4)));
+
+	addPlane(surfaces, glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(3.59171,-3.60756,0.89)),PI/10.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,2.0,2.0)));
+	addPlane(surfaces, glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(4.21,-2.87,4.73)),PI/10.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,2.0,2.0)));
+
+	addPlane(surfaces, glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(3.94,-2.52,2.33)),PI/2.0f+PI/4.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,0.6,0.6)));
+	addPlane(surfaces, glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(4.25,-3.08,5.84)),PI/2.0f+PI/5.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,1.0,0.5)));
+
+	addPlane(surfaces, glm::scale(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(-0.2,-3.60756,4.83412)),-PI/2.0f,glm::vec3(0.0,0.2,1.0)),glm::vec3(3.0,2.0,3.0)));
+
+	addPlane(surfaces, glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(2.19,-4.01,5.48+0.1)),-PI/4.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(0.2,0.2,0.2)));
+	addPlane(surfaces, glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(2.39+0.1,-4.01,5.48-0.05)),PI/2.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(0.2,0.2,0.2)));
+	addPlane(surfaces, glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(2.19+0.6,-4.01,5.48+0.1)),PI/4.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(0.2,0.2,0.2)));
+	addPlane(surfaces, glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(2.19+0.3,-3.81,5.48+0.1)),-0.1f,glm::vec3(1.0,0.0,0.0)),0.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(0.2,0.2,0.2)));
+}
+
+void Water::addWaterfallPlanes(Simulation& sim){
+	addWaterfallPlanes(sim.surfaces);
+}
+
+void Water::addWaterfallPlanes(CompactSimulation& sim){
+	addWaterfallPlanes(sim.surfaces);
+}
+
+void Water::addWaterfallPlanes(FlipSimulation& sim){
+	addWaterfallPlanes(sim.surfaces);
+}
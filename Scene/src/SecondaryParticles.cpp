@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+
+#include "SecondaryParticles.h"
+#include "Kernels.h"
+#include "Collision.h"
+#include "Trace.h"
+
+using namespace Water;
+using namespace std;
+
+SecondaryParticles::SecondaryParticles(const SecondaryParameters& p) : params(p), grid(1.0f){
+	for(int t=0; t<SECONDARY_TYPE_COUNT; t++){
+		counts[t] = 0;
+	}
+	updateSeconds = 0.0;
+	rngState = params.seed != 0 ? params.seed : 1;
+}
+
+void SecondaryParticles::update(Simulation& sim){
+	updateSeconds = 0.0;
+	ScopedTimer timer(updateSeconds);
+	TRACE_SCOPE("secondary");
+
+	splat(sim);
+	advect(sim);
+	seed(sim);
+}
+
+void SecondaryParticles::splat(Simulation& sim){
+	GLfloat spacing = 0.5f*sim.getEffectiveRadius();
+	if(grid.getCellSize() != spacing) grid = CellMap(spacing);
+	grid.clear();
+	nodeWeight.clear();
+	nodeVelocity.clear();
+
+	ParticleView positions = sim.positions();
+	ParticleView velocities = sim.velocities();
+	for(size_t i=0; i<positions.size; i++){
+		glm::vec3 x = positions[i];
+		glm::vec3 v = velocities[i];
+		int cx, cy, cz;
+		grid.coordinates(x, cx, cy, cz);
+		glm::vec3 f = x/spacing - glm::vec3(cx, cy, cz);
+		for(int corner=0; corner<8; corner++){
+			int ox = corner & 1, oy = corner >> 1 & 1, oz = corner >> 2;
+			GLfloat w = (ox ? f.x : 1.0f - f.x)*(oy ? f.y : 1.0f - f.y)*(oz ? f.z : 1.0f - f.z);
+			size_t node = grid.insert(cx + ox, cy + oy, cz + oz);
+			if(node == nodeWeight.size()){
+				nodeWeight.push_back(0.0f);
+				nodeVelocity.push_back(glm::vec3(0.0,0.0,0.0));
+			}
+			nodeWeight[node] += w;
+			nodeVelocity[node] += w*v;
+		}
+	}
+}
+
+void SecondaryParticles::advect(Simulation& sim){
+	GLfloat radius = sim.getEffectiveRadius();
+	GLfloat spacing = grid.getCellSize();
+	GLfloat dt = sim.getTimeStep();
+	glm::vec3 gravity(0.0, sim.getGravity(), 0.0);
+
+	//A node weight is the number of fluid particles per spacing^3, this
+	//turns it into the number within the effective radius
+	GLfloat neighbourScale = 4.0f/3.0f*PI*radius*radius*radius / (spacing*spacing*spacing);
+
+	for(int t=0; t<SECONDARY_TYPE_COUNT; t++){
+		counts[t] = 0;
+	}
+
+	size_t i = 0;
+	while(i < positions.size()){
+		glm::vec3& x = positions[i];
+		glm::vec3& v = velocities[i];
+
+		//Trilinear interpolation of the splatted fluid
+		int cx, cy, cz;
+		grid.coordinates(x, cx, cy, cz);
+		glm::vec3 f = x/spacing - glm::vec3(cx, cy, cz);
+		GLfloat weight = 0.0;
+		glm::vec3 momentum(0.0,0.0,0.0);
+		for(int corner=0; corner<8; corner++){
+			int ox = corner & 1, oy = corner >> 1 & 1, oz = corner >> 2;
+			const CellMap::Cell* c = grid.find(cx + ox, cy + oy, cz + oz);
+			if(c == NULL) continue;
+			size_t node = c - &grid.cell(0);
+			GLfloat w = (ox ? f.x : 1.0f - f.x)*(oy ? f.y : 1.0f - f.y)*(oz ? f.z : 1.0f - f.z);
+			weight += w*nodeWeight[node];
+			momentum += w*nodeVelocity[node];
+		}
+		glm::vec3 fluid = weight > EPS ? momentum / weight : glm::vec3(0.0,0.0,0.0);
+		GLfloat neighbours = weight*neighbourScale;
+
+		if(neighbours < params.sprayNeighbours){
+			//Ballistic, and the only kind which can hit the scenery
+			types[i] = SECONDARY_SPRAY;
+			v += dt*gravity;
+			glm::vec3 step = dt*v;
+			while(collideAndMove(x, v, step, sim.surfaces, 0.0f, collisions)) {}
+			x += step;
+		}else if(neighbours > params.bubbleNeighbours){
+			types[i] = SECONDARY_BUBBLE;
+			v += -params.buoyancy*dt*gravity + params.drag*(fluid - v);
+			x += dt*v;
+		}else{
+			types[i] = SECONDARY_FOAM;
+			v = fluid;
+			x += dt*v;
+			lifetimes[i] -= dt;
+		}
+
+		if(lifetimes[i] <= 0.0f || glm::any(glm::lessThan(x, params.domainMin)) || glm::any(glm::greaterThan(x, params.domainMax))){
+			remove(i);
+			continue;
+		}
+		counts[types[i]]++;
+		i++;
+	}
+}
+
+void SecondaryParticles::seed(Simulation& sim){
+	GLfloat dt = sim.getTimeStep();
+	GLfloat radius = sim.getEffectiveRadius();
+
+	ParticleView fluidPositions = sim.positions();
+	ParticleView fluidVelocities = sim.velocities();
+	for(size_t i=0; i<fluidPositions.size && positions.size() < params.capacity; i++){
+		glm::vec3 v = fluidVelocities[i];
+		GLfloat speed = glm::length(v);
+		GLfloat energy = 0.5f*speed*speed*sim.getParticleMass();
+
+		GLfloat air = glm::clamp((sim.getTrappedAir(i) - params.trappedAirMin) / (params.trappedAirMax - params.trappedAirMin), 0.0f, 1.0f);
+		GLfloat crest = glm::clamp((sim.getWaveCrest(i) - params.waveCrestMin) / (params.waveCrestMax - params.waveCrestMin), 0.0f, 1.0f);
+		GLfloat kinetic = glm::clamp((energy - params.energyMin) / (params.energyMax - params.energyMin), 0.0f, 1.0f);
+
+		//The fraction of a particle left over is seeded with that probability
+		GLfloat expected = dt*(params.trappedAirRate*air + params.waveCrestRate*crest)*kinetic;
+		int seeds = (int)(expected + random());
+		if(seeds == 0 || speed < EPS) continue;
+
+		//Spread over a cylinder around the path of the particle in this
+		//step, pushed outwards from its axis
+		glm::vec3 axis = v / speed;
+		glm::vec3 e1 = glm::cross(axis, fabs(axis.x) < 0.9f ? glm::vec3(1.0,0.0,0.0) : glm::vec3(0.0,1.0,0.0));
+		e1 = glm::normalize(e1);
+		glm::vec3 e2 = glm::cross(axis, e1);
+		for(int s=0; s<seeds && positions.size() < params.capacity; s++){
+			GLfloat r = 0.5f*radius*sqrt(random());
+			GLfloat angle = 2.0f*PI*random();
+			glm::vec3 out = r*(cos(angle)*e1 + sin(angle)*e2);
+
+			positions.push_back(fluidPositions[i] + out + random()*dt*v);
+			velocities.push_back(v + out);
+			lifetimes.push_back(params.foamLifetime*(0.5f + random()));
+			types.push_back(SECONDARY_SPRAY);
+		}
+	}
+}
+
+//Order does not matter, so the last particle takes the place of the removed one
+void SecondaryParticles::remove(size_t index){
+	positions[index] = positions.back();
+	velocities[index] = velocities.back();
+	lifetimes[index] = lifetimes.back();
+	types[index] = types.back();
+	positions.pop_back();
+	velocities.pop_back();
+	lifetimes.pop_back();
+	types.pop_back();
+}
+
+//Uniform in [0,1), the same generator as Simulation
+GLfloat SecondaryParticles::random(){
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return (rngState % 100000) / 100000.0;
+}
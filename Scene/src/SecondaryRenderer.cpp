@@ -0,0 +1,56 @@
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Shader.h"
+#include "SecondaryRenderer.h"
+#include "Trace.h"
+
+using namespace Water;
+
+SecondaryRenderer::SecondaryRenderer() : shader("shaders/secondary.vs", "shaders/secondary.frag"){
+	glGenBuffers(1, &positionVBO);
+	glGenBuffers(1, &typeVBO);
+	glGenVertexArrays(1, &VAO);
+
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat), (GLvoid*)0);
+	glEnableVertexAttribArray(0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, typeVBO);
+	glVertexAttribPointer(1, 1, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(GLubyte), (GLvoid*)0);
+	glEnableVertexAttribArray(1);
+	glBindVertexArray(0);
+}
+
+void SecondaryRenderer::draw(SecondaryParticles& secondary, const glm::mat4& view, const glm::mat4& projection, GLfloat pointScale){
+	if(secondary.size() == 0) return;
+	TRACE_SCOPE("draw secondary");
+
+	shader.Use();
+	glUniformMatrix4fv(glGetUniformLocation(shader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+	glUniformMatrix4fv(glGetUniformLocation(shader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+	glUniform1f(glGetUniformLocation(shader.Program, "pointScale"), pointScale);
+
+	//Points are sorted by nothing, so they blend without writing depth
+	glEnable(GL_PROGRAM_POINT_SIZE);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDepthMask(GL_FALSE);
+
+	glBindVertexArray(VAO);
+	{
+		TRACE_SCOPE("upload secondary");
+		glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*secondary.size(), secondary.getPositions().data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, typeVBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(GLubyte)*secondary.size(), secondary.getTypes().data(), GL_STREAM_DRAW);
+	}
+	glDrawArrays(GL_POINTS, 0, secondary.size());
+	glBindVertexArray(0);
+
+	glDepthMask(GL_TRUE);
+	glDisable(GL_BLEND);
+	glDisable(GL_PROGRAM_POINT_SIZE);
+}
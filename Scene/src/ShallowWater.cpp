@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+
+#include "ShallowWater.h"
+#include "Trace.h"
+
+using namespace Water;
+using namespace std;
+
+//Cells shallower than this are dry, the faces between two of them carry
+//no velocity
+static const GLfloat DRY = 1e-4;
+
+ShallowWater::ShallowWater(const ShallowWaterParameters& p) : params(p){
+	columns = max((int)ceil((params.poolMax.x - params.poolMin.x) / params.cellSize), 1);
+	rows = max((int)ceil((params.poolMax.y - params.poolMin.y) / params.cellSize), 1);
+
+	depth.assign(columns*rows, params.restDepth);
+	u.assign((columns+1)*rows, 0.0f);
+	w.assign(columns*(rows+1), 0.0f);
+	splash.assign(columns*rows, 0.0f);
+
+	drained = 0.0;
+	restVolume = volume();
+	absorbed = 0;
+	emitted = 0;
+	recycled = 0;
+	updateSeconds = 0.0;
+	rngState = params.seed != 0 ? params.seed : 1;
+}
+
+void ShallowWater::update(Simulation& sim){
+	updateSeconds = 0.0;
+	ScopedTimer timer(updateSeconds);
+	TRACE_SCOPE("pool");
+
+	absorbed = 0;
+	emitted = 0;
+	recycled = 0;
+	GLfloat particleVolume = sim.getParticleMass() / sim.getRestDensity();
+	GLfloat dt = sim.getTimeStep();
+
+	absorb(sim, particleVolume);
+	previous = depth;
+	advance(dt, fabs(sim.getGravity()));
+	emit(sim, particleVolume, dt);
+	drain(sim, particleVolume, dt);
+}
+
+bool ShallowWater::cellAt(GLfloat x, GLfloat z, size_t& i, size_t& j){
+	GLfloat fx = (x - params.poolMin.x) / params.cellSize;
+	GLfloat fz = (z - params.poolMin.y) / params.cellSize;
+	if(fx < 0.0f || fz < 0.0f || fx >= columns || fz >= rows) return false;
+	i = (size_t)fx;
+	j = (size_t)fz;
+	return true;
+}
+
+GLfloat ShallowWater::surfaceAt(GLfloat x, GLfloat z){
+	size_t i, j;
+	if(!cellAt(x, z, i, j)) return params.bed;
+
+	GLfloat fx = min(max((x - params.poolMin.x) / params.cellSize - 0.5f, 0.0f), columns - 1.0f);
+	GLfloat fz = min(max((z - params.poolMin.y) / params.cellSize - 0.5f, 0.0f), rows - 1.0f);
+	size_t i0 = (size_t)fx, j0 = (size_t)fz;
+	size_t i1 = min(i0 + 1, columns - 1), j1 = min(j0 + 1, rows - 1);
+	GLfloat a = fx - i0, b = fz - j0;
+	GLfloat d = (1.0f - a)*(1.0f - b)*depth[i0 + columns*j0] + a*(1.0f - b)*depth[i1 + columns*j0]
+		+ (1.0f - a)*b*depth[i0 + columns*j1] + a*b*depth[i1 + columns*j1];
+	return params.bed + d;
+}
+
+double ShallowWater::volume(){
+	double sum = 0.0;
+	for(size_t c=0; c<depth.size(); c++){
+		sum += depth[c];
+	}
+	return sum*params.cellSize*params.cellSize;
+}
+
+//u lives on a grid of columns+1 by rows faces, offset half a cell in z
+GLfloat ShallowWater::sampleU(GLfloat x, GLfloat z){
+	GLfloat fx = min(max((x - params.poolMin.x) / params.cellSize, 0.0f), (GLfloat)columns);
+	GLfloat fz = min(max((z - params.poolMin.y) / params.cellSize - 0.5f, 0.0f), rows - 1.0f);
+	size_t i0 = (size_t)fx, j0 = (size_t)fz;
+	size_t i1 = min(i0 + 1, columns), j1 = min(j0 + 1, rows - 1);
+	GLfloat a = fx - i0, b = fz - j0;
+	size_t stride = columns + 1;
+	return (1.0f - a)*(1.0f - b)*u[i0 + stride*j0] + a*(1.0f - b)*u[i1 + stride*j0]
+		+ (1.0f - a)*b*u[i0 + stride*j1] + a*b*u[i1 + stride*j1];
+}
+
+//w lives on a grid of columns by rows+1 faces, offset half a cell in x
+GLfloat ShallowWater::sampleW(GLfloat x, GLfloat z){
+	GLfloat fx = min(max((x - params.poolMin.x) / params.cellSize - 0.5f, 0.0f), columns - 1.0f);
+	GLfloat fz = min(max((z - params.poolMin.y) / params.cellSize, 0.0f), (GLfloat)rows);
+	size_t i0 = (size_t)fx, j0 = (size_t)fz;
+	size_t i1 = min(i0 + 1, columns - 1), j1 = min(j0 + 1, rows);
+	GLfloat a = fx - i0, b = fz - j0;
+	return (1.0f - a)*(1.0f - b)*w[i0 + columns*j0] + a*(1.0f - b)*w[i1 + columns*j0]
+		+ (1.0f - a)*b*w[i0 + columns*j1] + a*b*w[i1 + columns*j1];
+}
+
+//A particle adds its volume to the cell below it and its horizontal
+//velocity to the faces around the cell, weighted by the volume it adds.
+//Its downward speed pushes the faces outwards, so an impact starts a ring
+//of waves. Going down the array, the particle moved into a removed one's
+//place was already looked at
+void ShallowWater::absorb(Simulation& sim, GLfloat particleVolume){
+	ParticleView positions = sim.positions();
+	ParticleView velocities = sim.velocities();
+	GLfloat added = particleVolume / (params.cellSize*params.cellSize);
+	size_t stride = columns + 1;
+	for(size_t n=positions.size; n>0; n--){
+		size_t index = n - 1;
+		glm::vec3 x = positions[index];
+		glm::vec3 v = velocities[index];
+		size_t i, j;
+		if(v.y > 0.0f || !cellAt(x.x, x.z, i, j)) continue;
+		size_t c = i + columns*j;
+		if(x.y > params.bed + depth[c] + params.absorbMargin) continue;
+
+		GLfloat before = depth[c];
+		GLfloat after = before + added;
+		GLfloat push = -params.impactSpread*v.y;
+		if(i > 0) u[i + stride*j] = (before*u[i + stride*j] + added*(v.x - push)) / after;
+		if(i+1 < columns) u[i+1 + stride*j] = (before*u[i+1 + stride*j] + added*(v.x + push)) / after;
+		if(j > 0) w[i + columns*j] = (before*w[i + columns*j] + added*(v.z - push)) / after;
+		if(j+1 < rows) w[i + columns*(j+1)] = (before*w[i + columns*(j+1)] + added*(v.z + push)) / after;
+		depth[c] = after;
+
+		sim.removeParticle(index);
+		absorbed++;
+	}
+}
+
+//Substeps keep gravity waves and the flow under half a cell per substep.
+//Each advects the velocities, moves the water between cells with upwind
+//fluxes and accelerates the velocities down the slope of the surface
+//(Bridson 2015, chapter 13). Faces are limited to a quarter cell per
+//substep, then no cell can lose more water than it holds, so the depth
+//stays positive and volume is conserved
+void ShallowWater::advance(GLfloat dt, GLfloat gravity){
+	GLfloat dx = params.cellSize;
+	GLfloat fastest = 0.0f;
+	GLfloat deepest = 0.0f;
+	for(size_t f=0; f<u.size(); f++) fastest = max(fastest, fabs(u[f]));
+	for(size_t f=0; f<w.size(); f++) fastest = max(fastest, fabs(w[f]));
+	for(size_t c=0; c<depth.size(); c++) deepest = max(deepest, depth[c]);
+	GLfloat speed = fastest + sqrt(gravity*deepest);
+	int substeps = min(max((int)ceil(2.0f*speed*dt / dx), 1), 64);
+	GLfloat h = dt / substeps;
+	GLfloat limit = 0.25f*dx / h;
+	GLfloat keep = max(1.0f - params.friction*h, 0.0f);
+	size_t stride = columns + 1;
+
+	for(int s=0; s<substeps; s++){
+		advect(h);
+		for(size_t f=0; f<u.size(); f++) u[f] = min(max(u[f], -limit), limit);
+		for(size_t f=0; f<w.size(); f++) w[f] = min(max(w[f], -limit), limit);
+
+		depthNext.resize(depth.size());
+		for(size_t j=0; j<rows; j++){
+			for(size_t i=0; i<columns; i++){
+				size_t c = i + columns*j;
+				GLfloat net = 0.0f;
+				GLfloat left = u[i + stride*j];
+				GLfloat right = u[i+1 + stride*j];
+				GLfloat down = w[i + columns*j];
+				GLfloat up = w[i + columns*(j+1)];
+				if(i > 0) net += left*(left > 0.0f ? depth[c-1] : depth[c]);
+				if(i+1 < columns) net -= right*(right > 0.0f ? depth[c] : depth[c+1]);
+				if(j > 0) net += down*(down > 0.0f ? depth[c-columns] : depth[c]);
+				if(j+1 < rows) net -= up*(up > 0.0f ? depth[c] : depth[c+columns]);
+				depthNext[c] = max(depth[c] + h/dx*net, 0.0f);
+			}
+		}
+		depth.swap(depthNext);
+
+		for(size_t j=0; j<rows; j++){
+			for(size_t i=1; i<columns; i++){
+				size_t c = i + columns*j;
+				GLfloat& f = u[i + stride*j];
+				if(depth[c] < DRY && depth[c-1] < DRY) f = 0.0f;
+				else f = keep*(f - gravity*h/dx*(depth[c] - depth[c-1]));
+			}
+		}
+		for(size_t j=1; j<rows; j++){
+			for(size_t i=0; i<columns; i++){
+				size_t c = i + columns*j;
+				GLfloat& f = w[c];
+				if(depth[c] < DRY && depth[c-columns] < DRY) f = 0.0f;
+				else f = keep*(f - gravity*h/dx*(depth[c] - depth[c-columns]));
+			}
+		}
+	}
+}
+
+//Semi-Lagrangian: every interior face takes the velocity found where the
+//flow through it came from
+void ShallowWater::advect(GLfloat dt){
+	GLfloat dx = params.cellSize;
+	size_t stride = columns + 1;
+	uNext = u;
+	wNext = w;
+	for(size_t j=0; j<rows; j++){
+		for(size_t i=1; i<columns; i++){
+			GLfloat x = params.poolMin.x + i*dx;
+			GLfloat z = params.poolMin.y + (j + 0.5f)*dx;
+			uNext[i + stride*j] = sampleU(x - dt*u[i + stride*j], z - dt*sampleW(x, z));
+		}
+	}
+	for(size_t j=1; j<rows; j++){
+		for(size_t i=0; i<columns; i++){
+			GLfloat x = params.poolMin.x + (i + 0.5f)*dx;
+			GLfloat z = params.poolMin.y + j*dx;
+			wNext[i + columns*j] = sampleW(x - dt*sampleU(x, z), z - dt*w[i + columns*j]);
+		}
+	}
+	u.swap(uNext);
+	w.swap(wNext);
+}
+
+//The volume a cell rises by beyond splashSpeed is collected until it makes
+//up a particle. Cells which stop rising lose what they collected, so slow
+//swells never splash
+void ShallowWater::emit(Simulation& sim, GLfloat particleVolume, GLfloat dt){
+	GLfloat dx = params.cellSize;
+	GLfloat area = dx*dx;
+	GLfloat removed = particleVolume / area;
+	size_t stride = columns + 1;
+	for(size_t j=0; j<rows; j++){
+		for(size_t i=0; i<columns; i++){
+			size_t c = i + columns*j;
+			GLfloat rise = (depth[c] - previous[c]) / dt;
+			if(rise <= params.splashSpeed){
+				splash[c] = 0.0f;
+				continue;
+			}
+			splash[c] += (rise - params.splashSpeed)*dt*area;
+
+			glm::vec3 v(0.5f*(u[i + stride*j] + u[i+1 + stride*j]), params.splashLift*rise, 0.5f*(w[c] + w[c + columns]));
+			while(splash[c] >= particleVolume && depth[c] >= removed && emitted < params.maxEmitted){
+				glm::vec3 x(params.poolMin.x + (i + random())*dx, 0.0f, params.poolMin.y + (j + random())*dx);
+				x.y = params.bed + depth[c] + params.emitHeight;
+				if(!sim.addParticle(x, v)) return;
+				depth[c] -= removed;
+				splash[c] -= particleVolume;
+				emitted++;
+			}
+		}
+	}
+}
+
+//Lowers the whole pool evenly, cells shallower than the drop only lose
+//what they hold
+void ShallowWater::drain(Simulation& sim, GLfloat particleVolume, GLfloat dt){
+	double excess = volume() - restVolume;
+	if(excess > 0.0){
+		GLfloat drop = excess*(1.0 - exp(-params.drainRate*dt)) / (depth.size()*params.cellSize*params.cellSize);
+		double lost = 0.0;
+		for(size_t c=0; c<depth.size(); c++){
+			GLfloat d = min(depth[c], drop);
+			depth[c] -= d;
+			lost += d;
+		}
+		drained += lost*params.cellSize*params.cellSize;
+	}
+
+	if(!params.recycle){
+		drained = 0.0;
+		return;
+	}
+	while(drained >= particleVolume && sim.addSourceParticle()){
+		drained -= particleVolume;
+		recycled++;
+	}
+}
+
+//Uniform in [0,1), xorshift32 as in Simulation
+GLfloat ShallowWater::random(){
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return (rngState % 100000) / 100000.0f;
+}
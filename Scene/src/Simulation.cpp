@@ -1,216 +1,510 @@
 #include <iostream>
-#include <thread>
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <vector>
-#include <GL/glew.h>
-#include <GL/glu.h>
+#include <unistd.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "Simulation.h"
+#include "Kernels.h"
+#include "Collision.h"
+#include "Trace.h"
+#include "Numa.h"
 
 
 using namespace Water;
 using namespace std;
 
-GLfloat const PI = 3.14159265;
-
-GLfloat randomGLfloat(){
-	return (rand() % 100000) / 100000.0;
-}
-
-Simulation::Simulation(size_t particles){
-	v = 3.5; 				//Viscosity
-	k = 3.0;				//Presure constant
-	g = -9.81;				//Gravitational force
-	pm = 10.0;				//Particle mass
-	p_0 = 2301.3;				//Rest presure
-	d_0 = 1398.0;			//Rest density
-	dt = 0.01;				//Time step
-	c_R = 0.0;
-	/*
-	v = 3.5; 				//Viscosity
-	k = 3.0;				//Presure constant
-	g = -9.81;				//Gravitational force
-	pm = 10.0;				//Particle mass
-	p_0 = 1.0;				//Rest presure
-	d_0 = 500.0;			//Rest density
-	dt = 0.01;				//Time step
-	c_R = 0.1;
-	*/
-
-	effectiveRadius = 0.50;
+//Length of the summed kernel gradients above which a particle counts as
+//being at the surface
+static const GLfloat NORMAL_THRESHOLD = 20.0;
 
-	N = particles;
+//Below this many particles the passes of the parallel grid build cost more
+//in waiting for the workers than they save
+static const size_t PARALLEL_GRID_PARTICLES = 16384;
 
-	density = new GLfloat[N];
-	presure = new GLfloat[N];
+template<typename Scalar>
+BasicSimulation<Scalar>::BasicSimulation(size_t particles, bool hugePages) : grid(gridRes), boundaryGrid(SimulationParameters().effectiveRadius){
+	init(particles, SimulationParameters(), hugePages);
+}
 
-	x = new glm::vec3[N];
-	dx = new glm::vec3[N];
+template<typename Scalar>
+BasicSimulation<Scalar>::BasicSimulation(size_t particles, const SimulationParameters& params, bool hugePages) : grid(gridRes), boundaryGrid(params.effectiveRadius){
+	init(particles, params, hugePages);
+}
 
-	xcopy = new glm::vec3[N];
-	dxcopy = new glm::vec3[N];
+template<typename Scalar>
+void BasicSimulation<Scalar>::init(size_t particles, const SimulationParameters& params, bool hugePages){
+	v = params.v;
+	k = params.k;
+	g = params.g;
+	pm = params.pm;
+	p_0 = params.p_0;
+	d_0 = params.d_0;
+	dt = params.dt;
+	c_R = params.c_R;
+	effectiveRadius = params.effectiveRadius;
+	respawn = params.respawn;
+	version = 0;
+	domainMin = Vector(params.domainMin);
+	domainMax = Vector(params.domainMax);
+	useBoundary = params.boundaryParticles;
+	boundarySpacing = params.boundarySpacing;
+	boundaryStiffness = params.boundaryStiffness;
+	secondaryMetrics = params.secondaryMetrics;
+	lodDistance = params.lodDistance;
+	lodLevels = min(max(params.lodLevels, 0), MAX_LOD_LEVELS);
+	viewer = Vector(0.0,0.0,0.0);
+	boundarySurfaces = 0;
+	boundarySeconds = 0.0;
+	checkGridHalfWidth = (int)ceil(effectiveRadius / gridRes);
+
+	rngState = params.seed != 0 ? params.seed : 1;
 
-	ht = new int*[htSize];
-	for(int i=0; i<htSize; i++){
-		ht[i] = new int[htBucket];
+	N = particles;
+	ghosts = 0;
+	capacity = max(particles, params.capacity);
+	size_t metricCapacity = secondaryMetrics ? capacity : 0;
+
+	//Room for the metrics is always reserved, their pages are only mapped
+	//once they are turned on
+	arena.reserve(2*Arena::bytesFor<Scalar>(capacity)
+			+ 4*Arena::bytesFor<Vector>(capacity)
+			+ 2*Arena::bytesFor<int>(capacity)
+			+ Arena::bytesFor<Vector>(capacity)
+			+ 2*Arena::bytesFor<Scalar>(capacity)
+			+ 3*Arena::bytesFor<uint8_t>(capacity), hugePages);
+
+	density = arena.allocate<Scalar>(capacity);
+	presure = arena.allocate<Scalar>(capacity);
+
+	x = arena.allocate<Vector>(capacity);
+	dx = arena.allocate<Vector>(capacity);
+
+	xcopy = arena.allocate<Vector>(capacity);
+	dxcopy = arena.allocate<Vector>(capacity);
+
+	particleCell = arena.allocate<int>(capacity);
+	cellParticles = arena.allocate<int>(capacity);
+
+	surfaceNormal = NULL;
+	trappedAir = NULL;
+	waveCrest = NULL;
+	if(secondaryMetrics) allocateMetrics();
+
+	lodLevel = arena.allocate<uint8_t>(capacity);
+	lodWaiting = arena.allocate<uint8_t>(capacity);
+	lodSteps = arena.allocate<uint8_t>(capacity);
+
+	numa = params.numa && params.threads > 1;
+	reorderInterval = params.reorderInterval;
+	if(params.threads > 1){
+		NumaTopology topology;
+		if(numa) topology = NumaTopology::detect();
+		workers.reset(new WorkerGroup(params.threads, numa ? &topology : NULL));
+	}
+
+	//Worker w owns an equal share of the capacity. A node starts where its
+	//first worker's share does
+	size_t T = workers ? workers->size() : 1;
+	owner.resize(T + 1);
+	nodeBegin.clear();
+	nodeIds.clear();
+	for(size_t w=0; w<=T; w++){
+		owner[w] = capacity*w / T;
+		if(w < T && (w == 0 || workers->nodeOf(w) != workers->nodeOf(w-1))){
+			nodeBegin.push_back(owner[w]);
+			nodeIds.push_back(workers ? workers->systemNodeOf(w) : 0);
+		}
 	}
-	htBuckets = new int[htSize];
+	nodeBegin.push_back(capacity);
+	if(numa) placeParticles(metricCapacity);
 
 	int cnt = 0;
 	for(int m=0; m<100 && cnt < N; m++)
 	for(int l=0; l<10 && cnt < N; l++)
 	for(int n=0; n<10 && cnt < N; n++)
-		x[cnt++] = glm::vec3(l*0.3 + 0.5, m*0.3 - 1.19, n*0.3 - 4.37);
+		x[cnt++] = Vector(l*0.3 + 0.5, m*0.3 - 1.19, n*0.3 - 4.37);
 }
 
-static void applyForcesThreaded(Simulation* w, int imod);
-
-void Simulation::step(){
-	hashParticles();
-	
-	bool doThreading = false;
-	if(doThreading == true){
-		for(int i=0; i<N; i++){
-			dxcopy[i] = dx[i];
-		}
-
-		vector<thread> t;
-		for(int i=0; i<N; i++){
-			t.push_back(thread(applyForcesThreaded, this, i));
+template<typename Scalar>
+void BasicSimulation<Scalar>::step(){
+	statistics.steps++;
+	version++;
+	statistics.stepSeconds = 0.0;
+	for(int p=0; p<PHASE_COUNT; p++){
+		statistics.phaseSeconds[p] = 0.0;
+	}
+	statistics.neighborsVisited = 0;
+	statistics.kernelEvaluations = 0;
+	statistics.triangleTests = 0;
+	statistics.bounces = 0;
+	statistics.respawns = 0;
+	statistics.remoteNeighbors = 0;
+
+	ScopedTimer stepTimer(statistics.stepSeconds);
+	TRACE_SCOPE("step");
+	{
+		ScopedTimer t(statistics.phaseSeconds[PHASE_HASH]);
+		TRACE_SCOPE("hash");
+		updateLevelOfDetail();
+		hashParticles();
+		if(numa && reorderInterval > 0 && (statistics.steps - 1) % reorderInterval == 0){
+			sortParticles();
+			hashParticles();
 		}
+	}
+	
+	{
+		ScopedTimer t(statistics.phaseSeconds[PHASE_DENSITY]);
+		TRACE_SCOPE("density");
+		parallel(N+ghosts, [this](size_t begin, size_t end, SimulationStats& counters){
+			return computeDensity(begin, end, counters);
+		});
+	}
+	{
+		ScopedTimer t(statistics.phaseSeconds[PHASE_FORCES]);
+		TRACE_SCOPE("forces");
+		parallel(N, [this](size_t begin, size_t end, SimulationStats& counters){
+			return computeForces(begin, end, counters);
+		});
+
+		//Velocities are replaced once every force is known, the force pass
+		//reads the old ones of the neighbours
+		parallel(N, [this](size_t begin, size_t end, SimulationStats&){
+			for(size_t i=begin; i<end; i++){
+				dx[i] = dxcopy[i];
+			}
+			return (size_t)0;
+		});
+	}
 
-		for(int i=0; i<N; i++){
-			t[i].join();
-		}
+	{
+		ScopedTimer t(statistics.phaseSeconds[PHASE_COLLISION]);
+		TRACE_SCOPE("collision");
+		parallel(N, [this](size_t begin, size_t end, SimulationStats& counters){
+			collideParticles(begin, end, counters);
+			return (size_t)0;
+		});
+	}
+	{
+		ScopedTimer t(statistics.phaseSeconds[PHASE_RESPAWN]);
+		TRACE_SCOPE("respawn");
+		respawnParticles(0, N);
+	}
+}
 
-		for(int i=0; i<N; i++){
-			 dx[i] = dxcopy[i];
-		}
+template<typename Scalar>
+void BasicSimulation<Scalar>::partition(size_t w, size_t count, size_t& begin, size_t& end){
+	if(numa){
+		begin = min(owner[w], count);
+		end = min(owner[w+1], count);
 	}else{
-		applyForces();
+		size_t T = workers->size();
+		begin = count*w / T;
+		end = count*(w+1) / T;
 	}
+}
 
-	for(int i=0; i<N; i++){
-		glm::vec3 d	= dt*dx[i];
-		while(collideAndMove(i,d)) {}
+template<typename Scalar>
+template<typename Phase>
+size_t BasicSimulation<Scalar>::parallel(size_t count, Phase phase){
+	if(!workers) return phase(0, count, statistics);
+
+	//Every worker counts on its own stack and the counters are added up
+	//afterwards, in worker order
+	size_t T = workers->size();
+	vector<size_t> results(T, 0);
+	vector<SimulationStats> counted(T);
+	workers->run([&](size_t w){
+		size_t begin, end;
+		partition(w, count, begin, end);
+		SimulationStats counters;
+		results[w] = phase(begin, end, counters);
+		counted[w] = counters;
+	});
+
+	size_t sum = 0;
+	for(size_t w=0; w<T; w++){
+		sum += results[w];
+		statistics.neighborsVisited += counted[w].neighborsVisited;
+		statistics.kernelEvaluations += counted[w].kernelEvaluations;
+		statistics.triangleTests += counted[w].triangleTests;
+		statistics.bounces += counted[w].bounces;
+		statistics.remoteNeighbors += counted[w].remoteNeighbors;
+	}
+	return sum;
+}
 
-		x[i] += d;
+//The pages of the arena are only mapped when they are first written, on
+//the node of the thread writing them. Partial pages at the ends of a share
+//go to whichever worker gets there first
+template<typename Scalar>
+void BasicSimulation<Scalar>::placeParticles(size_t metricCapacity){
+	workers->run([&](size_t w){
+		size_t begin = owner[w];
+		size_t end = owner[w+1];
+		fill(density + begin, density + end, Scalar(0.0));
+		fill(presure + begin, presure + end, Scalar(0.0));
+		fill(x + begin, x + end, Vector(0.0,0.0,0.0));
+		fill(dx + begin, dx + end, Vector(0.0,0.0,0.0));
+		fill(xcopy + begin, xcopy + end, Vector(0.0,0.0,0.0));
+		fill(dxcopy + begin, dxcopy + end, Vector(0.0,0.0,0.0));
+		fill(particleCell + begin, particleCell + end, 0);
+		fill(cellParticles + begin, cellParticles + end, 0);
+		fill(lodLevel + begin, lodLevel + end, 0);
+		fill(lodWaiting + begin, lodWaiting + end, 0);
+		fill(lodSteps + begin, lodSteps + end, 0);
+		if(metricCapacity > 0){
+			fill(surfaceNormal + begin, surfaceNormal + end, Vector(0.0,0.0,0.0));
+			fill(trappedAir + begin, trappedAir + end, Scalar(0.0));
+			fill(waveCrest + begin, waveCrest + end, Scalar(0.0));
+		}
+	});
+}
 
-		if(x[i].y < -4.5 || x[i].x > 6.0 || x[i].x < -2.0 || x[i].z > 10.0 || x[i].z < -8.0){
-			x[i] = glm::vec3(1.60767 + 2.0*randomGLfloat() - 1.0,-0.9 + randomGLfloat()*0.2,-7.0 + 2.0*randomGLfloat() - 1.0);
-			dx[i] *= 0.0f;
-			dx[i].z = 1.7;
+//Counting sort of the particles by their cell after the cells are ordered,
+//then the permutation is applied in place by following its cycles. Density
+//and the level of detail state move with the particles since waiting
+//particles keep them from earlier steps
+template<typename Scalar>
+void BasicSimulation<Scalar>::sortParticles(){
+	TRACE_SCOPE("sort");
+	grid.sort(sortRemap);
+
+	sortStart.assign(grid.size() + 1, 0);
+	for(size_t i=0; i<N; i++){
+		sortStart[sortRemap[particleCell[i]] + 1]++;
+	}
+	for(size_t c=0; c<grid.size(); c++){
+		sortStart[c+1] += sortStart[c];
+	}
+	sortDestination.resize(N);
+	for(size_t i=0; i<N; i++){
+		sortDestination[i] = sortStart[sortRemap[particleCell[i]]]++;
+	}
+
+	for(size_t i=0; i<N; i++){
+		while(sortDestination[i] != (int)i){
+			int d = sortDestination[i];
+			swap(x[i], x[d]);
+			swap(dx[i], dx[d]);
+			swap(density[i], density[d]);
+			swap(presure[i], presure[d]);
+			swap(lodLevel[i], lodLevel[d]);
+			swap(lodWaiting[i], lodWaiting[d]);
+			swap(lodSteps[i], lodSteps[d]);
+			if(secondaryMetrics) swap(surfaceNormal[i], surfaceNormal[d]);
+			swap(sortDestination[i], sortDestination[d]);
 		}
 	}
+	version++;
 }
 
-const GLfloat EPS = 1e-10;
-
-GLfloat kernel(glm::vec3 r, GLfloat r_e){
-	GLfloat l = glm::length(r);
-	if(l > r_e) return 0.0f;
-	return 315.0f*pow(r_e*r_e - l*l, 3.0f) / (64.0f*PI*pow(r_e,9.0f));
+template<typename Scalar>
+double BasicSimulation<Scalar>::getLocalPageFraction(){
+	if(!numa || N == 0) return -1.0;
+
+	//One sample per page of the positions
+	size_t perPage = max((size_t)sysconf(_SC_PAGESIZE) / sizeof(Vector), (size_t)1);
+	size_t local = 0;
+	size_t known = 0;
+	for(size_t i=0; i<N; i+=perPage){
+		int node = nodeOfPage(x + i);
+		if(node < 0) continue;
+		known++;
+		if(node == nodeIds[nodeOf(i)]) local++;
+	}
+	return known > 0 ? local / (double)known : -1.0;
 }
 
-glm::vec3 presurekernel(glm::vec3 r, GLfloat r_e){
-	GLfloat l = glm::length(r);
-	if(l > r_e) return glm::vec3(0.0,0.0,0.0);
-	return 45.0f*pow(r_e - l,3.0f)*r / (PI*pow(r_e,6.0f)*l + EPS);
+template<typename Scalar>
+void BasicSimulation<Scalar>::collideParticles(size_t begin, size_t end, SimulationStats& counters){
+	for(int i=begin; i<end; i++){
+		Vector d	= dt*dx[i];
+		if(!useBoundary){
+			while(collideAndMove(i,d,counters)) {}
+		}
+
+		x[i] += d;
+	}
 }
 
-GLfloat viscositykernel(glm::vec3 r, GLfloat r_e){
-	GLfloat l = glm::length(r);
-	if(l > r_e) return 0.0f;
-	return 45.0f*(r_e - l) / (PI*pow(r_e,6.0f));
+template<typename Scalar>
+void BasicSimulation<Scalar>::respawnParticles(size_t begin, size_t end){
+	if(!respawn) return;
+	for(int i=begin; i<end; i++){
+		if(glm::any(glm::lessThan(x[i], domainMin)) || glm::any(glm::greaterThan(x[i], domainMax))){
+			placeAtSource(i);
+			SIM_COUNT(statistics.respawns, 1);
+		}
+	}
 }
 
-static void applyForcesThreaded(Simulation* w, int imod){
-	cout<<"Running imod = "<<imod<<endl;
-	w -> applyForces(imod);
+template<typename Scalar>
+void BasicSimulation<Scalar>::placeAtSource(size_t i){
+	x[i] = Vector(1.60767 + 2.0*random() - 1.0,-0.9 + random()*0.2,-7.0 + 2.0*random() - 1.0);
+	dx[i] *= 0.0f;
+	dx[i].z = 1.7;
 }
 
-void Simulation::applyForces(int imod){
-	glm::vec3 mx(gridRes*1.0001f, 0.0, 0.0);
-	glm::vec3 my(0.0, gridRes*1.0001f, 0.0);
-	glm::vec3 mz(0.0, 0.0, gridRes*1.0001f);
-	int i = imod;
+template<typename Scalar>
+bool BasicSimulation<Scalar>::addSourceParticle(){
+	if(!addParticle(Vector(0.0,0.0,0.0), Vector(0.0,0.0,0.0))) return false;
+	placeAtSource(N-1);
+	return true;
+}
 
-	density[i] = 0.0;
-	for(int l=-checkGridHalfWidth; l<=checkGridHalfWidth; l++){
-		for(int m=-checkGridHalfWidth; m<=checkGridHalfWidth; m++){
-			for(int n=-checkGridHalfWidth; n<=checkGridHalfWidth; n++){
-				int h=hash(x[i] + (GLfloat)l*mx + (GLfloat)m*my + (GLfloat)n*mz);
-				int* bucket = ht[h];
-				for(int j=0; j<htBucket && j<htBuckets[h]; j++){
-					int k = ht[h][j];
-					density[i] += pm * kernel(x[i] - x[k], effectiveRadius);
-				}
-			}
-		}
+//Decides which particles are updated in this step. The density and SPH force
+//of a particle at level L are computed every 2^L steps and the force is
+//applied for all of them at once, while gravity, moving and collisions still
+//happen every step so neighbours never see it jump. The updates of a level
+//are spread over the steps by particle index. Particles move to a finer
+//level as soon as they come closer, but only to the next coarser one at an
+//update, so the force interval never jumps by more than twice
+template<typename Scalar>
+void BasicSimulation<Scalar>::updateLevelOfDetail(){
+	if(lodDistance <= 0.0f){
+		statistics.activeParticles = N;
+		return;
 	}
-	presure[i] = p_0 + k*(density[i] - d_0);
-
-	for(int l=-checkGridHalfWidth; l<=checkGridHalfWidth; l++){
-		for(int m=-checkGridHalfWidth; m<=checkGridHalfWidth; m++){
-			for(int n=-checkGridHalfWidth; n<=checkGridHalfWidth; n++){
-				int h=hash(x[i] + (GLfloat)l*mx + (GLfloat)m*my + (GLfloat)n*mz);
-				int* bucket = ht[h];
-				for(int j=0; j<htBucket && j<htBuckets[h]; j++){
-					int k = ht[h][j];
-					if(k != i){
-						dxcopy[i] += dt * (presure[i] + presure[k]) / (2.0f*density[k]) * presurekernel(x[i] - x[k], effectiveRadius);
-
-						dxcopy[i] += -dt * v * (dx[i] - dx[k]) / density[k] * viscositykernel(x[i] - x[k], effectiveRadius);
-
-						if(glm::dot(dx[i],dx[k]) < 0.0){
-							dxcopy[i] += dt * dx[i] * 0.008f * glm::dot(dx[i],dx[k]) / (glm::length(dx[i])*glm::length(dx[k]) + EPS);
-						}
-					}
-				}
-			}
+
+	uint64_t step = statistics.steps;
+	uint64_t active = 0;
+	for(int i=0; i<N; i++){
+		Scalar distance = glm::length(x[i] - viewer);
+		int target = 0;
+		while(target < lodLevels && distance > lodDistance*(1 << target)) target++;
+
+		int level = min((int)lodLevel[i], target);
+		int period = 1 << level;
+		int waited = lodWaiting[i] + 1;
+		if((step + i) % period == 0 || waited >= period){
+			lodSteps[i] = waited;
+			lodWaiting[i] = 0;
+			if(target > level) level++;
+			active++;
+		}else{
+			lodSteps[i] = 0;
+			lodWaiting[i] = waited;
 		}
+		lodLevel[i] = level;
 	}
-	dxcopy[i].y += dt*g;
+	statistics.activeParticles = active;
 }
 
-void Simulation::applyForces(){
-	glm::vec3 mx(gridRes*1.0001f, 0.0, 0.0);
-	glm::vec3 my(0.0, gridRes*1.0001f, 0.0);
-	glm::vec3 mz(0.0, 0.0, gridRes*1.0001f);
+//Uniform in [0,1), xorshift32 so instances on different threads never share state
+template<typename Scalar>
+Scalar BasicSimulation<Scalar>::random(){
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return (rngState % 100000) / 100000.0;
+}
 
-	for(int i=0; i<N; i++){
-		dxcopy[i] = dx[i];
+template<typename Scalar>
+size_t BasicSimulation<Scalar>::computeDensity(size_t begin, size_t end, SimulationStats& counters){
+	size_t pairs = 0;
+#if WATERSIM_STATS
+	uint64_t evaluations = 0;
+	uint64_t remote = 0;
+#endif
+	for(int i=begin; i<end; i++){
+		//Particles waiting for their next update keep their old density
+		if(lodDistance > 0.0f && i < N && lodSteps[i] == 0) continue;
+		const CellMap::Cell& home = grid.cell(particleCell[i]);
+#if WATERSIM_STATS
+		int node = numa ? nodeOf(i) : 0;
+#endif
 		density[i] = 0.0;
-	}
-	
-	for(int i=0; i<N; i++){
+		Vector normal(0.0,0.0,0.0);
 		for(int l=-checkGridHalfWidth; l<=checkGridHalfWidth; l++){
 			for(int m=-checkGridHalfWidth; m<=checkGridHalfWidth; m++){
 				for(int n=-checkGridHalfWidth; n<=checkGridHalfWidth; n++){
-					int h=hash(x[i] + (GLfloat)l*mx + (GLfloat)m*my + (GLfloat)n*mz);
-					for(int j=0; j<htBucket && j<htBuckets[h]; j++){
-						density[i] += kernel(x[i] - x[ht[h][j]], effectiveRadius);
+					const CellMap::Cell* c = grid.find(home.x + l, home.y + m, home.z + n);
+					if(c == NULL) continue;
+					const int* bucket = cellParticles + c->begin;
+					for(unsigned int j=0; j<c->count; j++){
+						density[i] += kernel(x[i] - x[bucket[j]], effectiveRadius);
+						if(secondaryMetrics) normal += presurekernel(x[i] - x[bucket[j]], effectiveRadius);
+						pairs++;
+						SIM_COUNT(evaluations, 1);
+						SIM_COUNT(remote, numa && nodeOf(bucket[j]) != node);
 					}
 				}
 			}
 		}
 		density[i] *= pm;
+
+		//The neighbours lie behind the surface, so the sum of the kernel
+		//gradients points out of the fluid. Inside it cancels out
+		if(secondaryMetrics){
+			Scalar l = glm::length(normal);
+			surfaceNormal[i] = l > NORMAL_THRESHOLD ? normal / l : Vector(0.0,0.0,0.0);
+		}
+		if(useBoundary){
+			int bx, by, bz;
+			boundaryGrid.coordinates(x[i], bx, by, bz);
+			for(int l=-1; l<=1; l++){
+				for(int m=-1; m<=1; m++){
+					for(int n=-1; n<=1; n++){
+						const CellMap::Cell* c = boundaryGrid.find(bx + l, by + m, bz + n);
+						if(c == NULL) continue;
+						const int* bucket = boundaryParticles.data() + c->begin;
+						for(unsigned int j=0; j<c->count; j++){
+							int b = bucket[j];
+							density[i] += boundaryMass[b] * kernel(x[i] - boundary[b], effectiveRadius);
+							pairs++;
+							SIM_COUNT(evaluations, 1);
+						}
+					}
+				}
+			}
+		}
 		presure[i] = p_0 + k*(density[i] - d_0);
 	}
+	SIM_COUNT(counters.neighborsVisited, pairs);
+	SIM_COUNT(counters.kernelEvaluations, evaluations);
+	SIM_COUNT(counters.remoteNeighbors, remote);
+	return pairs;
+}
 
-	glm::vec3 f(0.0,0.0,0.0);
-	for(int i=0; i<N; i++){
+template<typename Scalar>
+size_t BasicSimulation<Scalar>::computeForces(size_t begin, size_t end, SimulationStats& counters){
+	size_t pairs = 0;
+#if WATERSIM_STATS
+	uint64_t evaluations = 0;
+	uint64_t remote = 0;
+#endif
+	Vector f(0.0,0.0,0.0);
+	for(int i=begin; i<end; i++){
+		//Particles waiting for their next update only fall
+		if(lodDistance > 0.0f && lodSteps[i] == 0){
+			dxcopy[i] = dx[i];
+			dxcopy[i].y += dt*g;
+			continue;
+		}
+		const CellMap::Cell& home = grid.cell(particleCell[i]);
+#if WATERSIM_STATS
+		int node = numa ? nodeOf(i) : 0;
+#endif
 		f *= 0.0f;
+		Scalar air = 0.0;
+		Scalar crest = 0.0;
 		for(int l=-checkGridHalfWidth; l<=checkGridHalfWidth; l++){
 			for(int m=-checkGridHalfWidth; m<=checkGridHalfWidth; m++){
 				for(int n=-checkGridHalfWidth; n<=checkGridHalfWidth; n++){
-					int h=hash(x[i] + (GLfloat)l*mx + (GLfloat)m*my + (GLfloat)n*mz);
-					int* bucket = ht[h];
-					for(int j=0; j<htBucket && j<htBuckets[h]; j++){
+					const CellMap::Cell* c = grid.find(home.x + l, home.y + m, home.z + n);
+					if(c == NULL) continue;
+					const int* bucket = cellParticles + c->begin;
+					for(unsigned int j=0; j<c->count; j++){
 						int k = bucket[j];
+						pairs++;
+						SIM_COUNT(remote, numa && nodeOf(k) != node);
 						if(k != i){
+							SIM_COUNT(evaluations, 2);
 							f += (presure[i] + presure[k]) / (2.0f*density[k]) * presurekernel(x[i] - x[k], effectiveRadius);
 
 							f +=  - v * (dx[i] - dx[k]) / density[k] * viscositykernel(x[i] - x[k], effectiveRadius);
@@ -218,126 +512,259 @@ void Simulation::applyForces(){
 							if(glm::dot(dx[i],dx[k]) < 0.0){
 								//f += dx[i] * 0.01f * glm::dot(dx[i],dx[k]) / (glm::length(dx[i])*glm::length(dx[k]) + EPS);
 							}
+
+							if(secondaryMetrics) accumulateMetrics(i, k, air, crest);
 						}
 					}
 				}
 			}
 		}
-		dxcopy[i] += dt*f;
+		//Boundary particles mirror the presure of the fluid particle, so
+		//they only push it away and never pull it in
+		if(useBoundary){
+			int bx, by, bz;
+			boundaryGrid.coordinates(x[i], bx, by, bz);
+			for(int l=-1; l<=1; l++){
+				for(int m=-1; m<=1; m++){
+					for(int n=-1; n<=1; n++){
+						const CellMap::Cell* c = boundaryGrid.find(bx + l, by + m, bz + n);
+						if(c == NULL) continue;
+						const int* bucket = boundaryParticles.data() + c->begin;
+						for(unsigned int j=0; j<c->count; j++){
+							int b = bucket[j];
+							pairs++;
+							SIM_COUNT(evaluations, 1);
+							f += boundaryStiffness * boundaryMass[b] / pm * presure[i] / density[i] * presurekernel(x[i] - boundary[b], effectiveRadius);
+						}
+					}
+				}
+			}
+		}
+		dxcopy[i] = dx[i] + forceTime(i)*f;
 		dxcopy[i].y += dt*g;
-	}
 
-	for(int i=0; i<N; i++){
-		dx[i] = dxcopy[i];
+		//Only crests which move outwards break into spray
+		if(secondaryMetrics){
+			Scalar speed = glm::length(dx[i]);
+			trappedAir[i] = air;
+			waveCrest[i] = speed > EPS && glm::dot(dx[i], surfaceNormal[i]) >= 0.6f*speed ? crest : 0.0f;
+		}
 	}
+	SIM_COUNT(counters.neighborsVisited, pairs);
+	SIM_COUNT(counters.kernelEvaluations, evaluations);
+	SIM_COUNT(counters.remoteNeighbors, remote);
+	return pairs;
 }
 
 
-bool Simulation::collideAndMove(int index, glm::vec3 &particleStep){
-	int i = index;
-
-	GLfloat mint = 1.0;
-	int minat = -1;
-	for(int j=0; j<surfaces.size(); j++){
-		GLfloat t = findCollision(i, surfaces[j], particleStep);
-		if(0.0 < t && t < mint){
-			mint = t;
-			minat = j;
-		}
+//Adds the contribution of neighbour k to the trapped air and wave crest
+//metrics of particle i (Ihmsen et al. 2012). Both are weighted by a kernel
+//falling linearly to zero at the effective radius
+template<typename Scalar>
+void BasicSimulation<Scalar>::accumulateMetrics(int i, int k, Scalar& air, Scalar& crest){
+	Vector xik = x[i] - x[k];
+	Scalar distance = glm::length(xik);
+	if(distance > effectiveRadius || distance < EPS) return;
+	Scalar weight = 1.0f - distance / effectiveRadius;
+
+	//Neighbours moving towards each other from the side trap air
+	Vector vik = dx[i] - dx[k];
+	Scalar speed = glm::length(vik);
+	if(speed > EPS){
+		air += speed * (1.0f - glm::dot(vik / speed, xik / distance)) * weight;
 	}
-	if(minat == -1) return false;
-
-	glm::vec3 n = glm::normalize(glm::cross(surfaces[minat].a - surfaces[minat].c,surfaces[minat].a - surfaces[minat].b));
 
-	x[i] = x[i] + (mint - 0.001f)*particleStep;
-	dx[i] = dx[i] - (1.0f + c_R)*glm::dot(n,dx[i])*n;
-	particleStep = (1-mint)*(particleStep - (1.0f + c_R)*glm::dot(n,particleStep)*n);
-
-	return true;
+	//Curvature from the normals of the neighbours behind a convex surface
+	if(glm::dot(xik, surfaceNormal[i]) > 0.0f){
+		crest += (1.0f - glm::dot(surfaceNormal[i], surfaceNormal[k])) * weight;
+	}
 }
 
-GLfloat Simulation::findCollision(int index, Triangle tri, glm::vec3 &particleStep){
-	int i = index;
-	glm::vec3 n = glm::normalize(glm::cross(tri.a - tri.c,tri.a - tri.b));
-
-	if(glm::dot(n, x[i] - tri.a)*glm::dot(n, x[i] + particleStep - tri.a) <= 0.0){
-		float d = glm::dot(particleStep, n);
-		float side = (d<0) - (d>0);
-		n = side*n;
-
-		glm::mat3 A(0.0);
-		A[0] = tri.a - tri.b;
-		A[1] = tri.a - tri.c;
-		A[2] = particleStep;
+template<typename Scalar>
+bool BasicSimulation<Scalar>::collideAndMove(int index, Vector &particleStep, SimulationStats& counters){
+	return Water::collideAndMove(x[index], dx[index], particleStep, surfaces, c_R, counters);
+}
 
-		glm::mat3 A_t(0.0);
-		A_t[0] = tri.a - tri.b;
-		A_t[1] = tri.a - tri.c;
-		A_t[2] = tri.a - x[i];
+template<typename Scalar>
+Scalar BasicSimulation<Scalar>::findCollision(int index, Triangle tri, Vector &particleStep){
+	return Water::findCollision(x[index], tri, particleStep);
+}
 
-		GLfloat t = glm::determinant(A_t) / glm::determinant(A);
+template<typename Scalar>
+void BasicSimulation<Scalar>::hashParticles(){
+	updateBoundary();
+	if(workers && N+ghosts >= PARALLEL_GRID_PARTICLES) grid.build(x, N+ghosts, particleCell, cellParticles, *workers);
+	else grid.build(x, N+ghosts, particleCell, cellParticles);
+}
 
-		glm::mat3 A_gamma(0.0);
-		A_gamma[0] = tri.a - tri.b;
-		A_gamma[1] = tri.a - x[i];
-		A_gamma[2] = particleStep;
+//Points of tri on a grid spanned by two of its edges, at most spacing apart
+template<typename Vector>
+static void sampleTriangle(const Triangle& tri, GLfloat spacing, vector<Vector>& out){
+	glm::vec3 u = tri.b - tri.a;
+	glm::vec3 w = tri.c - tri.a;
+	int nu = max(1, (int)ceil(glm::length(u) / spacing));
+	int nw = max(1, (int)ceil(glm::length(w) / spacing));
+	for(int i=0; i<=nu; i++){
+		for(int j=0; j<=nw; j++){
+			GLfloat s = i / (GLfloat)nu;
+			GLfloat t = j / (GLfloat)nw;
+			if(s + t > 1.0f + 1e-5f) break;
+			out.push_back(Vector(tri.a + s*u + t*w));
+		}
+	}
+}
 
-		GLfloat gamma = glm::determinant(A_gamma) / glm::determinant(A);
+template<typename Scalar>
+void BasicSimulation<Scalar>::updateBoundary(){
+	if(!useBoundary || boundarySurfaces == surfaces.size()) return;
+	boundarySeconds = 0.0;
+	ScopedTimer t(boundarySeconds);
+	TRACE_SCOPE("sample boundary");
+	sampleBoundary();
+}
 
-		if(gamma < 0 || gamma > 1) return -1.0; // no hit!
+template<typename Scalar>
+void BasicSimulation<Scalar>::sampleBoundary(){
+	//A checkpoint may have brought another kernel radius
+	if(boundaryGrid.getCellSize() != (float)effectiveRadius) boundaryGrid = CellMap(effectiveRadius);
 
-		glm::mat3 A_beta(0.0);
-		A_beta[0] = tri.a - x[i];
-		A_beta[1] = tri.a - tri.c;
-		A_beta[2] = particleStep;
+	boundary.clear();
+	for(size_t t=0; t<surfaces.size(); t++){
+		sampleTriangle(surfaces[t], boundarySpacing, boundary);
+	}
+	boundarySurfaces = surfaces.size();
+
+	boundaryCell.resize(boundary.size());
+	boundaryParticles.resize(boundary.size());
+	boundaryGrid.build(boundary.data(), boundary.size(), boundaryCell.data(), boundaryParticles.data());
+
+	//The mass of a boundary particle is the rest density times the volume
+	//it stands for, so overlapping samples along shared edges or where two
+	//surfaces meet do not push harder than a single layer
+	boundaryMass.resize(boundary.size());
+	for(size_t b=0; b<boundary.size(); b++){
+		const CellMap::Cell& home = boundaryGrid.cell(boundaryCell[b]);
+		Scalar sum = 0.0;
+		for(int l=-1; l<=1; l++){
+			for(int m=-1; m<=1; m++){
+				for(int n=-1; n<=1; n++){
+					const CellMap::Cell* c = boundaryGrid.find(home.x + l, home.y + m, home.z + n);
+					if(c == NULL) continue;
+					const int* bucket = boundaryParticles.data() + c->begin;
+					for(unsigned int j=0; j<c->count; j++){
+						sum += kernel(boundary[b] - boundary[bucket[j]], effectiveRadius);
+					}
+				}
+			}
+		}
+		boundaryMass[b] = d_0 / sum;
+	}
+}
 
-		GLfloat beta = glm::determinant(A_beta) / glm::determinant(A);
+template<typename Scalar>
+bool BasicSimulation<Scalar>::addParticle(Vector position, Vector velocity){
+	ghosts = 0;
+	if(N >= capacity) return false;
+
+	x[N] = position;
+	dx[N] = velocity;
+	density[N] = 0.0f;
+	presure[N] = 0.0f;
+	lodLevel[N] = 0;
+	lodWaiting[N] = 0;
+	if(secondaryMetrics){
+		surfaceNormal[N] = Vector(0.0);
+		trappedAir[N] = 0.0f;
+		waveCrest[N] = 0.0f;
+	}
+	N++;
+	version++;
+	return true;
+}
 
-		if (beta < 0 || beta > 1 - gamma) return -1.0; // no hit!
+template<typename Scalar>
+void BasicSimulation<Scalar>::removeParticle(size_t index){
+	ghosts = 0;
+	N--;
+	version++;
+	x[index] = x[N];
+	dx[index] = dx[N];
+	density[index] = density[N];
+	presure[index] = presure[N];
+	lodLevel[index] = lodLevel[N];
+	lodWaiting[index] = lodWaiting[N];
+	if(secondaryMetrics){
+		surfaceNormal[index] = surfaceNormal[N];
+		trappedAir[index] = trappedAir[N];
+		waveCrest[index] = waveCrest[N];
+	}
+}
 
-		return t;
+template<typename Scalar>
+void BasicSimulation<Scalar>::setLevelOfDetail(Scalar distance, int levels){
+	lodDistance = distance;
+	lodLevels = min(max(levels, 0), MAX_LOD_LEVELS);
+	for(size_t i=0; i<N; i++){
+		lodLevel[i] = 0;
+		lodWaiting[i] = 0;
 	}
-	return -1.0;
 }
 
-const int p1 = 73856093;
-const int p2 = 19349663;
-const int p3 = 83492791;
+template<typename Scalar>
+void BasicSimulation<Scalar>::allocateMetrics(){
+	if(surfaceNormal != NULL) return;
+	surfaceNormal = arena.allocate<Vector>(capacity);
+	trappedAir = arena.allocate<Scalar>(capacity);
+	waveCrest = arena.allocate<Scalar>(capacity);
+}
 
-size_t Simulation::hash(glm::vec3 t){
-	return (((p1*(int)(t.x / gridRes)) ^ (p2*(int)(t.y / gridRes)) ^ (p2*(int)(t.z / gridRes))) % htSize + htSize) % htSize;
+template<typename Scalar>
+void BasicSimulation<Scalar>::setSecondaryMetrics(bool enabled){
+	if(enabled == secondaryMetrics) return;
+	secondaryMetrics = enabled;
+	if(!enabled) return;
+
+	//The metrics were not kept up while they were off. Cleared by the
+	//workers so new pages end up on the node of the worker owning them
+	allocateMetrics();
+	parallel(capacity, [this](size_t begin, size_t end, SimulationStats&){
+		fill(surfaceNormal + begin, surfaceNormal + end, Vector(0.0,0.0,0.0));
+		fill(trappedAir + begin, trappedAir + end, Scalar(0.0));
+		fill(waveCrest + begin, waveCrest + end, Scalar(0.0));
+		return (size_t)0;
+	});
 }
 
-void Simulation::hashParticles(){
-	for(int i=0; i<htSize; i++){
-		htBuckets[i] = 0;
+template<typename Scalar>
+bool BasicSimulation<Scalar>::setGhosts(const Vector* positions, const Vector* velocities, size_t count){
+	if(N + count > capacity){
+		ghosts = 0;
+		return false;
 	}
 
-	for(int i=0; i<N; i++){
-		int h = hash(x[i]);
-		ht[h][htBuckets[h]++] = i;
+	for(size_t i=0; i<count; i++){
+		x[N+i] = positions[i];
+		dx[N+i] = velocities[i];
 	}
+	ghosts = count;
+	return true;
 }
 
-glm::vec3 Simulation::getPosition(size_t index){
-	return x[index];
-}
 
-glm::vec3 Simulation::getVelocity(size_t index){
-	return dx[index];
+template<typename Scalar>
+Scalar BasicSimulation<Scalar>::getTrappedAir(size_t index){
+	return secondaryMetrics ? trappedAir[index] : 0.0f;
 }
 
-void Simulation::addPlane(glm::mat4 modelMatrix){
-	Triangle t1;
-	t1.a = glm::vec3(modelMatrix*glm::vec4(-1.0,0.0,-1.0,1.0));
-	t1.c = glm::vec3(modelMatrix*glm::vec4(1.0,0.0,-1.0,1.0));
-	t1.b = glm::vec3(modelMatrix*glm::vec4(1.0,0.0,1.0,1.0));
-
-	Triangle t2;
-	t2.a = glm::vec3(modelMatrix*glm::vec4(-1.0,0.0,-1.0,1.0));
-	t2.c = glm::vec3(modelMatrix*glm::vec4(1.0,0.0,1.0,1.0));
-	t2.b = glm::vec3(modelMatrix*glm::vec4(-1.0,0.0,1.0,1.0));
+template<typename Scalar>
+Scalar BasicSimulation<Scalar>::getWaveCrest(size_t index){
+	return secondaryMetrics ? waveCrest[index] : 0.0f;
+}
 
-	surfaces.push_back(t1);
-	surfaces.push_back(t2);
+template<typename Scalar>
+void BasicSimulation<Scalar>::addPlane(glm::mat4 modelMatrix){
+	Water::addPlane(surfaces, modelMatrix);
 }
+
+template class Water::BasicSimulation<float>;
+template class Water::BasicSimulation<double>;
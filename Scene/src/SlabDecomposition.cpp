@@ -0,0 +1,205 @@
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <cfloat>
+
+#include "SlabDecomposition.h"
+
+using namespace Water;
+using namespace std;
+
+const int HISTOGRAM_BINS = 256;
+
+//Particles travel as a count followed by position and velocity pairs
+static void pack(vector<char>& message, glm::vec3 position, glm::vec3 velocity){
+	if(message.empty()) message.resize(sizeof(uint64_t), 0);
+	size_t at = message.size();
+	message.resize(at + 2*sizeof(glm::vec3));
+	memcpy(&message[at], &position, sizeof(glm::vec3));
+	memcpy(&message[at + sizeof(glm::vec3)], &velocity, sizeof(glm::vec3));
+
+	uint64_t count = (message.size() - sizeof(uint64_t)) / (2*sizeof(glm::vec3));
+	memcpy(&message[0], &count, sizeof(count));
+}
+
+static size_t unpack(const vector<char>& message, vector<glm::vec3>& positions, vector<glm::vec3>& velocities){
+	if(message.size() < sizeof(uint64_t)) return 0;
+	uint64_t count;
+	memcpy(&count, &message[0], sizeof(count));
+
+	const char* p = &message[sizeof(uint64_t)];
+	for(uint64_t i=0; i<count; i++){
+		glm::vec3 position, velocity;
+		memcpy(&position, p, sizeof(glm::vec3));
+		memcpy(&velocity, p + sizeof(glm::vec3), sizeof(glm::vec3));
+		positions.push_back(position);
+		velocities.push_back(velocity);
+		p += 2*sizeof(glm::vec3);
+	}
+	return count;
+}
+
+SlabDecomposition::SlabDecomposition(Simulation& s, Transport& t, GLfloat low, GLfloat high) : sim(s), transport(t){
+	zLow = low;
+	zHigh = high;
+	haloWidth = 0.0;
+	migratedOut = 0;
+	migratedIn = 0;
+
+	int P = transport.size();
+	boundaries.resize(P+1);
+	for(int r=0; r<=P; r++){
+		boundaries[r] = zLow + (zHigh - zLow)*r / P;
+	}
+	boundaries[0] = -FLT_MAX;
+	boundaries[P] = FLT_MAX;
+}
+
+int SlabDecomposition::owner(GLfloat z){
+	int P = transport.size();
+	for(int r=0; r<P-1; r++){
+		if(z < boundaries[r+1]) return r;
+	}
+	return P-1;
+}
+
+void SlabDecomposition::keepOwnParticles(){
+	int me = transport.rank();
+	for(size_t i=sim.getNumberOfParticles(); i-- > 0;){
+		if(owner(sim.getPosition(i).z) != me) sim.removeParticle(i);
+	}
+}
+
+void SlabDecomposition::step(){
+	migrate();
+	exchangeHalos();
+	sim.step();
+}
+
+void SlabDecomposition::migrate(){
+	int me = transport.rank();
+	int P = transport.size();
+
+	vector<vector<char> > out(P);
+	migratedOut = 0;
+	for(size_t i=sim.getNumberOfParticles(); i-- > 0;){
+		glm::vec3 p = sim.getPosition(i);
+		int o = owner(p.z);
+		if(o != me){
+			pack(out[o], p, sim.getVelocity(i));
+			sim.removeParticle(i);
+			migratedOut++;
+		}
+	}
+
+	//Respawned particles can jump across several slabs, so every pair of
+	//ranks exchanges. Pairs are visited in the same order on every rank
+	vector<glm::vec3> positions, velocities;
+	vector<char> in;
+	for(int a=0; a<P; a++)
+	for(int b=a+1; b<P; b++){
+		if(me != a && me != b) continue;
+		int peer = me == a ? b : a;
+		transport.exchange(peer, out[peer], in);
+		unpack(in, positions, velocities);
+	}
+
+	migratedIn = positions.size();
+	for(size_t i=0; i<positions.size(); i++){
+		if(!sim.addParticle(positions[i], velocities[i])){
+			cerr << "Rank " << me << " is full, dropped " << positions.size() - i << " particles" << endl;
+			break;
+		}
+	}
+}
+
+void SlabDecomposition::exchangeHalos(){
+	int me = transport.rank();
+	int P = transport.size();
+	GLfloat width = haloWidth > 0.0f ? haloWidth : 2.0f*sim.getEffectiveRadius();
+
+	vector<char> toLower, toUpper;
+	ParticleView own = sim.positions();
+	ParticleView ownVelocities = sim.velocities();
+	for(size_t i=0; i<own.size; i++){
+		glm::vec3 p = own[i];
+		if(me > 0 && p.z < boundaries[me] + width) pack(toLower, p, ownVelocities[i]);
+		if(me < P-1 && p.z >= boundaries[me+1] - width) pack(toUpper, p, ownVelocities[i]);
+	}
+
+	//Exchange with the lower neighbour first, which is the order of the
+	//pairs (r, r+1) on every rank
+	vector<glm::vec3> positions, velocities;
+	vector<char> in;
+	if(me > 0){
+		transport.exchange(me-1, toLower, in);
+		unpack(in, positions, velocities);
+	}
+	if(me < P-1){
+		transport.exchange(me+1, toUpper, in);
+		unpack(in, positions, velocities);
+	}
+
+	if(!sim.setGhosts(positions.data(), velocities.data(), positions.size())){
+		cerr << "Rank " << me << " has no room for " << positions.size() << " ghosts" << endl;
+	}
+}
+
+void SlabDecomposition::rebalance(GLfloat blend){
+	int me = transport.rank();
+	int P = transport.size();
+
+	vector<uint64_t> histogram(HISTOGRAM_BINS, 0);
+	GLfloat binWidth = (zHigh - zLow) / HISTOGRAM_BINS;
+	ParticleView positions = sim.positions();
+	for(size_t i=0; i<positions.size; i++){
+		int bin = (int)((positions[i].z - zLow) / binWidth);
+		bin = max(0, min(HISTOGRAM_BINS-1, bin));
+		histogram[bin]++;
+	}
+
+	vector<char> message(HISTOGRAM_BINS*sizeof(uint64_t));
+	if(me != 0){
+		memcpy(message.data(), histogram.data(), message.size());
+		transport.send(0, message);
+	}else{
+		for(int r=1; r<P; r++){
+			transport.receive(r, message);
+			const uint64_t* counts = (const uint64_t*)message.data();
+			for(int b=0; b<HISTOGRAM_BINS; b++) histogram[b] += counts[b];
+		}
+
+		uint64_t total = 0;
+		for(int b=0; b<HISTOGRAM_BINS; b++) total += histogram[b];
+
+		//Cut the cumulative histogram into P equal parts, interpolating
+		//linearly inside the bin where a cut falls
+		uint64_t seen = 0;
+		int b = 0;
+		for(int r=1; r<P; r++){
+			double target = (double)total*r / P;
+			while(b < HISTOGRAM_BINS-1 && seen + histogram[b] < target){
+				seen += histogram[b];
+				b++;
+			}
+			double inBin = histogram[b] > 0 ? (target - seen) / histogram[b] : 0.0;
+			GLfloat cut = zLow + (b + (GLfloat)inBin)*binWidth;
+			boundaries[r] += blend*(cut - boundaries[r]);
+		}
+		//Boundaries must stay ordered for owner() to be well defined
+		for(int r=2; r<P; r++){
+			boundaries[r] = max(boundaries[r], boundaries[r-1]);
+		}
+	}
+
+	//Broadcast the new boundaries
+	vector<char> cuts((P+1)*sizeof(GLfloat));
+	if(me == 0){
+		memcpy(cuts.data(), boundaries.data(), cuts.size());
+		for(int r=1; r<P; r++) transport.send(r, cuts);
+	}else{
+		transport.receive(0, cuts);
+		memcpy(boundaries.data(), cuts.data(), cuts.size());
+	}
+}
@@ -15,25 +15,55 @@ using namespace std;
 
 GLfloat const PI = 3.14159265;
 
-Sphere::Sphere(int resolution, GLfloat r){
+Sphere::Sphere(int res, GLfloat r){
 	radius = r;
 
 	glGenBuffers(1, &VBO);
 	glGenVertexArrays(1, &VAO);
 
+	setResolution(res);
+
 	glBindVertexArray(VAO);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
 
-	vector<glm::vec3> sphereVertices = generateSphereVertices(resolution);
-	numberOfVertices = sphereVertices.size();
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*numberOfVertices*3, (GLfloat*)sphereVertices.data(), GL_STATIC_DRAW);
-
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat), (GLvoid*)0);
 	glEnableVertexAttribArray(0);
 
 	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat), (GLvoid*)0);
 	glEnableVertexAttribArray(1);
 	glBindVertexArray(0);
+
+	//Same vertices, plus a position and velocity per instance
+	glGenBuffers(1, &positionVBO);
+	glGenBuffers(1, &velocityVBO);
+	glGenVertexArrays(1, &instancedVAO);
+
+	glBindVertexArray(instancedVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat), (GLvoid*)0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat), (GLvoid*)0);
+	glEnableVertexAttribArray(1);
+
+	glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat), (GLvoid*)0);
+	glEnableVertexAttribArray(2);
+	glVertexAttribDivisor(2, 1);
+
+	glBindBuffer(GL_ARRAY_BUFFER, velocityVBO);
+	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat), (GLvoid*)0);
+	glEnableVertexAttribArray(3);
+	glVertexAttribDivisor(3, 1);
+	glBindVertexArray(0);
+}
+
+void Sphere::setResolution(int res){
+	resolution = res;
+	vector<glm::vec3> sphereVertices = generateSphereVertices(resolution);
+	numberOfVertices = sphereVertices.size();
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*numberOfVertices*3, (GLfloat*)sphereVertices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 vector<glm::vec3> Sphere::generateSphereVertices(int resolution){
@@ -79,3 +109,16 @@ void Sphere::draw(Shader s, glm::vec3 position, glm::vec3 velocity){
 	glDrawArrays(GL_TRIANGLES, 0, numberOfVertices);
 	glBindVertexArray(0);
 }
+
+void Sphere::drawInstanced(Shader s, const glm::vec3* positions, const glm::vec3* velocities, size_t count){
+	if(count == 0) return;
+	s.Use();
+
+	glBindVertexArray(instancedVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*count, positions, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, velocityVBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*count, velocities, GL_STREAM_DRAW);
+	glDrawArraysInstanced(GL_TRIANGLES, 0, numberOfVertices, count);
+	glBindVertexArray(0);
+}
@@ -0,0 +1,236 @@
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "Telemetry.h"
+
+using namespace Water;
+using namespace std;
+
+//Longest a request or the answer to it is waited for, a scraper sends it
+//right after connecting
+static const int REQUEST_TIMEOUT_MS = 1000;
+
+//The frame loop is the only writer, so a load and a store add without a
+//locked instruction
+template<typename T>
+static void add(atomic<T>& counter, T value){
+	counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+Telemetry::Telemetry(){
+	steps = 0;
+	frames = 0;
+	respawns = 0;
+	bounces = 0;
+	neighbors = 0;
+	remoteNeighbors = 0;
+	particles = 0;
+	activeParticles = 0;
+	secondaryParticles = 0;
+	stepSeconds = 0.0;
+	stepSecondsTotal = 0.0;
+	frameSeconds = 0.0;
+	frameSecondsTotal = 0.0;
+	for(int p=0; p<PHASE_COUNT; p++){
+		phaseSeconds[p] = 0.0;
+	}
+	requests = 0;
+	listener = -1;
+	wakeup[0] = wakeup[1] = -1;
+}
+
+Telemetry::~Telemetry(){
+	stop();
+}
+
+bool Telemetry::start(const string& address){
+	stop();
+
+	bool isPort = !address.empty() && address.find_first_not_of("0123456789") == string::npos;
+	if(isPort){
+		listener = socket(AF_INET, SOCK_STREAM, 0);
+		if(listener < 0) return false;
+		int yes = 1;
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+		//Only local scrapers, the metrics are not meant to leave the machine
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(atoi(address.c_str()));
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if(bind(listener, (sockaddr*)&addr, sizeof(addr)) < 0){
+			cerr << "Telemetry: can not bind port " << address << ": " << strerror(errno) << endl;
+			close(listener);
+			listener = -1;
+			return false;
+		}
+	}else{
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if(address.size() >= sizeof(addr.sun_path)) return false;
+		strcpy(addr.sun_path, address.c_str());
+
+		listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(listener < 0) return false;
+		unlink(address.c_str());
+		if(bind(listener, (sockaddr*)&addr, sizeof(addr)) < 0){
+			cerr << "Telemetry: can not bind " << address << ": " << strerror(errno) << endl;
+			close(listener);
+			listener = -1;
+			return false;
+		}
+		socketPath = address;
+	}
+
+	if(listen(listener, 8) < 0 || pipe(wakeup) < 0){
+		stop();
+		return false;
+	}
+	server = thread(&Telemetry::serve, this);
+	return true;
+}
+
+void Telemetry::stop(){
+	if(server.joinable()){
+		char c = 0;
+		if(write(wakeup[1], &c, 1) < 0) {}
+		server.join();
+	}
+	if(listener >= 0) close(listener);
+	for(int i=0; i<2; i++){
+		if(wakeup[i] >= 0) close(wakeup[i]);
+		wakeup[i] = -1;
+	}
+	if(!socketPath.empty()) unlink(socketPath.c_str());
+	listener = -1;
+	socketPath.clear();
+}
+
+bool Telemetry::startFromEnvironment(){
+	const char* address = getenv("WATERSIM_TELEMETRY");
+	if(address == NULL || *address == '\0') return true;
+	if(!start(address)) return false;
+	cout << "Telemetry on " << address << endl;
+	return true;
+}
+
+void Telemetry::recordStep(const SimulationStats& stats, size_t count){
+	add(steps, (uint64_t)1);
+	add(respawns, stats.respawns);
+	add(bounces, stats.bounces);
+	add(neighbors, stats.neighborsVisited);
+	add(remoteNeighbors, stats.remoteNeighbors);
+	add(stepSecondsTotal, stats.stepSeconds);
+	stepSeconds.store(stats.stepSeconds, memory_order_relaxed);
+	for(int p=0; p<PHASE_COUNT; p++){
+		phaseSeconds[p].store(stats.phaseSeconds[p], memory_order_relaxed);
+	}
+	particles.store(count, memory_order_relaxed);
+	activeParticles.store(stats.activeParticles, memory_order_relaxed);
+}
+
+void Telemetry::recordFrame(double seconds){
+	add(frames, (uint64_t)1);
+	add(frameSecondsTotal, seconds);
+	frameSeconds.store(seconds, memory_order_relaxed);
+}
+
+void Telemetry::recordSecondary(size_t count){
+	secondaryParticles.store(count, memory_order_relaxed);
+}
+
+//One request per connection. Whatever is asked for gets the metrics
+void Telemetry::serve(){
+	while(true){
+		pollfd fds[2];
+		fds[0].fd = listener;
+		fds[0].events = POLLIN;
+		fds[1].fd = wakeup[0];
+		fds[1].events = POLLIN;
+		if(poll(fds, 2, -1) < 0){
+			if(errno == EINTR) continue;
+			return;
+		}
+		if(fds[1].revents != 0) return;
+		if((fds[0].revents & POLLIN) == 0) continue;
+
+		int client = accept(listener, NULL, NULL);
+		if(client < 0) continue;
+
+		//A scraper which stops reading only holds up this thread, and
+		//only for so long
+		timeval timeout;
+		timeout.tv_sec = REQUEST_TIMEOUT_MS / 1000;
+		timeout.tv_usec = REQUEST_TIMEOUT_MS % 1000 * 1000;
+		setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		//The request itself is not needed, but it is read so the client
+		//does not see a reset
+		pollfd in;
+		in.fd = client;
+		in.events = POLLIN;
+		char request[4096];
+		if(poll(&in, 1, REQUEST_TIMEOUT_MS) > 0 && recv(client, request, sizeof(request), 0) >= 0){
+			string body = render();
+			stringstream response;
+			response << "HTTP/1.0 200 OK\r\n"
+				<< "Content-Type: text/plain; version=0.0.4\r\n"
+				<< "Content-Length: " << body.size() << "\r\n"
+				<< "Connection: close\r\n\r\n" << body;
+			string bytes = response.str();
+			size_t sent = 0;
+			while(sent < bytes.size()){
+				ssize_t n = send(client, bytes.data() + sent, bytes.size() - sent, MSG_NOSIGNAL);
+				if(n <= 0) break;
+				sent += n;
+			}
+			requests.fetch_add(1, memory_order_relaxed);
+		}
+		close(client);
+	}
+}
+
+static void metric(stringstream& out, const char* name, const char* type, const char* help, double value){
+	out << "# HELP " << name << " " << help << "\n"
+		<< "# TYPE " << name << " " << type << "\n"
+		<< name << " " << value << "\n";
+}
+
+string Telemetry::render(){
+	stringstream out;
+	out.precision(9);
+	metric(out, "watersim_steps_total", "counter", "Simulation steps taken.", steps.load(memory_order_relaxed));
+	metric(out, "watersim_step_seconds", "gauge", "Wall time of the last step.", stepSeconds.load(memory_order_relaxed));
+	metric(out, "watersim_step_seconds_total", "counter", "Wall time of all steps.", stepSecondsTotal.load(memory_order_relaxed));
+
+	out << "# HELP watersim_phase_seconds Wall time of each phase of the last step.\n"
+		<< "# TYPE watersim_phase_seconds gauge\n";
+	for(int p=0; p<PHASE_COUNT; p++){
+		out << "watersim_phase_seconds{phase=\"" << SimulationStats::phaseName(p) << "\"} " << phaseSeconds[p].load(memory_order_relaxed) << "\n";
+	}
+
+	metric(out, "watersim_particles", "gauge", "Fluid particles after the last step.", particles.load(memory_order_relaxed));
+	metric(out, "watersim_active_particles", "gauge", "Particles updated in the last step.", activeParticles.load(memory_order_relaxed));
+	metric(out, "watersim_secondary_particles", "gauge", "Spray, foam and bubble particles.", secondaryParticles.load(memory_order_relaxed));
+	metric(out, "watersim_respawns_total", "counter", "Particles respawned after leaving the domain.", respawns.load(memory_order_relaxed));
+	metric(out, "watersim_bounces_total", "counter", "Collisions with the surfaces.", bounces.load(memory_order_relaxed));
+	metric(out, "watersim_neighbors_total", "counter", "Particle pairs visited by the density and force passes.", neighbors.load(memory_order_relaxed));
+	metric(out, "watersim_remote_neighbors_total", "counter", "Neighbours read from the NUMA node of another worker.", remoteNeighbors.load(memory_order_relaxed));
+	metric(out, "watersim_frames_total", "counter", "Frames displayed.", frames.load(memory_order_relaxed));
+	metric(out, "watersim_frame_seconds", "gauge", "Wall time of the last frame.", frameSeconds.load(memory_order_relaxed));
+	metric(out, "watersim_frame_seconds_total", "counter", "Wall time of all frames.", frameSecondsTotal.load(memory_order_relaxed));
+	return out.str();
+}
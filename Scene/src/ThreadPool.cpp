@@ -0,0 +1,68 @@
+#include "ThreadPool.h"
+
+using namespace Water;
+using namespace std;
+
+ThreadPool::ThreadPool(size_t threads){
+	running = 0;
+	stopping = false;
+
+	if(threads == 0) threads = thread::hardware_concurrency();
+	if(threads == 0) threads = 1;
+
+	for(size_t i=0; i<threads; i++){
+		workers.push_back(thread(&ThreadPool::work, this));
+	}
+}
+
+ThreadPool::~ThreadPool(){
+	{
+		unique_lock<mutex> l(lock);
+		stopping = true;
+	}
+	hasWork.notify_all();
+
+	for(size_t i=0; i<workers.size(); i++){
+		workers[i].join();
+	}
+}
+
+void ThreadPool::submit(function<void()> task){
+	{
+		unique_lock<mutex> l(lock);
+		tasks.push_back(task);
+	}
+	hasWork.notify_one();
+}
+
+void ThreadPool::wait(){
+	unique_lock<mutex> l(lock);
+	while(!tasks.empty() || running > 0){
+		isIdle.wait(l);
+	}
+}
+
+void ThreadPool::work(){
+	while(true){
+		function<void()> task;
+		{
+			unique_lock<mutex> l(lock);
+			while(tasks.empty() && !stopping){
+				hasWork.wait(l);
+			}
+			if(tasks.empty()) return;
+
+			task = tasks.front();
+			tasks.pop_front();
+			running++;
+		}
+
+		task();
+
+		{
+			unique_lock<mutex> l(lock);
+			running--;
+			if(tasks.empty() && running == 0) isIdle.notify_all();
+		}
+	}
+}
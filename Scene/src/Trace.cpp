@@ -0,0 +1,229 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <mutex>
+#include <chrono>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "Trace.h"
+
+using namespace Water;
+using namespace std;
+
+namespace{
+	//One slot of a ring. seq is odd while the slot is being written and
+	//2*index + 2 once event number index is complete, so a reader can tell
+	//a torn or overwritten slot from a valid one
+	struct Event{
+		atomic<const char*> name;
+		atomic<uint64_t> begin;
+		atomic<uint64_t> end;
+		atomic<uint64_t> seq;
+	};
+
+	struct ThreadRing{
+		long tid;
+		string name;
+		atomic<uint64_t> head;
+
+		//Events before first were recorded by the thread which had the
+		//ring before
+		uint64_t first;
+		Event events[Trace::RING_EVENTS];
+	};
+
+	//Rings are registered the first time a thread records and kept when
+	//it exits, so its events can still be written out, until a new thread
+	//takes the ring over from spare
+	mutex registryLock;
+	vector<ThreadRing*> rings;
+	vector<ThreadRing*> spare;
+
+	//The ring of the calling thread and the name it was given, which is
+	//only stored in a ring once the thread records
+	struct LocalRing{
+		ThreadRing* ring = NULL;
+		const char* name = NULL;
+
+		~LocalRing(){
+			if(ring == NULL) return;
+			unique_lock<mutex> l(registryLock);
+			spare.push_back(ring);
+		}
+	};
+	thread_local LocalRing local;
+
+	atomic<bool> recording(false);
+	atomic<uint64_t> startTime(0);
+	int traceCount = 0;
+
+	string environmentPath;
+	uint64_t environmentDeadline = 0;
+
+	ThreadRing* threadRing(){
+		if(local.ring == NULL){
+			unique_lock<mutex> l(registryLock);
+			ThreadRing* r;
+			if(!spare.empty()){
+				r = spare.back();
+				spare.pop_back();
+			}else{
+				r = new ThreadRing();
+				r->head.store(0);
+				for(size_t i=0; i<Trace::RING_EVENTS; i++){
+					r->events[i].seq.store(0);
+				}
+				rings.push_back(r);
+			}
+			r->tid = syscall(SYS_gettid);
+			r->name = local.name != NULL ? local.name : "";
+			r->first = r->head.load();
+			local.ring = r;
+		}
+		return local.ring;
+	}
+
+	void writeString(ostream& out, const string& s){
+		out << '"';
+		for(size_t i=0; i<s.size(); i++){
+			if(s[i] == '"' || s[i] == '\\') out << '\\';
+			out << s[i];
+		}
+		out << '"';
+	}
+}
+
+uint64_t Trace::now(){
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool Trace::isRecording(){
+	return recording.load(memory_order_relaxed);
+}
+
+void Trace::start(){
+	startTime.store(now());
+	recording.store(true);
+}
+
+void Trace::record(const char* name, uint64_t begin, uint64_t end){
+	if(!isRecording()) return;
+
+	ThreadRing* r = threadRing();
+	uint64_t index = r->head.load(memory_order_relaxed);
+	Event& e = r->events[index % RING_EVENTS];
+
+	e.seq.store(2*index + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	e.name.store(name, memory_order_relaxed);
+	e.begin.store(begin, memory_order_relaxed);
+	e.end.store(end, memory_order_relaxed);
+	e.seq.store(2*index + 2, memory_order_release);
+
+	r->head.store(index + 1, memory_order_release);
+}
+
+//Threads which never record do not get a ring. stop() reads the names of
+//all rings while writing a trace
+void Trace::setThreadName(const char* name){
+	local.name = name;
+	if(local.ring == NULL && !isRecording()) return;
+	ThreadRing* r = threadRing();
+	unique_lock<mutex> l(registryLock);
+	r->name = name;
+}
+
+bool Trace::stop(const string& path){
+	recording.store(false);
+	uint64_t from = startTime.load();
+
+	ofstream out(path.c_str());
+	if(!out){
+		cerr << "Trace: could not open " << path << endl;
+		return false;
+	}
+
+	long pid = getpid();
+	out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << endl;
+	out << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << pid << ", \"args\": {\"name\": \"watersim\"}}";
+
+	size_t written = 0;
+	unique_lock<mutex> l(registryLock);
+	for(size_t t=0; t<rings.size(); t++){
+		ThreadRing* r = rings[t];
+		if(!r->name.empty()){
+			out << "," << endl << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+				<< ", \"tid\": " << r->tid << ", \"args\": {\"name\": ";
+			writeString(out, r->name);
+			out << "}}";
+		}
+
+		uint64_t head = r->head.load(memory_order_acquire);
+		uint64_t first = max(r->first, head > RING_EVENTS ? head - RING_EVENTS : 0);
+		for(uint64_t index=first; index<head; index++){
+			Event& e = r->events[index % RING_EVENTS];
+			uint64_t seq = e.seq.load(memory_order_acquire);
+			const char* name = e.name.load(memory_order_relaxed);
+			uint64_t begin = e.begin.load(memory_order_relaxed);
+			uint64_t end = e.end.load(memory_order_relaxed);
+			atomic_thread_fence(memory_order_acquire);
+			if(seq != 2*index + 2 || e.seq.load(memory_order_relaxed) != seq) continue;
+			if(begin < from) continue;
+
+			out << "," << endl << "{\"name\": ";
+			writeString(out, name);
+			out << fixed << setprecision(3)
+				<< ", \"ph\": \"X\", \"pid\": " << pid << ", \"tid\": " << r->tid
+				<< ", \"ts\": " << (begin - from) / 1000.0
+				<< ", \"dur\": " << (end - begin) / 1000.0 << "}";
+			written++;
+		}
+	}
+	out << endl << "]}" << endl;
+
+	cout << "Trace: wrote " << written << " events to " << path << endl;
+	return true;
+}
+
+void Trace::toggle(){
+	if(isRecording()){
+		stringstream ss;
+		ss << "trace" << ++traceCount << ".json";
+		stop(ss.str());
+	}else{
+		cout << "Trace: recording" << endl;
+		start();
+	}
+}
+
+void Trace::startFromEnvironment(){
+	const char* path = getenv("WATERSIM_TRACE");
+	if(path == NULL || path[0] == '\0') return;
+
+	environmentPath = path;
+	const char* seconds = getenv("WATERSIM_TRACE_SECONDS");
+	if(seconds != NULL){
+		environmentDeadline = now() + (uint64_t)(atof(seconds)*1e9);
+	}
+	cout << "Trace: recording to " << environmentPath << endl;
+	start();
+}
+
+void Trace::update(){
+	if(environmentDeadline != 0 && now() >= environmentDeadline){
+		environmentDeadline = 0;
+		if(isRecording()) stop(environmentPath);
+	}
+}
+
+void Trace::shutdown(){
+	if(!isRecording()) return;
+	if(!environmentPath.empty()) stop(environmentPath);
+	else toggle();
+}
@@ -0,0 +1,251 @@
+#include <iostream>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <new>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "Transport.h"
+
+using namespace Water;
+using namespace std;
+
+static void fail(const char* what){
+	perror(what);
+	exit(1);
+}
+
+Transport::Transport(int size){
+	myRank = -1;
+	worldSize = size;
+}
+
+void Transport::exchange(int peer, const vector<char>& out, vector<char>& in){
+	if(myRank < peer){
+		send(peer, out);
+		receive(peer, in);
+	}else{
+		receive(peer, in);
+		send(peer, out);
+	}
+}
+
+//Head and tail count bytes ever written and read, they sit on separate
+//cache lines so the producer and consumer do not share one
+struct ShmTransport::Ring{
+	atomic<uint64_t> head;
+	char padHead[64 - sizeof(atomic<uint64_t>)];
+	atomic<uint64_t> tail;
+	char padTail[64 - sizeof(atomic<uint64_t>)];
+};
+
+ShmTransport::ShmTransport(int size, size_t bytes) : Transport(size){
+	ringBytes = bytes;
+	regionBytes = (size_t)size*size*(sizeof(Ring) + ringBytes);
+
+	//Anonymous shared mappings survive fork, so every rank sees the same rings
+	void* p = mmap(NULL, regionBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED) fail("ShmTransport mmap");
+	region = (char*)p;
+
+	for(int i=0; i<size; i++)
+	for(int j=0; j<size; j++){
+		Ring* r = new (ring(i, j)) Ring;
+		r->head.store(0);
+		r->tail.store(0);
+	}
+}
+
+ShmTransport::~ShmTransport(){
+	munmap(region, regionBytes);
+}
+
+ShmTransport::Ring* ShmTransport::ring(int from, int to){
+	return (Ring*)(region + ((size_t)from*worldSize + to)*(sizeof(Ring) + ringBytes));
+}
+
+void ShmTransport::attach(int rank){
+	myRank = rank;
+}
+
+void ShmTransport::write(Ring* r, const char* data, size_t bytes){
+	char* buffer = (char*)(r + 1);
+	uint64_t head = r->head.load(memory_order_relaxed);
+
+	while(bytes > 0){
+		uint64_t tail = r->tail.load(memory_order_acquire);
+		size_t space = ringBytes - (size_t)(head - tail);
+		if(space == 0){
+			sched_yield();
+			continue;
+		}
+
+		size_t offset = head % ringBytes;
+		size_t n = min(min(space, bytes), ringBytes - offset);
+		memcpy(buffer + offset, data, n);
+
+		head += n;
+		data += n;
+		bytes -= n;
+		r->head.store(head, memory_order_release);
+	}
+}
+
+void ShmTransport::read(Ring* r, char* data, size_t bytes){
+	char* buffer = (char*)(r + 1);
+	uint64_t tail = r->tail.load(memory_order_relaxed);
+
+	while(bytes > 0){
+		uint64_t head = r->head.load(memory_order_acquire);
+		size_t available = (size_t)(head - tail);
+		if(available == 0){
+			sched_yield();
+			continue;
+		}
+
+		size_t offset = tail % ringBytes;
+		size_t n = min(min(available, bytes), ringBytes - offset);
+		memcpy(data, buffer + offset, n);
+
+		tail += n;
+		data += n;
+		bytes -= n;
+		r->tail.store(tail, memory_order_release);
+	}
+}
+
+void ShmTransport::send(int peer, const vector<char>& message){
+	Ring* r = ring(myRank, peer);
+	uint64_t length = message.size();
+	write(r, (const char*)&length, sizeof(length));
+	write(r, message.data(), message.size());
+}
+
+void ShmTransport::receive(int peer, vector<char>& message){
+	Ring* r = ring(peer, myRank);
+	uint64_t length;
+	read(r, (char*)&length, sizeof(length));
+	message.resize(length);
+	read(r, message.data(), length);
+}
+
+TcpTransport::TcpTransport(int size) : Transport(size){
+	for(int i=0; i<size; i++){
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if(fd < 0) fail("TcpTransport socket");
+
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = 0;
+		if(bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) fail("TcpTransport bind");
+		if(listen(fd, size) < 0) fail("TcpTransport listen");
+
+		socklen_t len = sizeof(addr);
+		getsockname(fd, (sockaddr*)&addr, &len);
+
+		listeners.push_back(fd);
+		ports.push_back(ntohs(addr.sin_port));
+	}
+}
+
+TcpTransport::~TcpTransport(){
+	for(size_t i=0; i<listeners.size(); i++){
+		if(listeners[i] >= 0) close(listeners[i]);
+	}
+	for(size_t i=0; i<peers.size(); i++){
+		if(peers[i] >= 0) close(peers[i]);
+	}
+}
+
+void TcpTransport::attach(int rank){
+	myRank = rank;
+	peers.assign(worldSize, -1);
+
+	for(int i=0; i<worldSize; i++){
+		if(i != rank){
+			close(listeners[i]);
+			listeners[i] = -1;
+		}
+	}
+
+	//Connect to every lower rank, the listen backlog holds the connection
+	//until that rank gets around to accepting it
+	for(int i=0; i<rank; i++){
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if(fd < 0) fail("TcpTransport socket");
+
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(ports[i]);
+		if(connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) fail("TcpTransport connect");
+
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		int32_t id = rank;
+		write(fd, (const char*)&id, sizeof(id));
+		peers[i] = fd;
+	}
+
+	//Accept every higher rank, they say who they are first
+	for(int i=rank+1; i<worldSize; i++){
+		int fd = accept(listeners[rank], NULL, NULL);
+		if(fd < 0) fail("TcpTransport accept");
+
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		int32_t id;
+		read(fd, (char*)&id, sizeof(id));
+		if(id <= rank || id >= worldSize){
+			cerr << "TcpTransport: unexpected peer " << id << endl;
+			exit(1);
+		}
+		peers[id] = fd;
+	}
+
+	close(listeners[rank]);
+	listeners[rank] = -1;
+}
+
+void TcpTransport::write(int fd, const char* data, size_t bytes){
+	while(bytes > 0){
+		ssize_t n = ::send(fd, data, bytes, 0);
+		if(n < 0) fail("TcpTransport send");
+		data += n;
+		bytes -= n;
+	}
+}
+
+void TcpTransport::read(int fd, char* data, size_t bytes){
+	while(bytes > 0){
+		ssize_t n = ::recv(fd, data, bytes, 0);
+		if(n <= 0) fail("TcpTransport recv");
+		data += n;
+		bytes -= n;
+	}
+}
+
+void TcpTransport::send(int peer, const vector<char>& message){
+	uint64_t length = message.size();
+	write(peers[peer], (const char*)&length, sizeof(length));
+	write(peers[peer], message.data(), message.size());
+}
+
+void TcpTransport::receive(int peer, vector<char>& message){
+	uint64_t length;
+	read(peers[peer], (char*)&length, sizeof(length));
+	message.resize(length);
+	read(peers[peer], message.data(), length);
+}
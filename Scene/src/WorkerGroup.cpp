@@ -0,0 +1,85 @@
+#include "WorkerGroup.h"
+#include "Trace.h"
+
+using namespace Water;
+using namespace std;
+
+WorkerGroup::WorkerGroup(size_t threads, const NumaTopology* t){
+	task = NULL;
+	generation = 0;
+	pending = 0;
+	pinned = 0;
+	stopping = false;
+	pin = t != NULL;
+	if(pin) topology = *t;
+
+	if(threads == 0) threads = 1;
+	for(size_t w=0; w<threads; w++){
+		nodes.push_back(pin ? w*topology.nodes() / threads : 0);
+	}
+	for(size_t w=0; w<threads; w++){
+		workers.push_back(thread(&WorkerGroup::work, this, w));
+	}
+
+	//Workers pin themselves before they take their first task, so after
+	//this every worker is on its node
+	run([](size_t){});
+}
+
+WorkerGroup::~WorkerGroup(){
+	{
+		unique_lock<mutex> l(lock);
+		stopping = true;
+	}
+	started.notify_all();
+
+	for(size_t w=0; w<workers.size(); w++){
+		workers[w].join();
+	}
+}
+
+void WorkerGroup::run(const function<void(size_t)>& f){
+	unique_lock<mutex> l(lock);
+	task = &f;
+	pending = workers.size();
+	generation++;
+	started.notify_all();
+	while(pending > 0){
+		finished.wait(l);
+	}
+	task = NULL;
+}
+
+size_t WorkerGroup::getPinned(){
+	unique_lock<mutex> l(lock);
+	return pinned;
+}
+
+void WorkerGroup::work(size_t worker){
+	Trace::setThreadName("worker");
+	if(pin && pinToNode(topology, nodes[worker])){
+		unique_lock<mutex> l(lock);
+		pinned++;
+	}
+
+	uint64_t seen = 0;
+	while(true){
+		const function<void(size_t)>* f;
+		{
+			unique_lock<mutex> l(lock);
+			while(generation == seen && !stopping){
+				started.wait(l);
+			}
+			if(stopping) return;
+			seen = generation;
+			f = task;
+		}
+
+		(*f)(worker);
+
+		{
+			unique_lock<mutex> l(lock);
+			if(--pending == 0) finished.notify_one();
+		}
+	}
+}
@@ -0,0 +1,88 @@
+// Attaches to the frame ring of a running simulation and reads every frame
+// in place, an example consumer which only needs read access.
+//
+// Usage: watersim-attach name [-f frames]
+// name is the ring given to watersim-headless --publish. Runs until frames
+// frames were read or the simulation exits, then prints how many frames
+// were read, skipped because the reader fell behind and found overwritten
+// while being read.
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "FrameRing.h"
+
+using namespace Water;
+using namespace std;
+
+int main(int argc, char** argv){
+	string name = "";
+	long frames = -1;
+	for(int i=1; i<argc; i++){
+		bool hasValue = i+1 < argc;
+		if(!strcmp(argv[i], "-f") && hasValue) frames = atol(argv[++i]);
+		else if(name.empty() && argv[i][0] != '-') name = argv[i];
+		else{
+			cerr << "Unknown or incomplete argument " << argv[i] << endl;
+			return 1;
+		}
+	}
+	if(name.empty()){
+		cerr << "Usage: watersim-attach name [-f frames]" << endl;
+		return 1;
+	}
+
+	FrameRingReader ring;
+	if(!ring.attach(name)){
+		cerr << "No frame ring " << name << endl;
+		return 1;
+	}
+	cout << "Attached to " << name << ", " << ring.getCapacity() << " particles per frame" << endl;
+
+	long read = 0;
+	uint64_t skipped = 0;
+	uint64_t torn = 0;
+	uint64_t last = 0;
+	bool first = true;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	while(frames < 0 || read < frames){
+		FrameRingFrame frame;
+		if(!ring.latest(frame) || (!first && frame.frame == last)){
+			if(!ring.isProducerAlive()) break;
+			this_thread::sleep_for(chrono::microseconds(200));
+			continue;
+		}
+		if(!first) skipped += frame.frame - last - 1;
+		first = false;
+		last = frame.frame;
+
+		//Read in place, then make sure the producer did not overwrite it
+		double height = 0.0;
+		float fastest = 0.0;
+		for(size_t i=0; i<frame.particles; i++){
+			height += frame.positions[i].y;
+			fastest = max(fastest, glm::length(frame.velocities[i]));
+		}
+		if(!ring.isIntact(frame)){
+			torn++;
+			continue;
+		}
+		read++;
+
+		if(read % 100 == 0){
+			cout << "Frame " << frame.frame << ", step " << frame.step << ": " << frame.particles << " particles, mean height "
+				<< height / max(frame.particles, (size_t)1) << ", fastest " << fastest << endl;
+		}
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cout << "Read " << read << " frames in " << seconds << " s, skipped " << skipped << ", overwritten while reading " << torn << endl;
+	return 0;
+}
@@ -0,0 +1,178 @@
+// Runs many independent simulations of the waterfall scene concurrently
+// without a window, one per combination of the swept parameters.
+//
+// Usage: watersim-batch [-n particles] [-f frames] [-j threads] [-o file.csv]
+//                       [--v list] [--k list] [--d_0 list] [--radius list]
+//                       [--seed s] [--huge]
+// where list is a comma separated list of values, e.g. --k 1.0,3.0,5.0
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "Simulation.h"
+#include "SceneSetup.h"
+#include "ThreadPool.h"
+
+using namespace Water;
+using namespace std;
+
+struct Instance{
+	SimulationParameters params;
+
+	//Metrics, filled in when the run finishes
+	double seconds = 0.0;
+	double stepsPerSecond = 0.0;
+	double meanSpeed = 0.0;
+	double maxSpeed = 0.0;
+	double kineticEnergy = 0.0;
+	double meanHeight = 0.0;
+	double poolFraction = 0.0;
+	size_t invalid = 0;
+};
+
+static vector<GLfloat> parseList(const char* s){
+	vector<GLfloat> res;
+	stringstream ss(s);
+	string item;
+	while(getline(ss, item, ',')){
+		if(!item.empty()) res.push_back(atof(item.c_str()));
+	}
+	return res;
+}
+
+static void run(Instance& inst, size_t particles, int frames, bool hugePages){
+	Simulation sim(particles, inst.params, hugePages);
+	addWaterfallPlanes(sim);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(int f=0; f<frames; f++){
+		sim.step();
+	}
+	chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+	inst.seconds = chrono::duration<double>(end - start).count();
+	inst.stepsPerSecond = frames / inst.seconds;
+
+	ParticleView positions = sim.positions();
+	ParticleView velocities = sim.velocities();
+	size_t n = positions.size;
+	size_t valid = 0;
+	size_t inPool = 0;
+	for(size_t i=0; i<n; i++){
+		glm::vec3 p = positions[i];
+		glm::vec3 u = velocities[i];
+		GLfloat speed = glm::length(u);
+		if(!std::isfinite(speed) || !std::isfinite(p.y)){
+			inst.invalid++;
+			continue;
+		}
+		valid++;
+		inst.meanSpeed += speed;
+		inst.maxSpeed = max(inst.maxSpeed, (double)speed);
+		inst.kineticEnergy += 0.5*inst.params.pm*speed*speed;
+		inst.meanHeight += p.y;
+		if(p.y < -3.5) inPool++;
+	}
+	if(valid > 0){
+		inst.meanSpeed /= valid;
+		inst.meanHeight /= valid;
+		inst.poolFraction = (double)inPool / valid;
+	}
+}
+
+int main(int argc, char** argv){
+	size_t particles = WATERFALL_PARTICLES;
+	int frames = 500;
+	size_t threads = 0;
+	string output = "batch.csv";
+	unsigned int seed = 1;
+	bool hugePages = false;
+
+	SimulationParameters defaults;
+	vector<GLfloat> vs(1, defaults.v);
+	vector<GLfloat> ks(1, defaults.k);
+	vector<GLfloat> d0s(1, defaults.d_0);
+	vector<GLfloat> radii(1, defaults.effectiveRadius);
+
+	for(int i=1; i<argc; i++){
+		bool hasValue = i+1 < argc;
+		if(!strcmp(argv[i], "-n") && hasValue) particles = atol(argv[++i]);
+		else if(!strcmp(argv[i], "-f") && hasValue) frames = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-j") && hasValue) threads = atol(argv[++i]);
+		else if(!strcmp(argv[i], "-o") && hasValue) output = argv[++i];
+		else if(!strcmp(argv[i], "--v") && hasValue) vs = parseList(argv[++i]);
+		else if(!strcmp(argv[i], "--k") && hasValue) ks = parseList(argv[++i]);
+		else if(!strcmp(argv[i], "--d_0") && hasValue) d0s = parseList(argv[++i]);
+		else if(!strcmp(argv[i], "--radius") && hasValue) radii = parseList(argv[++i]);
+		else if(!strcmp(argv[i], "--seed") && hasValue) seed = atol(argv[++i]);
+		else if(!strcmp(argv[i], "--huge")) hugePages = true;
+		else{
+			cerr << "Unknown or incomplete argument " << argv[i] << endl;
+			return 1;
+		}
+	}
+
+	vector<Instance> instances;
+	for(size_t a=0; a<vs.size(); a++)
+	for(size_t b=0; b<ks.size(); b++)
+	for(size_t c=0; c<d0s.size(); c++)
+	for(size_t d=0; d<radii.size(); d++){
+		Instance inst;
+		inst.params.v = vs[a];
+		inst.params.k = ks[b];
+		inst.params.d_0 = d0s[c];
+		inst.params.effectiveRadius = radii[d];
+		inst.params.seed = seed + instances.size();
+		instances.push_back(inst);
+	}
+
+	ThreadPool pool(threads);
+	cerr << "Running " << instances.size() << " simulations of " << particles << " particles for "
+		<< frames << " frames on " << pool.size() << " threads" << endl;
+
+	mutex logLock;
+	size_t done = 0;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(size_t i=0; i<instances.size(); i++){
+		Instance* inst = &instances[i];
+		pool.submit([inst, i, particles, frames, hugePages, &logLock, &done, &instances](){
+			run(*inst, particles, frames, hugePages);
+
+			unique_lock<mutex> l(logLock);
+			done++;
+			cerr << "[" << done << "/" << instances.size() << "] instance " << i
+				<< ": " << inst->stepsPerSecond << " steps/s" << endl;
+		});
+	}
+	pool.wait();
+	double total = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	ofstream out(output.c_str());
+	if(!out){
+		cerr << "Could not open " << output << endl;
+		return 1;
+	}
+	out << "instance,v,k,d_0,effectiveRadius,seed,particles,frames,seconds,steps_per_second,"
+		<< "mean_speed,max_speed,kinetic_energy,mean_height,pool_fraction,invalid" << endl;
+	for(size_t i=0; i<instances.size(); i++){
+		Instance& inst = instances[i];
+		out << i << "," << inst.params.v << "," << inst.params.k << "," << inst.params.d_0 << ","
+			<< inst.params.effectiveRadius << "," << inst.params.seed << "," << particles << ","
+			<< frames << "," << inst.seconds << "," << inst.stepsPerSecond << ","
+			<< inst.meanSpeed << "," << inst.maxSpeed << "," << inst.kineticEnergy << ","
+			<< inst.meanHeight << "," << inst.poolFraction << "," << inst.invalid << endl;
+	}
+
+	cerr << "Finished in " << total << " s, "
+		<< instances.size()*(double)particles*frames / total << " particle steps/s, wrote " << output << endl;
+	return 0;
+}
@@ -0,0 +1,281 @@
+// Microbenchmarks of the simulation hot paths on the waterfall scene.
+//
+// Usage: watersim-bench [-n list] [--min-time s] [--sample n] [--filter name] [-o file.json]
+// where list is a comma separated list of particle counts, by default
+// 1000,10000,100000,1000000. Passes that are quadratic in the local particle
+// density only run over a sample of at most --sample particles, the per
+// particle figures are unaffected by this. The density and force samples
+// are taken from the middle of the lattice, the collision samples from its
+// lowest layers, which are the ones among the collision planes.
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+#include "Simulation.h"
+#include "SceneSetup.h"
+#include "Kernels.h"
+
+using namespace Water;
+using namespace std;
+
+//Spacing of the initial lattice, close to the rest spacing of the waterfall
+const GLfloat SPACING = 0.3;
+
+struct Result{
+	string name;
+	size_t particles;
+	size_t sampled;
+	size_t iterations;
+	double seconds;
+	double items;
+	double pairs;
+};
+
+//Results of the timed loops are written here so they are not optimised away
+static volatile GLfloat sink = 0.0;
+
+typedef chrono::steady_clock Clock;
+
+static double since(Clock::time_point start){
+	return chrono::duration<double>(Clock::now() - start).count();
+}
+
+static GLfloat uniform(unsigned int& state){
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return (state % 1000000) / 1000000.0f;
+}
+
+namespace Water{
+	//Has access to the private phases of Simulation
+	class Benchmark{
+		public:
+			//Fills sim with a jittered lattice over the floor of the scene,
+			//stacked upwards until n particles are placed, falling towards the pool
+			static void fill(Simulation& sim, size_t n){
+				unsigned int state = 12345;
+				int nx = (int)(7.8 / SPACING);
+				int nz = (int)(17.8 / SPACING);
+				for(size_t i=0; i<n; i++){
+					int layer = i / (nx*nz);
+					int a = (i / nz) % nx;
+					int b = i % nz;
+					glm::vec3 p(-1.9 + a*SPACING, -3.9 + layer*SPACING, -7.9 + b*SPACING);
+					p += 0.05f*glm::vec3(uniform(state), uniform(state), uniform(state));
+					glm::vec3 u(uniform(state) - 0.5f, -2.0f*uniform(state), 1.7f*uniform(state));
+					sim.addParticle(p, u);
+				}
+
+				//The force pass reads density and presure of every neighbour
+				for(size_t i=0; i<n; i++){
+					sim.density[i] = sim.d_0;
+					sim.presure[i] = sim.p_0;
+				}
+			}
+
+			static void hash(Simulation& sim){ sim.hashParticles(); }
+			static size_t density(Simulation& sim, size_t begin, size_t end){
+				SimulationStats counters;
+				return sim.computeDensity(begin, end, counters);
+			}
+			static size_t forces(Simulation& sim, size_t begin, size_t end){
+				SimulationStats counters;
+				return sim.computeForces(begin, end, counters);
+			}
+
+			static size_t findCollision(Simulation& sim, size_t begin, size_t end){
+				for(size_t i=begin; i<end; i++){
+					glm::vec3 d = sim.dt*sim.dx[i];
+					for(size_t j=0; j<sim.surfaces.size(); j++){
+						sink = sink + sim.findCollision(i, sim.surfaces[j], d);
+					}
+				}
+				return (end - begin)*sim.surfaces.size();
+			}
+
+			//Moves particles through the collision surfaces and puts them back
+			static size_t collideAndMove(Simulation& sim, size_t begin, size_t end){
+				size_t tests = 0;
+				SimulationStats counters;
+				for(size_t i=begin; i<end; i++){
+					glm::vec3 x = sim.x[i];
+					glm::vec3 dx = sim.dx[i];
+					glm::vec3 d = sim.dt*dx;
+					tests += sim.surfaces.size();
+					while(sim.collideAndMove(i, d, counters)) tests += sim.surfaces.size();
+					sim.x[i] = x;
+					sim.dx[i] = dx;
+				}
+				return tests;
+			}
+	};
+}
+
+//Runs f until minTime has passed, f returns the number of pairs it visited
+template<typename F>
+static Result measure(const string& name, size_t particles, size_t sampled, double minTime, F f){
+	Result r;
+	r.name = name;
+	r.particles = particles;
+	r.sampled = sampled;
+	r.iterations = 0;
+	r.pairs = 0.0;
+
+	Clock::time_point start = Clock::now();
+	do{
+		r.pairs += f();
+		r.iterations++;
+	}while(since(start) < minTime);
+	r.seconds = since(start);
+	r.items = (double)r.iterations*sampled;
+	return r;
+}
+
+static vector<size_t> parseList(const char* s){
+	vector<size_t> res;
+	stringstream ss(s);
+	string item;
+	while(getline(ss, item, ',')){
+		if(!item.empty()) res.push_back(atol(item.c_str()));
+	}
+	return res;
+}
+
+static void writeJson(ostream& out, const vector<Result>& results, double minTime, size_t sample){
+	out << "{" << endl;
+	out << "  \"context\": {\"min_time\": " << minTime << ", \"max_sample\": " << sample << "}," << endl;
+	out << "  \"benchmarks\": [" << endl;
+	for(size_t i=0; i<results.size(); i++){
+		const Result& r = results[i];
+		out << "    {\"name\": \"" << r.name << "\", \"particles\": " << r.particles
+			<< ", \"sampled\": " << r.sampled << ", \"iterations\": " << r.iterations
+			<< ", \"seconds\": " << r.seconds
+			<< ", \"ns_per_particle\": " << 1e9*r.seconds / r.items
+			<< ", \"pairs_per_second\": " << r.pairs / r.seconds << "}"
+			<< (i+1 < results.size() ? "," : "") << endl;
+	}
+	out << "  ]" << endl;
+	out << "}" << endl;
+}
+
+int main(int argc, char** argv){
+	vector<size_t> sizes;
+	sizes.push_back(1000);
+	sizes.push_back(10000);
+	sizes.push_back(100000);
+	sizes.push_back(1000000);
+	double minTime = 0.5;
+	size_t sample = 20000;
+	string filter = "";
+	string output = "";
+
+	for(int i=1; i<argc; i++){
+		bool hasValue = i+1 < argc;
+		if(!strcmp(argv[i], "-n") && hasValue) sizes = parseList(argv[++i]);
+		else if(!strcmp(argv[i], "--min-time") && hasValue) minTime = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--sample") && hasValue) sample = atol(argv[++i]);
+		else if(!strcmp(argv[i], "--filter") && hasValue) filter = argv[++i];
+		else if(!strcmp(argv[i], "-o") && hasValue) output = argv[++i];
+		else{
+			cerr << "Unknown or incomplete argument " << argv[i] << endl;
+			return 1;
+		}
+	}
+
+	vector<Result> results;
+	for(size_t s=0; s<sizes.size(); s++){
+		size_t n = sizes[s];
+		size_t m = min(n, sample);
+		size_t begin = n/2 - m/2;
+		size_t end = begin + m;
+
+		//The lattice fills the floor of the scene layer by layer, in the
+		//large runs the middle is far above every plane and the tests there
+		//would all be rejected by their first check
+		size_t lowest = m;
+
+		SimulationParameters params;
+		params.capacity = n;
+		Simulation sim(0, params);
+		addWaterfallPlanes(sim);
+		Benchmark::fill(sim, n);
+		Benchmark::hash(sim);
+
+		vector<glm::vec3> r(n);
+		unsigned int state = 777;
+		GLfloat r_e = sim.getEffectiveRadius();
+		for(size_t i=0; i<n; i++){
+			r[i] = 1.2f*r_e*(glm::vec3(uniform(state), uniform(state), uniform(state)) - 0.5f);
+		}
+
+		vector<Result> sized;
+		#define RUN(name, count, body) \
+			if(filter.empty() || string(name).find(filter) != string::npos) \
+				sized.push_back(measure(name, n, count, minTime, [&]() -> double { body }))
+
+		RUN("kernel", n, {
+			GLfloat sum = 0.0;
+			for(size_t i=0; i<n; i++) sum += kernel(r[i], r_e);
+			sink = sum;
+			return n;
+		});
+		RUN("presurekernel", n, {
+			glm::vec3 sum(0.0);
+			for(size_t i=0; i<n; i++) sum += presurekernel(r[i], r_e);
+			sink = sum.x + sum.y + sum.z;
+			return n;
+		});
+		RUN("viscositykernel", n, {
+			GLfloat sum = 0.0;
+			for(size_t i=0; i<n; i++) sum += viscositykernel(r[i], r_e);
+			sink = sum;
+			return n;
+		});
+		RUN("hashParticles", n, {
+			Benchmark::hash(sim);
+			return 0;
+		});
+		RUN("density", m, {
+			return Benchmark::density(sim, begin, end);
+		});
+		RUN("forces", m, {
+			return Benchmark::forces(sim, begin, end);
+		});
+		RUN("findCollision", m, {
+			return Benchmark::findCollision(sim, 0, lowest);
+		});
+		RUN("collideAndMove", m, {
+			return Benchmark::collideAndMove(sim, 0, lowest);
+		});
+		#undef RUN
+
+		for(size_t i=0; i<sized.size(); i++){
+			const Result& res = sized[i];
+			cerr << left << setw(16) << res.name << " N=" << setw(8) << res.particles
+				<< right << setw(12) << fixed << setprecision(1) << 1e9*res.seconds / res.items << " ns/particle"
+				<< setw(14) << scientific << setprecision(3) << res.pairs / res.seconds << " pairs/s" << endl;
+			results.push_back(res);
+		}
+	}
+
+	if(output.empty()){
+		writeJson(cout, results, minTime, sample);
+	}else{
+		ofstream out(output.c_str());
+		if(!out){
+			cerr << "Could not open " << output << endl;
+			return 1;
+		}
+		writeJson(out, results, minTime, sample);
+	}
+	return 0;
+}
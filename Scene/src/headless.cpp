@@ -0,0 +1,352 @@
+// Steps the waterfall scene without a window or an OpenGL context and
+// reports how fast it runs.
+//
+// Usage: watersim-headless [-n particles] [-f frames] [--huge]
+//                           [--load file] [--save file] [--checkpoint-every frames]
+//                           [--cache file] [--compact] [--boundary] [--secondary]
+//                           [--lod distance] [--publish name] [-j threads] [--numa]
+//                           [--pool] [--flip]
+// --load starts from a checkpoint instead of the initial lattice, --save
+// writes one at the end and --checkpoint-every also writes it periodically
+// in the background while stepping. --cache writes every frame to a particle
+// cache for offline rendering and playback. --compact steps a
+// CompactSimulation instead and reports the memory it takes per particle.
+// --boundary replaces the triangle collision pass with boundary particles,
+// which are sampled before stepping and reported separately.
+// --secondary also updates a layer of spray, foam and bubble particles.
+// --lod updates particles further than distance from the viewer's starting
+// camera position less often. --publish writes every step into the shared
+// memory frame ring name, which watersim-attach and other processes can read.
+// -j splits the passes over worker threads, --numa pins them to the NUMA
+// nodes, places the particles on the nodes of their workers and reports how
+// many neighbours were read from another node. --pool replaces the
+// particles in the plunge pool with a shallow water heightfield. --flip
+// steps a FlipSimulation and then Simulation on the same scene with the same
+// particles and workers, and compares them.
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include "Simulation.h"
+#include "CompactSimulation.h"
+#include "FlipSimulation.h"
+#include "SecondaryParticles.h"
+#include "ShallowWater.h"
+#include "SceneSetup.h"
+#include "Trace.h"
+#include "Checkpoint.h"
+#include "ParticleCache.h"
+#include "Telemetry.h"
+#include "FrameRing.h"
+
+using namespace Water;
+using namespace std;
+
+//Steps the compact representation and reports speed and memory
+static int runCompact(size_t particles, int frames, bool hugePages){
+	CompactSimulation watersim(particles, SimulationParameters(), hugePages);
+	addWaterfallPlanes(watersim);
+
+	cout << "Stepping " << particles << " compact particles for " << frames << " frames" << endl;
+
+	double total = 0.0;
+	double phaseTotal[PHASE_COUNT] = {};
+	size_t peakBytes = 0;
+	for(int f=0; f<frames; f++){
+		Trace::update();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		watersim.step();
+		total += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		const SimulationStats& stats = watersim.stats();
+		for(int p=0; p<PHASE_COUNT; p++){
+			phaseTotal[p] += stats.phaseSeconds[p];
+		}
+		peakBytes = max(peakBytes, watersim.memoryBytes());
+
+		if((f+1) % 100 == 0){
+			cout << "Frame " << f+1 << ": " << (f+1) / total << " steps/s" << endl;
+		}
+	}
+
+	cout << "Total " << total << " s" << endl;
+	cout << "Phase ms:";
+	for(int p=0; p<PHASE_COUNT; p++){
+		cout << " " << SimulationStats::phaseName(p) << " " << 1000.0*phaseTotal[p] / frames;
+	}
+	cout << endl;
+	cout << "Throughput: " << frames / total << " steps/s, " << particles*(double)frames / total << " particle steps/s" << endl;
+	cout << "Memory: " << peakBytes / (1024.0*1024.0) << " MB, " << peakBytes / (double)particles << " bytes/particle" << endl;
+
+	Trace::shutdown();
+	return 0;
+}
+
+//Steps sim for frames and prints the time of its phases. Returns the wall
+//time of the steps
+template<typename Solver>
+static double measure(Solver& sim, int frames, const char* name){
+	double total = 0.0;
+	double phaseTotal[PHASE_COUNT] = {};
+	double respawns = 0.0;
+	for(int f=0; f<frames; f++){
+		Trace::update();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		sim.step();
+		total += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		const SimulationStats& stats = sim.stats();
+		for(int p=0; p<PHASE_COUNT; p++){
+			phaseTotal[p] += stats.phaseSeconds[p];
+		}
+		respawns += stats.respawns;
+	}
+
+	cout << name << ": " << 1000.0*total / frames << " ms/step, " << sim.getNumberOfParticles()*(double)frames / total
+		<< " particle steps/s, " << respawns / frames << " respawns/step" << endl;
+	cout << name << " phase ms:";
+	for(int p=0; p<PHASE_COUNT; p++){
+		cout << " " << SimulationStats::phaseName(p) << " " << 1000.0*phaseTotal[p] / frames;
+	}
+	cout << endl;
+	return total;
+}
+
+//Steps the grid solver and then the SPH solver on the waterfall
+static int runFlip(size_t particles, int frames, const SimulationParameters& params){
+	cout << "Stepping " << particles << " particles for " << frames << " frames with FLIP and SPH" << endl;
+
+	FlipSimulation flip(particles, params);
+	addWaterfallPlanes(flip);
+	double flipSeconds = measure(flip, frames, "FLIP");
+	cout << "FLIP grid: " << flip.getActiveTiles() << " tiles (" << flip.getResidentTiles() << " with a grid), " << flip.getFluidCells() << " water cells, "
+		<< flip.getPressureIterations() << " pressure iterations in the last step, "
+		<< flip.memoryBytes() / (1024.0*1024.0) << " MB" << endl;
+
+	Simulation sph(particles, params);
+	addWaterfallPlanes(sph);
+	double sphSeconds = measure(sph, frames, "SPH");
+
+	cout << "FLIP takes " << flipSeconds / sphSeconds << "x the time of SPH" << endl;
+
+	Trace::shutdown();
+	return 0;
+}
+
+int main(int argc, char** argv){
+	size_t particles = WATERFALL_PARTICLES;
+	int frames = 1000;
+	bool hugePages = false;
+	string loadPath = "";
+	string savePath = "";
+	int checkpointEvery = 0;
+	string cachePath = "";
+	string publishName = "";
+	bool compact = false;
+	bool usePool = false;
+	bool useFlip = false;
+	SimulationParameters params;
+
+	for(int i=1; i<argc; i++){
+		bool hasValue = i+1 < argc;
+		if(!strcmp(argv[i], "-n") && hasValue) particles = atol(argv[++i]);
+		else if(!strcmp(argv[i], "-f") && hasValue) frames = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--huge")) hugePages = true;
+		else if(!strcmp(argv[i], "--load") && hasValue) loadPath = argv[++i];
+		else if(!strcmp(argv[i], "--save") && hasValue) savePath = argv[++i];
+		else if(!strcmp(argv[i], "--checkpoint-every") && hasValue) checkpointEvery = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--cache") && hasValue) cachePath = argv[++i];
+		else if(!strcmp(argv[i], "--compact")) compact = true;
+		else if(!strcmp(argv[i], "--boundary")) params.boundaryParticles = true;
+		else if(!strcmp(argv[i], "--secondary")) params.secondaryMetrics = true;
+		else if(!strcmp(argv[i], "--lod") && hasValue) params.lodDistance = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--publish") && hasValue) publishName = argv[++i];
+		else if(!strcmp(argv[i], "-j") && hasValue) params.threads = max(atoi(argv[++i]), 1);
+		else if(!strcmp(argv[i], "--numa")) params.numa = true;
+		else if(!strcmp(argv[i], "--pool")) usePool = true;
+		else if(!strcmp(argv[i], "--flip")) useFlip = true;
+		else{
+			cerr << "Unknown or incomplete argument " << argv[i] << endl;
+			return 1;
+		}
+	}
+
+	Trace::setThreadName("main");
+	Trace::startFromEnvironment();
+
+	if(compact){
+		if(!loadPath.empty() || !savePath.empty() || !cachePath.empty() || params.boundaryParticles || params.secondaryMetrics || params.lodDistance > 0.0f || !publishName.empty() || params.threads > 1 || usePool || useFlip){
+			cerr << "--compact can not be combined with checkpoints, caches, boundary or secondary particles, --lod, --publish, -j, --pool or --flip" << endl;
+			return 1;
+		}
+		return runCompact(particles, frames, hugePages);
+	}
+	if(useFlip){
+		if(!loadPath.empty() || !savePath.empty() || !cachePath.empty() || params.boundaryParticles || params.secondaryMetrics || params.lodDistance > 0.0f || !publishName.empty() || params.numa || usePool){
+			cerr << "--flip can not be combined with checkpoints, caches, boundary or secondary particles, --lod, --publish, --numa or --pool" << endl;
+			return 1;
+		}
+		return runFlip(particles, frames, params);
+	}
+
+	Telemetry telemetry;
+	if(!telemetry.startFromEnvironment()) return 1;
+
+	Simulation watersim(particles, params, hugePages);
+	watersim.setViewer(WATERFALL_CAMERA);
+	addWaterfallPlanes(watersim);
+	if(!loadPath.empty()){
+		if(!watersim.load(loadPath)) return 1;
+		particles = watersim.getNumberOfParticles();
+		cout << "Loaded " << loadPath << " at step " << watersim.stats().steps << endl;
+	}
+	if(params.boundaryParticles){
+		//Sampled up front so the first step is not charged for it
+		watersim.updateBoundary();
+		cout << "Boundary: " << watersim.getBoundaryParticles() << " particles sampled in " << 1000.0*watersim.getBoundarySeconds() << " ms" << endl;
+	}
+	if(checkpointEvery > 0 && savePath.empty()){
+		cerr << "--checkpoint-every needs --save" << endl;
+		return 1;
+	}
+	CheckpointWriter checkpoints;
+	SecondaryParticles secondary;
+	ShallowWater pool;
+	ParticleCacheWriter cache;
+	if(!cachePath.empty() && !cache.open(cachePath)) return 1;
+
+	FrameRingWriter ring;
+	if(!publishName.empty()){
+		if(!ring.create(publishName, watersim.getCapacity())) return 1;
+		cout << "Publishing to frame ring " << publishName << endl;
+	}
+
+	cout << "Stepping " << particles << " particles for " << frames << " frames" << endl;
+
+	double total = 0.0;
+	double stepTotal = 0.0;
+	double particleSteps = 0.0;
+	double cachedParticles = 0.0;
+	double fastest = 1e30;
+	double slowest = 0.0;
+	double phaseTotal[PHASE_COUNT] = {};
+	double respawns = 0.0;
+	double secondarySeconds = 0.0;
+	double active = 0.0;
+	double neighbors = 0.0;
+	double remote = 0.0;
+	double alive = 0.0;
+	double poolSeconds = 0.0;
+	double absorbed = 0.0;
+	double emitted = 0.0;
+	double recycled = 0.0;
+	for(int f=0; f<frames; f++){
+		Trace::update();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		watersim.step();
+		chrono::steady_clock::time_point stepped = chrono::steady_clock::now();
+		if(usePool) pool.update(watersim);
+		if(params.secondaryMetrics) secondary.update(watersim);
+		if(!cachePath.empty()){
+			cache.addFrame(watersim);
+			cachedParticles += watersim.getNumberOfParticles();
+		}
+		if(!publishName.empty()) ring.publish(watersim);
+		chrono::steady_clock::time_point end = chrono::steady_clock::now();
+		double stepSeconds = chrono::duration<double>(stepped - start).count();
+		double seconds = chrono::duration<double>(end - start).count();
+
+		//Only the solver counts towards the step time, the pool, secondary
+		//particles, cache and publishing are reported on their own
+		total += seconds;
+		stepTotal += stepSeconds;
+		particleSteps += watersim.getNumberOfParticles();
+		fastest = min(fastest, stepSeconds);
+		slowest = max(slowest, stepSeconds);
+
+		const SimulationStats& stats = watersim.stats();
+		for(int p=0; p<PHASE_COUNT; p++){
+			phaseTotal[p] += stats.phaseSeconds[p];
+		}
+		respawns += stats.respawns;
+		active += stats.activeParticles;
+		neighbors += stats.neighborsVisited;
+		alive += watersim.getNumberOfParticles();
+		poolSeconds += pool.getUpdateSeconds();
+		absorbed += pool.getAbsorbed();
+		emitted += pool.getEmitted();
+		recycled += pool.getRecycled();
+		remote += stats.remoteNeighbors;
+		secondarySeconds += secondary.getUpdateSeconds();
+
+		telemetry.recordStep(stats, watersim.getNumberOfParticles());
+		telemetry.recordFrame(seconds);
+		if(params.secondaryMetrics) telemetry.recordSecondary(secondary.size());
+
+		if(checkpointEvery > 0 && (f+1) % checkpointEvery == 0){
+			if(!checkpoints.submit(watersim, savePath)){
+				cout << "Frame " << f+1 << ": previous checkpoint still being written, skipped" << endl;
+			}
+		}
+
+		if((f+1) % 100 == 0){
+			cout << "Frame " << f+1 << ": " << (f+1) / stepTotal << " steps/s" << endl;
+		}
+	}
+
+	cout << "Total " << total << " s, " << stepTotal << " s in the solver, " << total - stepTotal << " s in the rest of the frame" << endl;
+	cout << "Step time ms: mean " << 1000.0*stepTotal / frames << ", min " << 1000.0*fastest << ", max " << 1000.0*slowest << endl;
+	cout << "Phase ms:";
+	for(int p=0; p<PHASE_COUNT; p++){
+		cout << " " << SimulationStats::phaseName(p) << " " << 1000.0*phaseTotal[p] / frames;
+	}
+	cout << endl;
+	cout << "Respawns per step: " << respawns / frames << endl;
+	if(params.lodDistance > 0.0f){
+		cout << "Updated per step: " << active / frames << " particles" << endl;
+	}
+	if(watersim.getThreads() > 0){
+		cout << "Workers: " << watersim.getThreads() << endl;
+	}
+	if(params.numa && watersim.getThreads() > 0){
+		cout << "Neighbours on other nodes: " << 100.0*remote / max(neighbors, 1.0) << "%";
+		double local = watersim.getLocalPageFraction();
+		if(local >= 0.0) cout << ", positions on the node of their worker: " << 100.0*local << "%";
+		cout << endl;
+	}
+	if(usePool){
+		double particleVolume = watersim.getParticleMass() / watersim.getRestDensity();
+		cout << "Pool: " << alive / frames << " particles on average, " << watersim.getNumberOfParticles() << " at the end, "
+			<< pool.volume() / particleVolume << " particles of water in the pool, update " << 1000.0*poolSeconds / frames << " ms" << endl;
+		cout << "Pool per step: " << absorbed / frames << " absorbed, " << emitted / frames << " splashed, "
+			<< recycled / frames << " drained to the source" << endl;
+	}
+	if(params.secondaryMetrics){
+		cout << "Secondary particles: " << secondary.count(SECONDARY_SPRAY) << " spray, " << secondary.count(SECONDARY_FOAM) << " foam, "
+			<< secondary.count(SECONDARY_BUBBLE) << " bubbles, update " << 1000.0*secondarySeconds / frames << " ms" << endl;
+	}
+	cout << "Frame time ms: mean " << 1000.0*total / frames << ", of which " << 1000.0*(total - stepTotal) / frames << " outside the solver" << endl;
+	cout << "Throughput: " << frames / stepTotal << " steps/s, " << particleSteps / stepTotal << " particle steps/s" << endl;
+
+	if(!cachePath.empty()){
+		if(!cache.close()) return 1;
+		uint64_t cacheFrames = cache.getFrames();
+		uint64_t cacheBytes = cache.getBytes();
+		cout << "Cache " << cachePath << ": " << cacheFrames << " frames, " << cacheBytes / (double)cacheFrames << " bytes/frame, "
+			<< 24.0*cachedParticles / cacheBytes << "x smaller than raw floats" << endl;
+	}
+
+	if(!savePath.empty()){
+		checkpoints.wait();
+		if(!watersim.save(savePath)) return 1;
+		cout << "Saved " << savePath << " at step " << watersim.stats().steps << endl;
+	}
+
+	Trace::shutdown();
+	return 0;
+}
@@ -1,5 +1,11 @@
 #include <iostream>
+#include <sstream>
+#include <iomanip>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <memory>
 
 // GLEW
 #define GLEW_STATIC
@@ -22,6 +28,18 @@
 #include "Camera.h"
 #include "Sphere.h"
 #include "Simulation.h"
+#include "SecondaryParticles.h"
+#include "SecondaryRenderer.h"
+#include "ShallowWater.h"
+#include "PoolRenderer.h"
+#include "SceneSetup.h"
+#include "Overlay.h"
+#include "Trace.h"
+#include "Checkpoint.h"
+#include "ParticleCache.h"
+#include "Telemetry.h"
+#include "QualityController.h"
+#include "RenderTarget.h"
 #include "model.h"
 
 using namespace Water;
@@ -39,7 +57,7 @@ const GLuint WIDTH = 1800, HEIGHT = 1000;
 GLuint collisionVBO, collisionVAO, collisionVBOnormals;
 
 // Camera
-Camera  camera(glm::vec3(4.32825,-3.28939,9.06154));
+Camera  camera(WATERFALL_CAMERA);
 GLfloat lastX  =  WIDTH  / 2.0;
 GLfloat lastY  =  HEIGHT / 2.0;
 bool    keys[1024];
@@ -54,6 +72,35 @@ GLfloat lastFrame = 0.0f;  	// Time of last frame
 //Recording
 bool isRecording = false;
 
+//Checkpoints, K saves and L loads
+bool saveCheckpoint = false;
+bool loadCheckpoint = false;
+
+//Spray, foam and bubbles, F toggles them and the metrics seeding them
+bool showSecondary = false;
+bool showSecondaryChanged = false;
+
+//The plunge pool as a shallow water heightfield, P toggles it. While it is
+//off the water in it stays where it is
+bool usePool = false;
+
+//Particles far from the camera are updated less often, G toggles it
+const GLfloat LOD_DISTANCE = 6.0;
+bool levelOfDetail = false;
+bool levelOfDetailChanged = false;
+
+//Holds 60 fps by lowering the level of detail distance, sphere
+//tessellation and resolution, Q toggles it
+bool adaptiveQuality = true;
+bool adaptiveQualityChanged = false;
+
+//Cache playback. Space pauses, [ and ] step one frame, , and . jump a
+//second, Home goes back to the first frame and O toggles looping
+bool playbackPaused = false;
+bool playbackLoop = true;
+bool playbackRewind = false;
+long playbackSkip = 0;
+
 GLint modelLoc;
 GLint viewLoc;
 GLint projLoc;
@@ -89,8 +136,25 @@ void configureShader(Shader s){
 }
 
 // The MAIN function, from here we start the application and run the game loop
-int main()
+// Usage: water [--play cache], --play replays a particle cache baked by
+// watersim-headless --cache instead of running the simulation
+int main(int argc, char** argv)
 {
+	string playbackPath = "";
+	for(int i=1; i<argc; i++){
+		if(!strcmp(argv[i], "--play") && i+1 < argc) playbackPath = argv[++i];
+		else{
+			cerr << "Unknown or incomplete argument " << argv[i] << endl;
+			return 1;
+		}
+	}
+	bool isPlayback = !playbackPath.empty();
+
+	Trace::setThreadName("main");
+	Trace::startFromEnvironment();
+	Telemetry telemetry;
+	telemetry.startFromEnvironment();
+
 	// Init GLFW
 	glfwInit();
 	// Set all the required options for GLFW
@@ -127,11 +191,21 @@ int main()
 	// Build and compile our shader program
 	Shader domeShader("shaders/phong.vs", "shaders/phong.frag");
 	Shader waterShader("shaders/water.vs", "shaders/water.frag");
+	Shader instancedWaterShader("shaders/water_instanced.vs", "shaders/water.frag");
 	Shader treeShader("shaders/tree.vs", "shaders/tree.frag");
 	Shader rockShader("shaders/rock.vs", "shaders/rock.frag");
 	Shader planeShader("shaders/plane.vs", "shaders/plane.frag");
 
-	Sphere sphere(50, 0.1f);
+	QualityController quality;
+	quality.setLevelOfDetail(levelOfDetail);
+	const QualitySettings fixedQuality(50, 1.0, LOD_DISTANCE, 1.0);
+	QualitySettings applied = adaptiveQuality ? quality.settings() : fixedQuality;
+
+	Sphere sphere(applied.sphereResolution, 0.1f);
+	RenderTarget target;
+	Overlay overlay;
+	SecondaryRenderer secondaryRenderer;
+	PoolRenderer poolRenderer;
 
 	Model treesObj("/home/gardar/Downloads/Blend in Pieces/Blend in Pieces/Highest.obj");
 	Model sphereObj("/home/gardar/Downloads/Blend in Pieces/Blend in Pieces/Sphere.obj");
@@ -139,64 +213,70 @@ int main()
 
 	//Water spawn spot
 	//1.40767 -1.19419 -4.87515
-	Simulation watersim(3000);
-
-	GLfloat PI = 3.14159265;
-	watersim.addPlane(glm::scale(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(0.0,-4.0,2.0)),0.0f,glm::vec3(1.0,0.0,0.1)),glm::vec3(20.0,20.0,20.0)));
-
-	watersim.addPlane(glm::scale(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(1.44,-1.28,-7.67)),0.10f,glm::vec3(1.0,0.0,0.1)),glm::vec3(2.0,2.0,5.0)));
-
-	watersim.addPlane(glm::scale(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(-0.53,-2.43,-2.0)),-PI/2.1f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,2.0,2.0)));
-	watersim.addPlane(glm::scale(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(-0.53+0.3,-3.43+0.3,-2.0)),-PI/4.1f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,2.0,2.0)));
-	watersim.addPlane(glm::scale(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(3.32,-2.43,-2.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,2.0,2.0)));
-
-	watersim.addPlane(glm::scale(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(1.43,-3.81,-2.16)),PI/2.5f,glm::vec3(1.0,0.0,0.0)),glm::vec3(2.0,2.0,2.0)));
-	watersim.addPlane(glm::scale(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(1.43,0.2,-8.16)),PI/2.0f,glm::vec3(1.0,0.0,0.0)),glm::vec3(2.0,2.0,2.0)));
-
-	watersim.addPlane(glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(3.06,-0.99,-5.53)),0.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,2.0,4.0)));
-	watersim.addPlane(glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(0.55,-1.44,-5.56)),0.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,2.0,4.0)));
-	watersim.addPlane(glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(-0.42,-2.43,0.93)),PI/6.0f,glm::vec3(0.0,1.0,0.0)),-PI/2.1f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,2.0,2.0)));
-	watersim.addPlane(glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(-0.60,-3.46,0.04)),-PI/5.0f,glm::vec3(0.0,1.0,0.0)),-PI/3.2f,glm::vec3(0.0,0.0,1.0)),glm::vec3(1.4,0.4,0.4)));
-
-	watersim.addPlane(glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(3.59171,-3.60756,0.89)),PI/10.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,2.0,2.0)));
-	watersim.addPlane(glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(4.21,-2.87,4.73)),PI/10.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,2.0,2.0)));
-
-	watersim.addPlane(glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(3.94,-2.52,2.33)),PI/2.0f+PI/4.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,0.6,0.6)));
-	watersim.addPlane(glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(4.25,-3.08,5.84)),PI/2.0f+PI/5.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(2.0,1.0,0.5)));
-
-	watersim.addPlane(glm::scale(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(-0.2,-3.60756,4.83412)),-PI/2.0f,glm::vec3(0.0,0.2,1.0)),glm::vec3(3.0,2.0,3.0)));
-
-	watersim.addPlane(glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(2.19,-4.01,5.48+0.1)),-PI/4.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(0.2,0.2,0.2)));
-	watersim.addPlane(glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(2.39+0.1,-4.01,5.48-0.05)),PI/2.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(0.2,0.2,0.2)));
-	watersim.addPlane(glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(2.19+0.6,-4.01,5.48+0.1)),PI/4.0f,glm::vec3(0.0,1.0,0.0)),PI/2.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(0.2,0.2,0.2)));
-	watersim.addPlane(glm::scale(glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), glm::vec3(2.19+0.3,-3.81,5.48+0.1)),-0.1f,glm::vec3(1.0,0.0,0.0)),0.0f,glm::vec3(0.0,0.0,1.0)),glm::vec3(0.2,0.2,0.2)));
+	std::vector<Triangle> surfaces;
+	addWaterfallPlanes(surfaces);
+
+	//Playback only needs the collision surfaces, so it makes no simulation
+	SimulationParameters params;
+	params.secondaryMetrics = showSecondary;
+	params.lodDistance = levelOfDetail ? applied.lodDistance : 0.0f;
+	std::unique_ptr<Simulation> watersim;
+	if(!isPlayback){
+		watersim.reset(new Simulation(WATERFALL_PARTICLES, params));
+		watersim->surfaces = surfaces;
+	}
+	SecondaryParticles secondary;
+	ShallowWater pool;
+
+	//WATERSIM_CHECKPOINT=file warm starts from file and is where K saves to,
+	//WATERSIM_CHECKPOINT_SECONDS=s also saves it every s seconds
+	const char* checkpointEnv = getenv("WATERSIM_CHECKPOINT");
+	string checkpointPath = checkpointEnv != NULL ? checkpointEnv : "checkpoint.bin";
+	if(watersim && checkpointEnv != NULL && access(checkpointPath.c_str(), F_OK) == 0 && watersim->load(checkpointPath)){
+		cout << "Loaded " << checkpointPath << " at step " << watersim->stats().steps << endl;
+	}
+	const char* checkpointSeconds = getenv("WATERSIM_CHECKPOINT_SECONDS");
+	GLfloat checkpointInterval = checkpointSeconds != NULL ? atof(checkpointSeconds) : 0.0f;
+	GLfloat lastCheckpoint = 0.0f;
+	CheckpointWriter checkpoints;
+
+	ParticleCacheReader playback;
+	if(isPlayback && !playback.open(playbackPath)) return 1;
+	long playbackFrame = 0;
+	long shownFrame = -1;
+	std::vector<glm::vec3> playbackPositions;
+	std::vector<glm::vec3> playbackVelocities;
 
 	glGenBuffers(1, &collisionVBO);
 	glGenBuffers(1, &collisionVBOnormals);
 	glGenVertexArrays(1, &collisionVAO);
 
 	std::vector<glm::vec3> surfaceNormals;
-	for(int i=0; i<watersim.surfaces.size(); i++){
-		Triangle tmp = watersim.surfaces[i];
+	for(int i=0; i<surfaces.size(); i++){
+		Triangle tmp = surfaces[i];
 		glm::vec3 norm = glm::cross(tmp.a - tmp.b, tmp.a - tmp.c);
 		surfaceNormals.push_back(norm);
 		surfaceNormals.push_back(norm);
 		surfaceNormals.push_back(norm);
 	}
 
-	glBindVertexArray(collisionVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, collisionVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*watersim.surfaces.size()*9, (GLfloat*)watersim.surfaces.data(), GL_STATIC_DRAW);
+	//Scoped so the trace event ends here and not after Trace::shutdown
+	{
+		TRACE_SCOPE("upload collision surfaces");
+		glBindVertexArray(collisionVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, collisionVBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*surfaces.size()*9, (GLfloat*)surfaces.data(), GL_STATIC_DRAW);
 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat), (GLvoid*)0);
-	glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat), (GLvoid*)0);
+		glEnableVertexAttribArray(0);
 
-	glBindBuffer(GL_ARRAY_BUFFER, collisionVBOnormals);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*watersim.surfaces.size()*9, (GLfloat*)surfaceNormals.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, collisionVBOnormals);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*surfaces.size()*9, (GLfloat*)surfaceNormals.data(), GL_STATIC_DRAW);
 
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat), (GLvoid*)0);
-	glEnableVertexAttribArray(1);
-	glBindVertexArray(0);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat), (GLvoid*)0);
+		glEnableVertexAttribArray(1);
+		glBindVertexArray(0);
+	}
 
 	GLuint surfaceVBO, surfaceVBOnormals, surfaceVAO;
 
@@ -242,18 +322,53 @@ int main()
 	//cnt for filenames
 	int cnt=1;
 
+	//Colors of the simulation phases in the overlay
+	const glm::vec3 phaseColors[PHASE_COUNT] = {
+		glm::vec3(0.9f, 0.9f, 0.2f),
+		glm::vec3(0.2f, 0.6f, 1.0f),
+		glm::vec3(0.2f, 0.9f, 0.4f),
+		glm::vec3(1.0f, 0.4f, 0.2f),
+		glm::vec3(0.8f, 0.3f, 0.9f)
+	};
+	GLfloat lastTitle = 0.0f;
+	GLfloat stepCredit = 0.0f;
+	SimulationStats playbackStats;
+
 	// Game loop
 	while (!glfwWindowShouldClose(window))
 	{
+		TRACE_SCOPE("frame");
+		Trace::update();
+
 		// Calculate deltatime of current frame
 		GLfloat currentFrame = glfwGetTime();
 		deltaTime = currentFrame - lastFrame;
 		lastFrame = currentFrame;
+		telemetry.recordFrame(deltaTime);
 
 		// Check if any events have been activiated (key pressed, mouse moved etc.) and call corresponding response functions
 		glfwPollEvents();
 		do_movement();
 
+		if(isPlayback){
+			long frames = playback.getFrames();
+			if(playbackRewind) playbackFrame = 0;
+			playbackRewind = false;
+			playbackFrame += playbackSkip;
+			playbackSkip = 0;
+			if(playbackLoop) playbackFrame = (playbackFrame % frames + frames) % frames;
+			else playbackFrame = std::max(0L, std::min(frames - 1, playbackFrame));
+
+			if(playbackFrame != shownFrame){
+				TRACE_SCOPE("read cache frame");
+				playback.read(playbackFrame, playbackPositions, playbackVelocities);
+				shownFrame = playbackFrame;
+			}
+		}
+
+		GLfloat renderStart = glfwGetTime();
+		target.begin(w, h, applied.renderScale);
+
 		// Clear the colorbuffer
 		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -261,10 +376,21 @@ int main()
 
 		// Draw the container (using container's vertex attributes)
 
-		configureShader(waterShader);
-		for(int i=0; i<watersim.getNumberOfParticles(); i++){
-			sphere.draw(waterShader, watersim.getPosition(i), watersim.getVelocity(i));
-			//sphere.draw(domeShader, watersim.getPosition(i));
+		{
+			TRACE_SCOPE("draw water");
+			if(isPlayback){
+				configureShader(instancedWaterShader);
+				sphere.drawInstanced(instancedWaterShader, playbackPositions.data(), playbackVelocities.data(), playbackPositions.size());
+			}else{
+				configureShader(waterShader);
+				ParticleView positions = watersim->positions();
+				ParticleView velocities = watersim->velocities();
+				for(size_t i=0; i<positions.size; i++){
+					sphere.draw(waterShader, positions[i], velocities[i]);
+					//sphere.draw(domeShader, positions[i]);
+				}
+				if(usePool) poolRenderer.draw(pool, waterShader);
+			}
 		}
 		//configureShader(domeShader);
 
@@ -274,40 +400,161 @@ int main()
 
 		/*
 		glBindVertexArray(collisionVAO);
-		glDrawArrays(GL_TRIANGLES, 0, watersim.surfaces.size()*3);
+		glDrawArrays(GL_TRIANGLES, 0, surfaces.size()*3);
 		glBindVertexArray(0);
 		*/
 		
-		configureShader(planeShader);
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-		glBindVertexArray(surfaceVAO);
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glBindVertexArray(0);
+		{
+			TRACE_SCOPE("draw pool");
+			configureShader(planeShader);
+			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+			glBindVertexArray(surfaceVAO);
+			glDrawArrays(GL_TRIANGLES, 0, 6);
+			glBindVertexArray(0);
+		}
 
 		glm::mat4 sceneModel = glm::translate(glm::mat4(1.0),glm::vec3(-2.0,-4.0,0.0));
 		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(sceneModel));
 
-		configureShader(treeShader);
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(sceneModel));
-		treesObj.Draw(treeShader);
+		{
+			TRACE_SCOPE("draw trees");
+			configureShader(treeShader);
+			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(sceneModel));
+			treesObj.Draw(treeShader);
+		}
 
-		configureShader(domeShader);
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(sceneModel));
-		sphereObj.Draw(domeShader);
+		{
+			TRACE_SCOPE("draw dome");
+			configureShader(domeShader);
+			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(sceneModel));
+			sphereObj.Draw(domeShader);
+		}
 
 
-		configureShader(rockShader);
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(sceneModel));
-		rockObj.Draw(rockShader);
+		{
+			TRACE_SCOPE("draw rocks");
+			configureShader(rockShader);
+			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(sceneModel));
+			rockObj.Draw(rockShader);
+		}
 
-		cout<<camera.Position.x<<" "<<camera.Position.y<<" "<<camera.Position.z<<" "<<endl;
+		//Caches hold no metrics, so there is nothing to seed from in playback
+		if(!isPlayback && showSecondary){
+			glm::mat4 projection = glm::perspective(camera.Zoom, (GLfloat)w / (GLfloat)h, 0.1f, 100.0f);
+			secondaryRenderer.draw(secondary, camera.GetViewMatrix(), projection, 0.02f*h*applied.renderScale);
+		}
+		target.end();
+		GLfloat renderSeconds = glfwGetTime() - renderStart;
+
+		if(isPlayback){
+			//One cache frame per displayed frame
+			if(!playbackPaused) playbackFrame++;
+		}else{
+			if(levelOfDetailChanged){
+				levelOfDetailChanged = false;
+				quality.setLevelOfDetail(levelOfDetail);
+				watersim->setLevelOfDetail(levelOfDetail ? applied.lodDistance : 0.0f, params.lodLevels);
+			}
+			if(showSecondaryChanged){
+				showSecondaryChanged = false;
+				watersim->setSecondaryMetrics(showSecondary);
+			}
+			watersim->setViewer(camera.Position);
+			//Below one step per frame the steps are spread over the frames
+			double simSeconds = 0.0;
+			stepCredit += applied.stepsPerFrame;
+			for(; stepCredit >= 1.0f; stepCredit -= 1.0f){
+				watersim->step();
+				if(usePool) pool.update(*watersim);
+				if(showSecondary) secondary.update(*watersim);
+				simSeconds += watersim->stats().stepSeconds + (showSecondary ? secondary.getUpdateSeconds() : 0.0)
+					+ (usePool ? pool.getUpdateSeconds() : 0.0);
+				telemetry.recordStep(watersim->stats(), watersim->getNumberOfParticles());
+			}
+			telemetry.recordSecondary(showSecondary ? secondary.size() : 0);
+
+			if(adaptiveQualityChanged || (adaptiveQuality && quality.update(simSeconds, renderSeconds, deltaTime))){
+				adaptiveQualityChanged = false;
+				QualitySettings next = adaptiveQuality ? quality.settings() : fixedQuality;
+				if(next.sphereResolution != applied.sphereResolution) sphere.setResolution(next.sphereResolution);
+				if(next.lodDistance != applied.lodDistance) levelOfDetailChanged = true;
+				applied = next;
+			}
+		}
 
-		watersim.step();
+		if(!isPlayback && checkpointInterval > 0.0f && currentFrame - lastCheckpoint > checkpointInterval){
+			lastCheckpoint = currentFrame;
+			saveCheckpoint = true;
+		}
+		if(saveCheckpoint){
+			saveCheckpoint = false;
+			//Skipped while the previous one is still being written
+			if(watersim) checkpoints.submit(*watersim, checkpointPath);
+		}
+		if(loadCheckpoint){
+			loadCheckpoint = false;
+			checkpoints.wait();
+			if(watersim && watersim->load(checkpointPath)){
+				cout << "Loaded " << checkpointPath << " at step " << watersim->stats().steps << endl;
+			}
+		}
+
+		//Overlay, the top bar is the last step split into its phases and the
+		//one below is the whole frame. A full bar is one frame at 60 fps
+		const SimulationStats& stats = watersim ? watersim->stats() : playbackStats;
+		std::vector<GLfloat> phaseWidths;
+		for(int p=0; p<PHASE_COUNT; p++){
+			phaseWidths.push_back(stats.phaseSeconds[p]*60.0f);
+		}
+		overlay.addBar(0, phaseWidths, std::vector<glm::vec3>(phaseColors, phaseColors + PHASE_COUNT));
+		overlay.addBar(1, std::vector<GLfloat>(1, deltaTime*60.0f), std::vector<glm::vec3>(1, glm::vec3(0.9f)));
+		overlay.draw();
+
+		//The numbers behind the bars go in the title, twice a second
+		if(currentFrame - lastTitle > 0.5f){
+			lastTitle = currentFrame;
+			std::stringstream title;
+			title << std::fixed << std::setprecision(1) << "Water simulation V2 | frame " << 1000.0f*deltaTime
+				<< " ms | step " << 1000.0*stats.stepSeconds << " ms:";
+			for(int p=0; p<PHASE_COUNT; p++){
+				title << " " << SimulationStats::phaseName(p) << " " << 1000.0*stats.phaseSeconds[p];
+			}
+			if(isPlayback){
+				title << " | playback frame " << shownFrame + 1 << "/" << playback.getFrames()
+					<< ", step " << playback.getStep(shownFrame) << ", " << playbackPositions.size() << " particles"
+					<< (playbackPaused ? ", paused" : "") << (playbackLoop ? ", looping" : "");
+			}else{
+				title << " | " << watersim->getNumberOfParticles() << " particles, "
+					<< stats.neighborsVisited << " neighbors, " << stats.kernelEvaluations << " kernels, "
+					<< stats.triangleTests << " triangle tests, " << stats.bounces << " bounces, "
+					<< stats.respawns << " respawns";
+				if(levelOfDetail){
+					title << ", " << stats.activeParticles << " updated";
+				}
+				if(adaptiveQuality){
+					title << " | quality: spheres " << applied.sphereResolution << ", " << applied.stepsPerFrame << " steps per frame, lod "
+						<< applied.lodDistance << ", scale " << applied.renderScale;
+				}
+				if(usePool){
+					title << " | pool " << 1000.0*pool.getUpdateSeconds() << " ms: " << pool.getAbsorbed() << " absorbed, "
+						<< pool.getEmitted() << " splashed, " << pool.getRecycled() << " drained";
+				}
+				if(showSecondary){
+					title << " | secondary " << 1000.0*secondary.getUpdateSeconds() << " ms: " << secondary.count(SECONDARY_SPRAY) << " spray, "
+						<< secondary.count(SECONDARY_FOAM) << " foam, " << secondary.count(SECONDARY_BUBBLE) << " bubbles";
+				}
+			}
+			glfwSetWindowTitle(window, title.str().c_str());
+		}
 
 		// Swap the screen buffers
-		glfwSwapBuffers(window);
+		{
+			TRACE_SCOPE("swap buffers");
+			glfwSwapBuffers(window);
+		}
 
 		if(isRecording == true){
+			TRACE_SCOPE("screenshot");
 			stringstream ss;
 			ss << "movie" << cnt++ << ".bmp";
 			string filename = ss.str();
@@ -315,6 +562,8 @@ int main()
 		}
 	}
 
+	Trace::shutdown();
+
 	// Terminate GLFW, clearing any resources allocated by GLFW.
 	glfwTerminate();
 	return 0;
@@ -325,6 +574,43 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 {
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, GL_TRUE);
+	if (key == GLFW_KEY_T && action == GLFW_PRESS)
+		Trace::toggle();
+	if (key == GLFW_KEY_F && action == GLFW_PRESS){
+		showSecondary = !showSecondary;
+		showSecondaryChanged = true;
+	}
+	if (key == GLFW_KEY_P && action == GLFW_PRESS)
+		usePool = !usePool;
+	if (key == GLFW_KEY_Q && action == GLFW_PRESS){
+		adaptiveQuality = !adaptiveQuality;
+		adaptiveQualityChanged = true;
+	}
+	if (key == GLFW_KEY_G && action == GLFW_PRESS){
+		levelOfDetail = !levelOfDetail;
+		levelOfDetailChanged = true;
+	}
+	if (key == GLFW_KEY_K && action == GLFW_PRESS)
+		saveCheckpoint = true;
+	if (key == GLFW_KEY_L && action == GLFW_PRESS)
+		loadCheckpoint = true;
+	if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
+		playbackPaused = !playbackPaused;
+	if (key == GLFW_KEY_O && action == GLFW_PRESS)
+		playbackLoop = !playbackLoop;
+	if (key == GLFW_KEY_HOME && action == GLFW_PRESS)
+		playbackRewind = true;
+	//Held keys repeat, so holding them scrubs
+	if (action == GLFW_PRESS || action == GLFW_REPEAT){
+		if (key == GLFW_KEY_LEFT_BRACKET)
+			playbackSkip -= 1;
+		if (key == GLFW_KEY_RIGHT_BRACKET)
+			playbackSkip += 1;
+		if (key == GLFW_KEY_COMMA)
+			playbackSkip -= 60;
+		if (key == GLFW_KEY_PERIOD)
+			playbackSkip += 60;
+	}
 	if (key >= 0 && key < 1024)
 	{
 		if (action == GLFW_PRESS)
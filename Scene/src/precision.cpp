@@ -0,0 +1,231 @@
+// Compares the float and double instantiations of the solver, stepping both
+// from the same start: the column of particles every simulation starts
+// with, dropped into a closed tank where it settles into a deep pool.
+//
+// Usage: watersim-precision [-n particles] [-s steps] [-i interval] [-t steps] [--boundary]
+// Every interval steps it prints the total energy of both runs, the gap
+// between them, how far the particles of the float run are from those of
+// the double run and how many particles of each escaped the tank. At the
+// end it prints the drift of the energy of each over the second half of the
+// run, when the pool should be at rest and any change is error. The drift
+// only counts particles which stay in the tank all through that half:
+// the collision response backs a particle off to x + (t - 0.001)*step,
+// which in float can leave it on the far side of a wall, and the energy
+// an escaped particle loses or gains would otherwise swamp the error of
+// the ones that stay. The energy columns include every particle. A leaking
+// run still drifts, as the pool drains the water left in it sinks, and the
+// tool says so when a run lost particles. Then both
+// start over from the final state of the double run, loaded from a
+// checkpoint, and their throughput is timed over -t steps.
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include <glm/glm.hpp>
+
+#include "Simulation.h"
+
+using namespace Water;
+using namespace std;
+
+//Corners of the tank, around the initial column of particles
+const glm::vec3 TANK_MIN(-0.5, -1.5, -5.4);
+const glm::vec3 TANK_MAX(4.2, 8.0, -0.6);
+
+static void addQuad(vector<Triangle>& surfaces, glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 d){
+	Triangle t1 = {a, b, c};
+	Triangle t2 = {a, c, d};
+	surfaces.push_back(t1);
+	surfaces.push_back(t2);
+}
+
+//Floor and walls of the tank, it is open at the top
+static void addTank(vector<Triangle>& surfaces){
+	glm::vec3 l = TANK_MIN;
+	glm::vec3 h = TANK_MAX;
+	addQuad(surfaces, glm::vec3(l.x,l.y,l.z), glm::vec3(h.x,l.y,l.z), glm::vec3(h.x,l.y,h.z), glm::vec3(l.x,l.y,h.z));
+	addQuad(surfaces, glm::vec3(l.x,l.y,l.z), glm::vec3(l.x,h.y,l.z), glm::vec3(l.x,h.y,h.z), glm::vec3(l.x,l.y,h.z));
+	addQuad(surfaces, glm::vec3(h.x,l.y,l.z), glm::vec3(h.x,h.y,l.z), glm::vec3(h.x,h.y,h.z), glm::vec3(h.x,l.y,h.z));
+	addQuad(surfaces, glm::vec3(l.x,l.y,l.z), glm::vec3(h.x,l.y,l.z), glm::vec3(h.x,h.y,l.z), glm::vec3(l.x,h.y,l.z));
+	addQuad(surfaces, glm::vec3(l.x,l.y,h.z), glm::vec3(h.x,l.y,h.z), glm::vec3(h.x,h.y,h.z), glm::vec3(l.x,h.y,h.z));
+}
+
+//Whether p left the tank through its floor or walls
+template<typename Vector>
+static bool outside(const Vector& p){
+	return p.x < TANK_MIN.x || p.x > TANK_MAX.x || p.y < TANK_MIN.y || p.z < TANK_MIN.z || p.z > TANK_MAX.z;
+}
+
+//Kinetic plus potential energy above the floor of the tank of every
+//particle, in double
+template<typename Scalar>
+static vector<double> energies(BasicSimulation<Scalar>& sim){
+	typename BasicSimulation<Scalar>::View x = sim.positions();
+	typename BasicSimulation<Scalar>::View v = sim.velocities();
+	vector<double> e(x.size);
+	for(size_t i=0; i<x.size; i++){
+		glm::dvec3 u(v[i]);
+		e[i] = sim.getParticleMass()*(0.5*glm::dot(u, u) - (double)sim.getGravity()*(x[i].y - TANK_MIN.y));
+	}
+	return e;
+}
+
+//Marks the particles which are outside the tank now. Escaped particles are
+//respawned, possibly back above the tank, so this is checked every step
+template<typename Scalar>
+static void markEscaped(BasicSimulation<Scalar>& sim, vector<bool>& lost){
+	typename BasicSimulation<Scalar>::View x = sim.positions();
+	lost.resize(max(lost.size(), x.size), false);
+	for(size_t i=0; i<x.size; i++){
+		if(outside(x[i])) lost[i] = true;
+	}
+}
+
+//Total energy of every particle, escaped or not
+template<typename Scalar>
+static double energy(BasicSimulation<Scalar>& sim){
+	typename BasicSimulation<Scalar>::View x = sim.positions();
+	typename BasicSimulation<Scalar>::View v = sim.velocities();
+	double e = 0.0;
+	for(size_t i=0; i<x.size; i++){
+		glm::dvec3 u(v[i]);
+		e += 0.5*glm::dot(u, u) - (double)sim.getGravity()*(x[i].y - TANK_MIN.y);
+	}
+	return sim.getParticleMass()*e;
+}
+
+//Relative change of the energy of the particles never marked lost. kept
+//receives how many of them there are
+static double drift(const vector<double>& before, const vector<double>& after, const vector<bool>& lost, size_t& kept){
+	double a = 0.0;
+	double b = 0.0;
+	kept = 0;
+	for(size_t i=0; i<min(before.size(), after.size()); i++){
+		if(i < lost.size() && lost[i]) continue;
+		a += before[i];
+		b += after[i];
+		kept++;
+	}
+	return (b - a) / a;
+}
+
+template<typename Scalar>
+static size_t escaped(BasicSimulation<Scalar>& sim){
+	typename BasicSimulation<Scalar>::View x = sim.positions();
+	size_t n = 0;
+	for(size_t i=0; i<x.size; i++){
+		if(outside(x[i])) n++;
+	}
+	return n;
+}
+
+//Root mean square distance between the particles of the two runs
+static double positionGap(Simulation& a, DoubleSimulation& b){
+	ParticleView x = a.positions();
+	DoubleSimulation::View y = b.positions();
+	size_t n = min(x.size, y.size);
+	double sum = 0.0;
+	for(size_t i=0; i<n; i++){
+		glm::dvec3 d = glm::dvec3(x[i]) - y[i];
+		sum += glm::dot(d, d);
+	}
+	return n > 0 ? sqrt(sum / n) : 0.0;
+}
+
+//Seconds sim spends on steps steps
+template<typename Scalar>
+static double measure(BasicSimulation<Scalar>& sim, size_t steps){
+	double seconds = 0.0;
+	for(size_t s=0; s<steps; s++){
+		sim.step();
+		seconds += sim.stats().stepSeconds;
+	}
+	return seconds;
+}
+
+static void throughput(const char* name, size_t particles, size_t steps, double seconds){
+	cout << name << ": " << fixed << setprecision(3) << 1000.0*seconds / steps << " ms/step, "
+		<< scientific << setprecision(3) << particles*steps / seconds << " particle steps/s" << endl;
+}
+
+int main(int argc, char** argv){
+	size_t particles = 2000;
+	size_t steps = 2000;
+	size_t interval = 200;
+	size_t timed = 200;
+	SimulationParameters params;
+
+	for(int i=1; i<argc; i++){
+		bool hasValue = i+1 < argc;
+		if(!strcmp(argv[i], "-n") && hasValue) particles = atol(argv[++i]);
+		else if(!strcmp(argv[i], "-s") && hasValue) steps = max(atol(argv[++i]), 2L);
+		else if(!strcmp(argv[i], "-i") && hasValue) interval = max(atol(argv[++i]), 1L);
+		else if(!strcmp(argv[i], "-t") && hasValue) timed = max(atol(argv[++i]), 1L);
+		else if(!strcmp(argv[i], "--boundary")) params.boundaryParticles = true;
+		else{
+			cerr << "Unknown or incomplete argument " << argv[i] << endl;
+			return 1;
+		}
+	}
+
+	Simulation single(particles, params);
+	DoubleSimulation twice(particles, params);
+	addTank(single.surfaces);
+	addTank(twice.surfaces);
+
+	vector<double> singleSettled;
+	vector<double> twiceSettled;
+	vector<bool> singleLost;
+	vector<bool> twiceLost;
+
+	cout << setw(8) << "step" << setw(16) << "float energy" << setw(16) << "double energy" << setw(14) << "energy gap"
+		<< setw(14) << "position gap" << setw(16) << "float escaped" << setw(16) << "double escaped" << endl;
+	for(size_t s=1; s<=steps; s++){
+		single.step();
+		twice.step();
+
+		if(s == steps/2){
+			singleSettled = energies(single);
+			twiceSettled = energies(twice);
+		}
+		if(s >= steps/2){
+			markEscaped(single, singleLost);
+			markEscaped(twice, twiceLost);
+		}
+		if(s % interval == 0 || s == steps){
+			double a = energy(single);
+			double b = energy(twice);
+			cout << setw(8) << s << scientific << setprecision(6) << setw(16) << a << setw(16) << b
+				<< setprecision(3) << setw(14) << (a - b) / fabs(b) << setw(14) << positionGap(single, twice)
+				<< setw(16) << escaped(single) << setw(16) << escaped(twice) << endl;
+		}
+	}
+	size_t singleKept, twiceKept;
+	double singleDrift = drift(singleSettled, energies(single), singleLost, singleKept);
+	double twiceDrift = drift(twiceSettled, energies(twice), twiceLost, twiceKept);
+	cout << "Energy drift over steps " << steps/2 << " to " << steps << " of the particles in the tank throughout: float "
+		<< scientific << setprecision(3) << singleDrift << " (" << singleKept << " particles), double " << twiceDrift
+		<< " (" << twiceKept << " particles)" << endl;
+	if(singleKept < single.getNumberOfParticles() || twiceKept < twice.getNumberOfParticles()){
+		cout << "Particles escaped through the walls, the collision backoff does not always keep them in. The pool drains"
+			<< " and the water left in it sinks, so the drift of a leaking run mostly measures the leak" << endl;
+	}
+
+	//The particles the float run lost would make its steps cheaper, so
+	//both are timed from the same state
+	string path = "watersim-precision.ckp";
+	bool loaded = twice.save(path) && single.load(path);
+	unlink(path.c_str());
+	if(!loaded){
+		cerr << "Could not hand the state of the double run to the float run" << endl;
+		return 1;
+	}
+	throughput("float", single.getNumberOfParticles(), timed, measure(single, timed));
+	throughput("double", twice.getNumberOfParticles(), timed, measure(twice, timed));
+	return 0;
+}
@@ -0,0 +1,124 @@
+// Runs the waterfall scene split into slabs along z, one process per slab.
+// Processes exchange migrating particles and ghost halos every step over
+// shared memory or TCP on the loopback interface.
+//
+// Usage: watersim-slabs [-p processes] [-n particles] [-f frames]
+//                       [-t shm|tcp] [-r rebalance interval]
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <glm/glm.hpp>
+
+#include "Simulation.h"
+#include "SceneSetup.h"
+#include "Transport.h"
+#include "SlabDecomposition.h"
+
+using namespace Water;
+using namespace std;
+
+//Extent of the waterfall scene along z, particles outside are respawned
+const GLfloat SCENE_Z_LOW = -8.0;
+const GLfloat SCENE_Z_HIGH = 10.0;
+
+static int runRank(Transport& transport, int rank, size_t particles, int frames, int rebalanceInterval){
+	transport.attach(rank);
+
+	SimulationParameters params;
+	params.seed = 1 + rank;
+	params.capacity = 2*particles;
+
+	//Every rank builds the full initial block and keeps its own share of it
+	Simulation sim(particles, params);
+	addWaterfallPlanes(sim);
+
+	SlabDecomposition slabs(sim, transport, SCENE_Z_LOW, SCENE_Z_HIGH);
+	slabs.rebalance(1.0);
+	slabs.keepOwnParticles();
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(int f=0; f<frames; f++){
+		if(rebalanceInterval > 0 && f > 0 && f % rebalanceInterval == 0){
+			slabs.rebalance(0.5);
+			if(rank == 0){
+				cerr << "Frame " << f << " boundaries:";
+				for(int r=1; r<transport.size(); r++) cerr << " " << slabs.boundaries[r];
+				cerr << endl;
+			}
+		}
+		slabs.step();
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cerr << "Rank " << rank << ": " << sim.getNumberOfParticles() << " particles, "
+		<< sim.getNumberOfGhosts() << " ghosts, " << frames / seconds << " steps/s" << endl;
+	return 0;
+}
+
+int main(int argc, char** argv){
+	int processes = 2;
+	size_t particles = WATERFALL_PARTICLES;
+	int frames = 500;
+	string transportName = "shm";
+	int rebalanceInterval = 50;
+
+	for(int i=1; i<argc; i++){
+		bool hasValue = i+1 < argc;
+		if(!strcmp(argv[i], "-p") && hasValue) processes = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-n") && hasValue) particles = atol(argv[++i]);
+		else if(!strcmp(argv[i], "-f") && hasValue) frames = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-t") && hasValue) transportName = argv[++i];
+		else if(!strcmp(argv[i], "-r") && hasValue) rebalanceInterval = atoi(argv[++i]);
+		else{
+			cerr << "Unknown or incomplete argument " << argv[i] << endl;
+			return 1;
+		}
+	}
+	if(processes < 1){
+		cerr << "Need at least one process" << endl;
+		return 1;
+	}
+
+	Transport* transport;
+	if(transportName == "shm") transport = new ShmTransport(processes);
+	else if(transportName == "tcp") transport = new TcpTransport(processes);
+	else{
+		cerr << "Unknown transport " << transportName << endl;
+		return 1;
+	}
+
+	cerr << "Running " << particles << " particles in " << processes << " slabs over "
+		<< transportName << " for " << frames << " frames" << endl;
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(int r=0; r<processes; r++){
+		pid_t pid = fork();
+		if(pid < 0){
+			perror("fork");
+			return 1;
+		}
+		if(pid == 0){
+			_exit(runRank(*transport, r, particles, frames, rebalanceInterval));
+		}
+	}
+
+	int failed = 0;
+	for(int r=0; r<processes; r++){
+		int status;
+		wait(&status);
+		if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cerr << "Finished in " << seconds << " s, " << (double)particles*frames / seconds << " particle steps/s";
+	if(failed > 0) cerr << ", " << failed << " ranks failed";
+	cerr << endl;
+
+	delete transport;
+	return failed > 0 ? 1 : 0;
+}
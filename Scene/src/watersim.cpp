@@ -0,0 +1,189 @@
+#include <cstring>
+#include <cstddef>
+#include <new>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "watersim.h"
+#include "Simulation.h"
+#include "SceneSetup.h"
+
+using namespace Water;
+
+//Buffers are handed out as glm::vec3 arrays
+static_assert(sizeof(glm::vec3) == 3*sizeof(float), "glm::vec3 is not three packed floats");
+
+struct watersim{
+	watersim(size_t particles, const SimulationParameters& params) : simulation(particles, params){}
+	Simulation simulation;
+};
+
+static watersim_buffer buffer(const ParticleView& view){
+	watersim_buffer b;
+	b.data = glm::value_ptr(*view.data);
+	b.count = view.size;
+	b.stride = sizeof(glm::vec3);
+	return b;
+}
+
+//Fields a caller built against an older header does not know keep their defaults
+#define WATERSIM_HAS(params, field) ((params)->size >= offsetof(watersim_params, field) + sizeof((params)->field))
+
+static SimulationParameters convert(const watersim_params* p){
+	SimulationParameters params;
+	if(p == NULL) return params;
+	if(WATERSIM_HAS(p, viscosity)) params.v = p->viscosity;
+	if(WATERSIM_HAS(p, stiffness)) params.k = p->stiffness;
+	if(WATERSIM_HAS(p, gravity)) params.g = p->gravity;
+	if(WATERSIM_HAS(p, particle_mass)) params.pm = p->particle_mass;
+	if(WATERSIM_HAS(p, rest_pressure)) params.p_0 = p->rest_pressure;
+	if(WATERSIM_HAS(p, rest_density)) params.d_0 = p->rest_density;
+	if(WATERSIM_HAS(p, time_step)) params.dt = p->time_step;
+	if(WATERSIM_HAS(p, restitution)) params.c_R = p->restitution;
+	if(WATERSIM_HAS(p, effective_radius)) params.effectiveRadius = p->effective_radius;
+	if(WATERSIM_HAS(p, seed)) params.seed = p->seed;
+	if(WATERSIM_HAS(p, respawn)) params.respawn = p->respawn != 0;
+	if(WATERSIM_HAS(p, domain_min)) params.domainMin = glm::make_vec3(p->domain_min);
+	if(WATERSIM_HAS(p, domain_max)) params.domainMax = glm::make_vec3(p->domain_max);
+	if(WATERSIM_HAS(p, boundary_particles)) params.boundaryParticles = p->boundary_particles != 0;
+	if(WATERSIM_HAS(p, boundary_spacing)) params.boundarySpacing = p->boundary_spacing;
+	if(WATERSIM_HAS(p, boundary_stiffness)) params.boundaryStiffness = p->boundary_stiffness;
+	if(WATERSIM_HAS(p, lod_distance)) params.lodDistance = p->lod_distance;
+	if(WATERSIM_HAS(p, lod_levels)) params.lodLevels = p->lod_levels;
+	if(WATERSIM_HAS(p, capacity)) params.capacity = p->capacity;
+	if(WATERSIM_HAS(p, threads)) params.threads = p->threads;
+	if(WATERSIM_HAS(p, numa)) params.numa = p->numa != 0;
+	if(WATERSIM_HAS(p, reorder_interval)) params.reorderInterval = p->reorder_interval;
+	return params;
+}
+
+uint32_t watersim_abi_version(void){
+	return WATERSIM_ABI_VERSION;
+}
+
+void watersim_default_params(watersim_params* p){
+	SimulationParameters params;
+	memset(p, 0, sizeof(watersim_params));
+	p->size = sizeof(watersim_params);
+	p->viscosity = params.v;
+	p->stiffness = params.k;
+	p->gravity = params.g;
+	p->particle_mass = params.pm;
+	p->rest_pressure = params.p_0;
+	p->rest_density = params.d_0;
+	p->time_step = params.dt;
+	p->restitution = params.c_R;
+	p->effective_radius = params.effectiveRadius;
+	p->seed = params.seed;
+	p->respawn = params.respawn;
+	memcpy(p->domain_min, glm::value_ptr(params.domainMin), sizeof(p->domain_min));
+	memcpy(p->domain_max, glm::value_ptr(params.domainMax), sizeof(p->domain_max));
+	p->boundary_particles = params.boundaryParticles;
+	p->boundary_spacing = params.boundarySpacing;
+	p->boundary_stiffness = params.boundaryStiffness;
+	p->lod_distance = params.lodDistance;
+	p->lod_levels = params.lodLevels;
+	p->capacity = params.capacity;
+	p->threads = params.threads;
+	p->numa = params.numa;
+	p->reorder_interval = params.reorderInterval;
+}
+
+//No exception may cross into C
+watersim* watersim_create(size_t particles, const watersim_params* params){
+	try{
+		return new watersim(particles, convert(params));
+	}catch(const std::exception&){
+		return NULL;
+	}
+}
+
+void watersim_destroy(watersim* sim){
+	delete sim;
+}
+
+int watersim_step(watersim* sim, int steps){
+	try{
+		for(int s=0; s<steps; s++){
+			sim->simulation.step();
+		}
+		return 1;
+	}catch(const std::exception&){
+		return 0;
+	}
+}
+
+int watersim_add_particle(watersim* sim, const float position[3], const float velocity[3]){
+	return sim->simulation.addParticle(glm::make_vec3(position), glm::make_vec3(velocity));
+}
+
+int watersim_add_triangle(watersim* sim, const float a[3], const float b[3], const float c[3]){
+	Triangle tri;
+	tri.a = glm::make_vec3(a);
+	tri.b = glm::make_vec3(b);
+	tri.c = glm::make_vec3(c);
+	try{
+		sim->simulation.surfaces.push_back(tri);
+		return 1;
+	}catch(const std::exception&){
+		return 0;
+	}
+}
+
+int watersim_add_plane(watersim* sim, const float matrix[16]){
+	try{
+		sim->simulation.addPlane(glm::make_mat4(matrix));
+		return 1;
+	}catch(const std::exception&){
+		return 0;
+	}
+}
+
+int watersim_add_waterfall(watersim* sim){
+	try{
+		addWaterfallPlanes(sim->simulation);
+		return 1;
+	}catch(const std::exception&){
+		return 0;
+	}
+}
+
+void watersim_set_viewer(watersim* sim, const float position[3]){
+	sim->simulation.setViewer(glm::make_vec3(position));
+}
+
+size_t watersim_particle_count(watersim* sim){
+	return sim->simulation.getNumberOfParticles();
+}
+
+watersim_buffer watersim_positions(watersim* sim){
+	return buffer(sim->simulation.positions());
+}
+
+watersim_buffer watersim_velocities(watersim* sim){
+	return buffer(sim->simulation.velocities());
+}
+
+uint64_t watersim_version(watersim* sim){
+	return sim->simulation.getVersion();
+}
+
+double watersim_step_seconds(watersim* sim){
+	return sim->simulation.stats().stepSeconds;
+}
+
+int watersim_save(watersim* sim, const char* path){
+	try{
+		return sim->simulation.save(path);
+	}catch(const std::exception&){
+		return 0;
+	}
+}
+
+int watersim_load(watersim* sim, const char* path){
+	try{
+		return sim->simulation.load(path);
+	}catch(const std::exception&){
+		return 0;
+	}
+}
@@ -15,6 +15,18 @@ namespace Water{
 		glm::vec3 a,b,c;
 	};
 
+	//Read only view of a particle array in place, the values change with
+	//every step
+	struct ParticleView{
+		const glm::vec3* data;
+		size_t size;
+		unsigned long version;
+
+		const glm::vec3& operator[](size_t i) const { return data[i]; }
+		const glm::vec3* begin() const { return data; }
+		const glm::vec3* end() const { return data + size; }
+	};
+
 	class Simulation{
 		public:
 			Simulation(size_t particles);
@@ -23,7 +35,12 @@ namespace Water{
 			void step();
 
 			//Returns the position of particle at index
-			glm::vec3 getPosition(size_t index);
+			glm::vec3 getPosition(size_t index){ return x[index]; }
+
+			//Positions and velocities of all particles, the version is the
+			//number of steps taken
+			ParticleView positions(){ ParticleView v = {x, N, steps}; return v; }
+			ParticleView velocities(){ ParticleView v = {dx, N, steps}; return v; }
 
 			//Returns the number of particles in the simulation
 			size_t getNumberOfParticles(){ return N; }
@@ -37,6 +54,7 @@ namespace Water{
 		private:
 			//Number of particles
 			size_t N;
+			unsigned long steps;
 
 			//Physical arrays
 			GLfloat* density;
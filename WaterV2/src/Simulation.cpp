@@ -31,6 +31,7 @@ Simulation::Simulation(size_t particles){
 	effectiveRadius = 0.50;
 
 	N = particles;
+	steps = 0;
 
 	density = new GLfloat[N];
 	presure = new GLfloat[N];
@@ -49,6 +50,7 @@ Simulation::Simulation(size_t particles){
 }
 
 void Simulation::step(){
+	steps++;
 	applyForces();
 
 	for(int i=0; i<N; i++){
@@ -194,10 +196,6 @@ GLfloat Simulation::findCollision(int index, Triangle tri, glm::vec3 &particleSt
 	return -1.0;
 }
 
-glm::vec3 Simulation::getPosition(size_t index){
-	return x[index];
-}
-
 void Simulation::addPlane(glm::mat4 modelMatrix){
 	Triangle t1;
 	t1.a = glm::vec3(modelMatrix*glm::vec4(-1.0,0.0,-1.0,1.0));
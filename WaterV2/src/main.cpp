@@ -172,8 +172,9 @@ int main()
         // Draw the container (using container's vertex attributes)
 
 		glUniform3f(objectColorLoc, 0.0f, 0.5f,1.01f);
-		for(int i=0; i<watersim.getNumberOfParticles(); i++){
-			sphere.draw(lightingShader, watersim.getPosition(i));
+		ParticleView positions = watersim.positions();
+		for(size_t i=0; i<positions.size; i++){
+			sphere.draw(lightingShader, positions[i]);
 		}
         glUniform3f(objectColorLoc, 1.0f, 0.5f, 0.31f);
         glm::mat4 model(1.0);